@@ -0,0 +1,10 @@
+// Stands in for avr-libc's avr/interrupt.h when the split link is built on the host. The simulated bus calls the twi
+// callbacks in line, so there is nothing to hold off
+
+#if !defined(BENCH_INTERRUPT_H)
+#define BENCH_INTERRUPT_H
+
+#define cli()
+#define sei()
+
+#endif
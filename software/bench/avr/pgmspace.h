@@ -0,0 +1,18 @@
+
+// Stands in for avr-libc's avr/pgmspace.h when the keymap is built on the host. Flash is ordinary memory here, and
+// function pointers are wider than a word, so a word read of one reads the whole pointer. Little endian hosts only
+
+#if !defined(BENCH_PGMSPACE_H)
+#define BENCH_PGMSPACE_H
+
+#include <inttypes.h>
+#include <string.h>
+
+#define PROGMEM
+#define PSTR(s) (s)
+#define pgm_read_byte(address) (*(const uint8_t *)(address))
+#define pgm_read_word(address) ({ uintptr_t value = 0; memcpy(&value, (address), sizeof(*(address))); value; })
+#define pgm_read_ptr(address) (*(const void * const *)(address))
+#define memcpy_P memcpy
+
+#endif
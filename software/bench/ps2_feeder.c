@@ -0,0 +1,306 @@
+#include <inttypes.h>
+#include <stdbool.h>
+#include <stdio.h>
+
+#include "mouse_keys.h"
+#include "ps2.h"
+#include "ps2_frame.h"
+#include "ps2_mouse.h"
+
+// ps2_feeder - ps2_mouse.c and the receiving half of ps2.c fed simulated PS/2 bit streams
+//
+// Stands in for the hardware half of ps2.c: the bytes ps2_mouse.c sends go to a simulated stick, which answers them
+// the way a real one does. Everything the stick sends goes in one bit per ps2_frame_bit call, as the interrupt does on
+// each falling clock edge, so framing, parity and cut off frames are run as they are on the keyboard. One scan per ms
+
+// The self test the simulated stick takes after a reset
+#define SELF_TEST_TIME 300
+
+static uint16_t now = 0;
+
+uint16_t timer_read(void) {
+
+	return now;
+}
+
+uint16_t timer_elapsed(uint16_t since) {
+
+	return now - since;
+}
+
+// The bits the stick is going to clock out, in order of the ms they are due in
+struct bit {
+	uint16_t time;
+	bool data;
+};
+
+#define MAX_BITS 2000
+
+static struct bit bits[MAX_BITS];
+static uint16_t num_bits;
+static uint16_t next_bit;
+
+static void queue_bit(uint16_t time, bool data) {
+
+	if(num_bits == MAX_BITS) {
+
+		fprintf(stderr, "ps2_feeder: too many bits queued\n");
+		return;
+	}
+
+	// After everything due by then, so the bits of one frame stay together
+	uint16_t i = num_bits++;
+	for(; i > next_bit && (int16_t)(bits[i - 1].time - time) > 0; --i)
+		bits[i] = bits[i - 1];
+
+	bits[i].time = time;
+	bits[i].data = data;
+}
+
+// The first length bits of a frame of byte: start bit, eight data bits, odd parity, stop bit. A wrong parity bit if
+// bad_parity is set
+static void queue_frame(uint16_t time, uint8_t byte, uint8_t length, bool bad_parity) {
+
+	uint16_t frame = (uint16_t)byte << 1;
+
+	uint8_t ones = 0;
+	for(uint8_t i = 0; i < 8; ++i)
+		ones += (byte >> i) & 1;
+
+	if(!(ones & 1) != bad_parity)
+		frame |= 1 << 9;
+	frame |= 1 << 10;
+
+	for(uint8_t i = 0; i < length; ++i)
+		queue_bit(time, frame & (1 << i));
+}
+
+static void queue_byte(uint16_t time, uint8_t byte) {
+
+	queue_frame(time, byte, 11, false);
+}
+
+// Whether the stick answers at all, and what it was sent
+static bool stick_plugged_in = true;
+
+#define MAX_COMMANDS 64
+
+static uint8_t commands[MAX_COMMANDS];
+static uint16_t command_times[MAX_COMMANDS];
+static uint8_t num_commands;
+
+static void stick_receive(uint8_t byte) {
+
+	if(num_commands < MAX_COMMANDS) {
+
+		commands[num_commands] = byte;
+		command_times[num_commands++] = now;
+	}
+
+	if(!stick_plugged_in)
+		return;
+
+	queue_byte(now + 1, 0xFA);
+
+	if(byte == 0xFF) {
+
+		queue_byte(now + SELF_TEST_TIME, 0xAA);
+		queue_byte(now + SELF_TEST_TIME + 1, 0x00);
+	}
+}
+
+// Stand ins for the hardware half of ps2.c, a byte is sent two scans after ps2_send while the clock is held low
+static bool sending = false;
+static uint8_t send_byte;
+static uint16_t send_time;
+
+void ps2_init(void) {
+
+	ps2_frame_init();
+	sending = false;
+}
+
+bool ps2_send(uint8_t byte) {
+
+	if(sending)
+		return false;
+
+	ps2_frame_cut();
+	send_byte = byte;
+	send_time = now;
+	sending = true;
+
+	return true;
+}
+
+bool ps2_sending(void) {
+
+	return sending;
+}
+
+void ps2_task(void) {
+
+	if(!sending || timer_elapsed(send_time) < 2)
+		return;
+
+	sending = false;
+	stick_receive(send_byte);
+}
+
+// What went into the mouse report
+struct move {
+	int16_t x;
+	int16_t y;
+	uint8_t buttons;
+};
+
+#define MAX_MOVES 16
+
+static struct move moves[MAX_MOVES];
+static uint8_t num_moves;
+
+void mouse_keys_pointer(int16_t x, int16_t y, uint8_t buttons) {
+
+	if(num_moves == MAX_MOVES)
+		return;
+
+	moves[num_moves].x = x;
+	moves[num_moves].y = y;
+	moves[num_moves++].buttons = buttons;
+}
+
+static void run(uint16_t length) {
+
+	for(uint16_t i = 0; i < length; ++i) {
+
+		now++;
+
+		for(; next_bit < num_bits && (int16_t)(now - bits[next_bit].time) >= 0; ++next_bit)
+			ps2_frame_bit(bits[next_bit].data, now);
+
+		ps2_mouse_task();
+	}
+}
+
+// Queued from the next ms on, and run until the stick has sent it all and the mouse code had time to act on it
+static void play(const uint8_t * bytes, uint8_t num_bytes, uint16_t gap) {
+
+	num_moves = 0;
+
+	uint16_t time = now + 1;
+	for(uint8_t i = 0; i < num_bytes; ++i, time += gap)
+		queue_byte(time, bytes[i]);
+
+	run(num_bytes * gap + 50);
+}
+
+static bool failed = false;
+
+static void check(bool ok, const char * what) {
+
+	printf("  %-56s %s\n", what, ok ? "ok" : "FAILED");
+	if(!ok)
+		failed = true;
+}
+
+static bool moved(uint8_t index, int16_t x, int16_t y, uint8_t buttons) {
+
+	return index < num_moves && moves[index].x == x && moves[index].y == y && moves[index].buttons == buttons;
+}
+
+// The setup commands ps2_mouse.c sends, from the reset on
+static const uint8_t setup[] = {0xFF, 0xF3, PS2_MOUSE_SAMPLE_RATE, 0xF4};
+
+static bool set_up_from(uint8_t first) {
+
+	if(num_commands != first + sizeof(setup))
+		return false;
+
+	for(uint8_t i = 0; i < sizeof(setup); ++i)
+		if(commands[first + i] != setup[i])
+			return false;
+
+	return true;
+}
+
+int main(void) {
+
+	ps2_mouse_init();
+
+	printf("setup\n");
+	run(1000);
+	check(set_up_from(0), "reset, sample rate and enable reporting, in order");
+
+	printf("stream\n");
+	const uint8_t right_down[] = {0x08, 0x05, 0x03};
+	play(right_down, 3, 1);
+	check(num_moves == 1 && moved(0, 5, -3, 0), "08 05 03 moves right 5 and up 3");
+	const uint8_t left_up_pressed[] = {0x39, 0xFB, 0xFD};
+	play(left_up_pressed, 3, 1);
+	check(num_moves == 1 && moved(0, -5, 3, 1), "39 FB FD moves left 5 and down 3, left button");
+	const uint8_t overflow[] = {0x4A, 0x10, 0x00};
+	play(overflow, 3, 1);
+	check(num_moves == 1 && moved(0, 0, 0, 2), "an overflowed packet only has its buttons");
+
+	printf("bad frames\n");
+	num_moves = 0;
+	queue_byte(now + 1, 0x08);
+	queue_frame(now + 2, 0x05, 11, true);
+	queue_byte(now + 3, 0x03);
+	queue_byte(now + 4, 0x08);
+	queue_byte(now + 5, 0x01);
+	queue_byte(now + 6, 0x01);
+	run(50);
+	check(num_moves == 1 && moved(0, 1, -1, 0), "a bad parity bit drops its packet, the next is kept");
+
+	num_moves = 0;
+	queue_frame(now + 1, 0x08, 6, false);
+	queue_byte(now + 5, 0x08);
+	queue_byte(now + 6, 0x02);
+	queue_byte(now + 7, 0x02);
+	run(50);
+	check(num_moves == 1 && moved(0, 2, -2, 0), "a cut off frame is dropped, the next frame is read");
+
+	num_moves = 0;
+	queue_byte(now + 1, 0x08);
+	queue_byte(now + 2, 0x05);
+	queue_byte(now + 30, 0x08);
+	queue_byte(now + 31, 0x03);
+	queue_byte(now + 32, 0x03);
+	run(80);
+	check(num_moves == 1 && moved(0, 3, -3, 0), "a packet that stops is dropped, the next is kept");
+	check(num_commands == sizeof(setup), "none of that sets the stick up again");
+
+	printf("reconnect\n");
+	const uint8_t hello_packet[] = {0xAA, 0x00, 0x10};
+	run(100);
+	play(hello_packet, 3, 1);
+	check(num_moves == 1 && moved(0, 0, 0, 2), "AA 00 10 after a pause is a packet");
+	const uint8_t packet_then_hello[] = {0x08, 0x05, 0x03, 0xAA, 0x00};
+	play(packet_then_hello, 5, 1);
+	run(1000);
+	check(num_commands == sizeof(setup), "AA 00 straight after a packet is not a reconnect");
+	const uint8_t hello[] = {0xAA, 0x00};
+	run(100);
+	play(hello, 2, 1);
+	run(1000);
+	check(set_up_from(sizeof(setup)), "AA 00 after a pause and nothing more sets it up again");
+
+	printf("unplugged\n");
+	stick_plugged_in = false;
+	uint8_t first = num_commands;
+	run(100);
+	play(hello, 2, 1);
+	run(3000);
+	check(num_commands > first + 1 && commands[first] == 0xFF && commands[first + 1] == 0xFF,
+		"a reset that isn't acked is sent again");
+	check(num_commands > first + 1 && command_times[first + 1] - command_times[first] > 1000,
+		"but only after waiting a second");
+
+	stick_plugged_in = true;
+	first = num_commands;
+	run(3000);
+	check(num_commands > first && set_up_from(num_commands - sizeof(setup)), "plugged back in it is set up again");
+
+	return failed ? 1 : 0;
+}
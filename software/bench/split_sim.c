@@ -0,0 +1,418 @@
+#include <inttypes.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "split.h"
+#include "twi.h"
+
+// split_sim - the split link run between a master, the other half and a thumb cluster on a simulated twi bus
+//
+// split.c is built three times, see the Makefile, with the functions of each build renamed after the node it runs
+// on. The bus stands in for twi.c: a write is handed to the receive callback of whichever node has the address, a
+// read takes what its transmit callback gives and pads the rest with 0xFF as the pull ups would. Transfers take one
+// or two calls of twi_result to finish and only one is on the bus at a time. Four scans per ms, each scan runs both
+// slaves and then the master's task, the way the scan loop does on each of them
+//
+// On top of that the bus can lose transfers, abandon the master's writes as if a notification had won arbitration,
+// garble reads above a speed and have nodes unplugged, and each case checks the master ends up with the keys the
+// modules have
+
+#define SPLIT_API(node) \
+	void node##_split_init(uint8_t side); \
+	bool node##_split_slave_selected(void); \
+	uint8_t node##_split_slave_leds(void); \
+	void node##_split_slave_update(const uint8_t * status); \
+	void node##_split_master_connect(void); \
+	void node##_split_master_task(uint8_t leds, uint8_t layers); \
+	uint8_t node##_split_master_keys(uint8_t side, uint8_t * status); \
+	bool node##_split_master_busy(void); \
+	uint16_t node##_split_link_speed(void); \
+	uint16_t node##_split_link_errors(void);
+
+SPLIT_API(master)
+SPLIT_API(half)
+SPLIT_API(thumb)
+
+// The thumb cluster's build, see the Makefile
+#define THUMB_FIRST_KEY 30
+#define THUMB_NUM_KEYS 5
+
+#define SCANS_PER_MS 4
+
+static uint16_t now = 0;
+
+uint16_t timer_read(void) {
+
+	return now;
+}
+
+uint16_t timer_elapsed(uint16_t since) {
+
+	return now - since;
+}
+
+struct node {
+	const char * name;
+	uint8_t address;
+	void (* receive)(uint8_t * buffer, int length);
+	void (* transmit)(void);
+	bool unplugged;
+	// Its transfer on the bus, finished once pending gets to 0
+	uint8_t pending;
+	uint8_t result;
+};
+
+static struct node master = {.name = "master"};
+static struct node half = {.name = "half"};
+static struct node thumb = {.name = "thumb"};
+static struct node * const nodes[] = {&master, &half, &thumb};
+
+#define NUM_NODES (sizeof(nodes) / sizeof(nodes[0]))
+
+// The node whose code is running, twi calls are made by it
+static struct node * current;
+
+// What the bus does to transfers
+static uint16_t bus_speed = TWI_FREQ / 1000;
+static uint16_t clean_speed = 400;
+static uint16_t lose_transfers = 0;
+static uint16_t abandon_writes = 0;
+static uint32_t bus_bytes = 0;
+
+static const uint8_t * transmit_data;
+static uint8_t transmit_length;
+
+void twi_init(void) {
+}
+
+void twi_setAddress(uint8_t address) {
+
+	current->address = address;
+}
+
+void twi_setFrequency(uint32_t frequency) {
+
+	bus_speed = frequency / 1000;
+}
+
+void twi_attachSlaveRxEvent(void (* receive)(uint8_t * buffer, int length)) {
+
+	current->receive = receive;
+}
+
+void twi_attachSlaveTxEvent(void (* transmit)(void)) {
+
+	current->transmit = transmit;
+}
+
+uint8_t twi_transmitFrom(const uint8_t * data, uint8_t length) {
+
+	transmit_data = data;
+	transmit_length = length;
+	return 0;
+}
+
+static struct node * addressed(uint8_t address) {
+
+	for(uint8_t i = 0; i < NUM_NODES; ++i)
+		if(nodes[i] != current && nodes[i]->address == address && !nodes[i]->unplugged && !current->unplugged)
+			return nodes[i];
+
+	return NULL;
+}
+
+static bool bus_busy(void) {
+
+	for(uint8_t i = 0; i < NUM_NODES; ++i)
+		if(nodes[i]->pending)
+			return true;
+
+	return false;
+}
+
+uint8_t twi_writeTo(uint8_t address, const uint8_t * data, uint8_t length, uint8_t wait, uint8_t send_stop) {
+
+	bus_bytes += 1 + length;
+
+	struct node * target = addressed(address);
+	if(!target || !target->receive)
+		return 2;
+
+	if(lose_transfers) {
+
+		lose_transfers--;
+		return 2;
+	}
+
+	uint8_t buffer[TWI_BUFFER_LENGTH];
+	memcpy(buffer, data, length);
+	target->receive(buffer, length);
+	return 0;
+}
+
+// As many bytes as asked for, whatever the node doesn't send reads as 0xFF. Above clean_speed the last byte comes
+// back with a bit flipped
+uint8_t twi_readFrom(uint8_t address, uint8_t * data, uint8_t length, uint8_t send_stop) {
+
+	bus_bytes += 1 + length;
+
+	struct node * target = addressed(address);
+	if(!target || !target->transmit)
+		return 0;
+
+	if(lose_transfers) {
+
+		lose_transfers--;
+		return 0;
+	}
+
+	transmit_length = 0;
+	target->transmit();
+
+	for(uint8_t i = 0; i < length; ++i)
+		data[i] = i < transmit_length ? transmit_data[i] : 0xFF;
+
+	if(bus_speed > clean_speed && length > 1)
+		data[length - 1] ^= 0x10;
+
+	return length;
+}
+
+static uint8_t start(uint8_t result) {
+
+	current->result = result;
+	current->pending = 1 + (rand() % 3 == 0);
+	return 0;
+}
+
+uint8_t twi_writeToAsync(uint8_t address, const uint8_t * data, uint8_t length, uint8_t send_stop) {
+
+	if(bus_busy())
+		return 1;
+
+	if(current == &master && abandon_writes) {
+
+		abandon_writes--;
+		return start(TWI_ABANDONED);
+	}
+
+	return start(twi_writeTo(address, data, length, true, send_stop));
+}
+
+uint8_t twi_readFromAsync(uint8_t address, uint8_t * data, uint8_t length, uint8_t send_stop) {
+
+	if(bus_busy())
+		return 1;
+
+	return start(twi_readFrom(address, data, length, send_stop));
+}
+
+uint8_t twi_result(void) {
+
+	if(current->pending && --current->pending)
+		return TWI_PENDING;
+
+	return current->result;
+}
+
+// The keys of each module, and what the master makes of them
+static uint8_t half_keys[SPLIT_NUM_KEYS];
+static uint8_t thumb_keys[THUMB_NUM_KEYS];
+static uint8_t master_keys[NUM_KEYBOARD_SIDES][SPLIT_NUM_KEYS];
+static uint8_t leds = 0;
+
+static void scan(void) {
+
+	current = &half;
+	half_split_slave_update(half_keys);
+	current = &thumb;
+	thumb_split_slave_update(thumb_keys);
+
+	current = &master;
+	master_split_master_task(leds, 0);
+	master_split_master_keys(RIGHT_KEYBOARD, master_keys[RIGHT_KEYBOARD]);
+	master_split_master_keys(LEFT_KEYBOARD, master_keys[LEFT_KEYBOARD]);
+}
+
+static void run(uint16_t ms) {
+
+	for(uint16_t i = 0; i < ms; ++i) {
+
+		now++;
+		for(uint8_t j = 0; j < SCANS_PER_MS; ++j)
+			scan();
+	}
+}
+
+static bool half_in_sync(void) {
+
+	return memcmp(master_keys[RIGHT_KEYBOARD], half_keys, SPLIT_NUM_KEYS) == 0;
+}
+
+static bool thumb_in_sync(void) {
+
+	for(uint8_t key = 0; key < SPLIT_NUM_KEYS; ++key) {
+
+		bool thumb_key = key >= THUMB_FIRST_KEY && key < THUMB_FIRST_KEY + THUMB_NUM_KEYS;
+		if(master_keys[LEFT_KEYBOARD][key] != (thumb_key ? thumb_keys[key - THUMB_FIRST_KEY] : 0))
+			return false;
+	}
+
+	return true;
+}
+
+static bool in_sync(void) {
+
+	return half_in_sync() && thumb_in_sync();
+}
+
+static bool master_has(uint8_t side, uint8_t key) {
+
+	return master_keys[side][key] != 0;
+}
+
+#define NEVER 0xFFFF
+
+// Runs until the condition holds, the ms it took or NEVER
+#define RUN_UNTIL(condition, limit) ({ \
+	uint16_t elapsed = 0; \
+	while(!(condition) && elapsed < (limit)) { \
+		run(1); \
+		elapsed++; \
+	} \
+	(condition) ? elapsed : NEVER; \
+})
+
+static bool failed = false;
+
+static void check(bool ok, const char * what) {
+
+	printf("  %-60s %s\n", what, ok ? "ok" : "FAILED");
+	if(!ok)
+		failed = true;
+}
+
+static void check_time(uint16_t time, uint16_t limit, const char * what) {
+
+	if(time == NEVER)
+		printf("  %-53s  never FAILED\n", what);
+	else
+		printf("  %-53s %3u ms %s\n", what, time, time <= limit ? "ok" : "FAILED");
+
+	if(time > limit)
+		failed = true;
+}
+
+int main(void) {
+
+	srand(3);
+
+	current = &half;
+	half_split_init(RIGHT_KEYBOARD);
+	current = &thumb;
+	thumb_split_init(LEFT_KEYBOARD);
+	current = &master;
+	master_split_init(LEFT_KEYBOARD);
+	master_split_master_connect();
+
+	printf("connect\n");
+	check(half_split_slave_selected() && thumb_split_slave_selected(), "both modules told they are slaves");
+	check(master_split_link_speed() == clean_speed, "the fastest speed that doesn't garble is picked");
+	check_time(RUN_UNTIL(in_sync() && !master_split_master_busy(), 100), 10, "first checkpoints");
+
+	printf("keys\n");
+	half_keys[3] = 1;
+	thumb_keys[1] = 1;
+	check_time(RUN_UNTIL(in_sync(), 100), 2, "presses on both modules");
+	bus_bytes = 0;
+	run(1000);
+	printf("  %-47s %6u bytes\n", "bus use over 1 s with keys held", (unsigned)bus_bytes);
+	half_keys[3] = 0;
+	thumb_keys[1] = 0;
+	leds = 0x04;
+	check_time(RUN_UNTIL(in_sync() && half_split_slave_leds() == leds && thumb_split_slave_leds() == leds, 100), 4,
+		"releases, and new leds on both");
+	bus_bytes = 0;
+	run(1000);
+	printf("  %-47s %6u bytes\n", "bus use over 1 s idle", (unsigned)bus_bytes);
+
+	printf("lost bus\n");
+	half_keys[5] = 1;
+	RUN_UNTIL(in_sync(), 100);
+	bool held = true;
+	for(uint16_t i = 0; i < 500 * SCANS_PER_MS; ++i) {
+
+		if(i % SCANS_PER_MS == 0)
+			now++;
+		if(i % 40 == 0) {
+
+			half_keys[6] ^= 1;
+			abandon_writes = 1;
+		}
+		scan();
+		held = held && master_has(RIGHT_KEYBOARD, 5);
+	}
+	check(held, "a held key stays down through abandoned writes");
+	half_keys[5] = 0;
+	check_time(RUN_UNTIL(in_sync(), 100), 2, "and goes up after");
+
+	printf("typing\n");
+	for(uint16_t i = 0; i < 20000; ++i) {
+
+		if(rand() % 3 == 0)
+			half_keys[rand() % SPLIT_NUM_KEYS] ^= 1;
+		if(rand() % 5 == 0)
+			thumb_keys[rand() % THUMB_NUM_KEYS] ^= 1;
+		if(rand() % 50 == 0)
+			lose_transfers = 1;
+		if(rand() % 50 == 0)
+			abandon_writes = 1;
+		if(rand() % 7 == 0)
+			now += rand() % 30;
+		scan();
+	}
+	check_time(RUN_UNTIL(in_sync(), 1000), 10, "random keys, lost and abandoned transfers");
+
+	printf("unplugged\n");
+	memset(half_keys, 0, sizeof(half_keys));
+	memset(thumb_keys, 0, sizeof(thumb_keys));
+	RUN_UNTIL(in_sync(), 100);
+	half_keys[3] = 1;
+	thumb_keys[2] = 1;
+	RUN_UNTIL(in_sync(), 100);
+	half.unplugged = true;
+	check_time(RUN_UNTIL(!master_has(RIGHT_KEYBOARD, 3), 1000), SPLIT_POLL_INTERVAL, "held key of the unplugged half let go");
+	check(master_has(LEFT_KEYBOARD, THUMB_FIRST_KEY + 2), "the thumb cluster's key stays down");
+	half_keys[3] = 0;
+	half_keys[9] = 1;
+	run(100);
+	half.unplugged = false;
+	check_time(RUN_UNTIL(in_sync(), 1000), 3 * SPLIT_REPROBE_INTERVAL, "plugged back in, synced");
+
+	printf("link speed\n");
+	uint16_t errors = master_split_link_errors();
+	clean_speed = 100;
+	half_keys[9] = 0;
+	half_keys[10] = 1;
+	check_time(RUN_UNTIL(master_split_link_speed() == clean_speed, 2000), 1000, "garbled answers slow the link");
+	check(master_split_link_errors() > errors, "and count as errors");
+	run(SPLIT_CHECKPOINT_INTERVAL);
+	check(in_sync(), "keys right again at the slower speed");
+
+	half.unplugged = true;
+	thumb.unplugged = true;
+	run(100);
+	check(!master_split_master_keys(RIGHT_KEYBOARD, master_keys[RIGHT_KEYBOARD]) &&
+		!master_split_master_keys(LEFT_KEYBOARD, master_keys[LEFT_KEYBOARD]), "nothing plugged in, no keys down");
+	clean_speed = 400;
+	half.unplugged = false;
+	check_time(RUN_UNTIL(half_in_sync() && master_has(RIGHT_KEYBOARD, 10), 1000), 3 * SPLIT_REPROBE_INTERVAL,
+		"one module plugged in alone, synced");
+	check(master_split_link_speed() == clean_speed, "and the speed probed again from the fastest");
+	thumb.unplugged = false;
+	check_time(RUN_UNTIL(in_sync(), 1000), 3 * SPLIT_REPROBE_INTERVAL, "the other plugged in as well");
+
+	return failed ? 1 : 0;
+}
@@ -0,0 +1,280 @@
+#include <inttypes.h>
+#include <stdbool.h>
+#include <stdio.h>
+
+#include "keymap.h"
+#include "usb_key_ids.h"
+
+// tap_hold_bench - how much later than a plain key a tap-hold key reaches the host
+//
+// Runs the keymap the way the main loop does, one scan per ms: keymap_task, then the key events of that scan, then
+// the report, which the host takes straight away. Each case plays a few key events against the first tap-hold key
+// in the layout and prints when its report changes, in ms after the event it waited for. A plain key is the
+// baseline, anything above its figure is latency the tap-hold code adds
+
+// Stand ins for the parts of the firmware that talk to hardware
+static uint16_t now = 0;
+
+uint16_t timer_read(void) {
+
+	return now;
+}
+
+uint16_t timer_elapsed(uint16_t since) {
+
+	return now - since;
+}
+
+void keymap_store_init(void) {
+}
+
+bool keymap_store_get(uint16_t location, uint16_t * entry) {
+
+	(void)location;
+	(void)entry;
+	return false;
+}
+
+bool keymap_store_set(uint16_t location, uint16_t entry) {
+
+	(void)location;
+	(void)entry;
+	return false;
+}
+
+void mouse_keys_init(void) {
+}
+
+void mouse_keys_press(uint16_t entry) {
+
+	(void)entry;
+}
+
+void mouse_keys_release(uint16_t entry) {
+
+	(void)entry;
+}
+
+void consumer_keys_init(void) {
+}
+
+void consumer_keys_press(uint16_t entry) {
+
+	(void)entry;
+}
+
+void consumer_keys_release(uint16_t entry) {
+
+	(void)entry;
+}
+
+// A key event due at a scan, in ms from the start of the case
+struct event {
+	uint16_t time;
+	uint8_t key;
+	bool pressed;
+};
+
+#define MAX_SCANS 1000
+#define NO_TIME 0xFFFF
+
+static uint8_t tap_hold_side;
+static uint8_t tap_hold_key;
+static uint16_t tap_hold_tap;
+static uint8_t tap_hold_layer;
+static uint8_t other_key;
+static uint16_t other_base;
+static uint16_t other_layer;
+
+// The report of each scan of the last case, and the layers active
+static uint8_t report_keys[MAX_SCANS][6];
+static uint8_t report_layers[MAX_SCANS];
+static uint16_t num_scans;
+
+// Where usage is in the report's key list, which keeps the order keys went down in, 6 if it isn't there
+static uint8_t report_position(uint16_t scan, uint16_t usage) {
+
+	uint8_t i = 0;
+	while(i < 6 && report_keys[scan][i] != usage)
+		i++;
+
+	return i;
+}
+
+static bool report_has(uint16_t scan, uint16_t usage) {
+
+	return report_position(scan, usage) < 6;
+}
+
+// The first scan from start on whose report has usage, or not if down is false
+static uint16_t first_report(uint16_t start, uint16_t usage, bool down) {
+
+	for(uint16_t scan = start; scan < num_scans; ++scan)
+		if(report_has(scan, usage) == down)
+			return scan;
+
+	return NO_TIME;
+}
+
+static uint16_t first_layer(uint16_t start, uint8_t layer) {
+
+	for(uint16_t scan = start; scan < num_scans; ++scan)
+		if(report_layers[scan] & (1 << layer))
+			return scan;
+
+	return NO_TIME;
+}
+
+static void run(const struct event * events, uint8_t num_events, uint16_t length) {
+
+	// Long enough apart that nothing from the last case is still waiting
+	for(uint16_t i = 0; i < 1000; ++i) {
+
+		now++;
+		keymap_task(true);
+	}
+
+	uint8_t next_event = 0;
+
+	for(num_scans = 0; num_scans < length && num_scans < MAX_SCANS; ++num_scans) {
+
+		now++;
+		keymap_task(true);
+
+		for(; next_event < num_events && events[next_event].time == num_scans; ++next_event) {
+
+			keymap_key_event(tap_hold_side, events[next_event].key, events[next_event].pressed);
+		}
+
+		uint8_t modifier_keys;
+		keymap_get_report(&modifier_keys, report_keys[num_scans], 6);
+		report_layers[num_scans] = keymap_layer_state();
+	}
+}
+
+static bool failed = false;
+
+static void print_latency(const char * what, uint16_t from, uint16_t to) {
+
+	if(to == NO_TIME) {
+
+		printf("  %-44s never\n", what);
+		failed = true;
+		return;
+	}
+
+	printf("  %-44s %3u ms\n", what, to - from);
+}
+
+// The first tap-hold key on the base layer, and a plain key on the same side that is something else on the layer it
+// holds
+static bool find_keys(void) {
+
+	for(uint8_t side = 0; side < NUM_KEYBOARD_SIDES; ++side) {
+
+		for(uint8_t key = 0; key < NUM_PHYSICAL_KEYS; ++key) {
+
+			uint16_t entry = keymap_get_entry(side, LAYER_BASE, key);
+			if(ACTION_KIND(entry) != ACTION_TAP_HOLD || entry == KEY_TRANSPARENT)
+				continue;
+
+			const struct keymap_tap_hold * tap_hold = &keymap_tap_holds[ACTION_PAYLOAD(entry)];
+			uint16_t hold = tap_hold->hold;
+			if(ACTION_KIND(hold) != ACTION_LAYER || ACTION_KIND(tap_hold->tap) != ACTION_KEY)
+				continue;
+
+			tap_hold_side = side;
+			tap_hold_key = key;
+			tap_hold_tap = tap_hold->tap;
+			tap_hold_layer = ACTION_PAYLOAD(hold) & 0x07;
+
+			for(other_key = 0; other_key < NUM_PHYSICAL_KEYS; ++other_key) {
+
+				other_base = keymap_get_entry(side, LAYER_BASE, other_key);
+				other_layer = keymap_get_entry(side, tap_hold_layer, other_key);
+
+				if(ACTION_KIND(other_base) == ACTION_KEY && other_base != KEY_RESERVED &&
+					other_base != KEY_TRANSPARENT && ACTION_KIND(other_layer) == ACTION_KEY &&
+					other_layer != KEY_RESERVED && other_layer != KEY_TRANSPARENT && other_layer != other_base &&
+					other_base != tap_hold_tap)
+					return true;
+			}
+		}
+	}
+
+	return false;
+}
+
+int main(void) {
+
+	keymap_init();
+
+	if(!find_keys()) {
+
+		fprintf(stderr, "tap_hold_bench: the layout has no layer tap-hold key to measure\n");
+		return 1;
+	}
+
+	uint16_t term = keymap_tap_holds[ACTION_PAYLOAD(keymap_get_entry(tap_hold_side, LAYER_BASE, tap_hold_key))].term;
+	printf("tap-hold key %u on side %u, tap 0x%02X, holds layer %u, term %u ms, other key %u\n\n", tap_hold_key,
+		tap_hold_side, tap_hold_tap, tap_hold_layer, term, other_key);
+
+	// The baseline, a plain key pressed and released
+	const struct event plain[] = {{10, 0, true}, {60, 0, false}};
+	struct event plain_events[2];
+	for(uint8_t i = 0; i < 2; ++i) {
+
+		plain_events[i] = plain[i];
+		plain_events[i].key = other_key;
+	}
+	run(plain_events, 2, 100);
+	printf("plain key\n");
+	print_latency("press to key in report", 10, first_report(10, other_base, true));
+	print_latency("release to key out of report", 60, first_report(60, other_base, false));
+
+	// Tapped well inside the term
+	const struct event tap[] = {{10, tap_hold_key, true}, {60, tap_hold_key, false}};
+	run(tap, 2, 100);
+	printf("tap\n");
+	print_latency("release to tap in report", 60, first_report(10, tap_hold_tap, true));
+	print_latency("release to tap out of report", 60, first_report(61, tap_hold_tap, false));
+
+	// Held alone past the term
+	const struct event hold[] = {{10, tap_hold_key, true}, {10 + term + 50, tap_hold_key, false}};
+	run(hold, 2, term + 100);
+	printf("hold\n");
+	print_latency("press to layer on", 10, first_layer(0, tap_hold_layer));
+	print_latency("press to layer on, less the term", 10 + term, first_layer(0, tap_hold_layer));
+
+	// Another key pressed and released inside the term, so it is held
+	const struct event permissive[] = {{10, tap_hold_key, true}, {30, other_key, true}, {50, other_key, false},
+		{80, tap_hold_key, false}};
+	run(permissive, 4, 120);
+	printf("permissive hold\n");
+	print_latency("other key press to its layer key in report", 30, first_report(0, other_layer, true));
+	print_latency("other key release to its layer key in report", 50, first_report(0, other_layer, true));
+	if(first_report(0, other_base, true) != NO_TIME || first_report(0, tap_hold_tap, true) != NO_TIME) {
+
+		printf("  the tap or the base layer key was sent as well\n");
+		failed = true;
+	}
+
+	// A roll: the tap-hold key goes up while the next key is still down, both are taps in order. Both can go out in
+	// one report, the tap then has to come first in its key list
+	const struct event roll[] = {{10, tap_hold_key, true}, {30, other_key, true}, {50, tap_hold_key, false},
+		{90, other_key, false}};
+	run(roll, 4, 120);
+	printf("roll\n");
+	uint16_t tap_time = first_report(0, tap_hold_tap, true);
+	uint16_t other_time = first_report(0, other_base, true);
+	print_latency("tap-hold release to tap in report", 50, tap_time);
+	print_latency("other key press to it in report", 30, other_time);
+	if(tap_time == NO_TIME || other_time == NO_TIME || other_time < tap_time || (other_time == tap_time &&
+		report_position(tap_time, other_base) < report_position(tap_time, tap_hold_tap))) {
+
+		printf("  the other key was not sent after the tap\n");
+		failed = true;
+	}
+
+	return failed ? 1 : 0;
+}
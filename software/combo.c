@@ -0,0 +1,174 @@
+
+#include <inttypes.h>
+#include <stdbool.h>
+#include <assert.h>
+
+#include <avr/pgmspace.h>
+
+#include "keymap.h"
+#include "combo.h"
+#include "tap_hold.h"
+#include "timer.h"
+
+#define static_assert _Static_assert
+
+// A combo is a set of keys pressed together within COMBO_TERM ms that sends its own entry instead of theirs.
+// Every key has a mask of the combos it is part of, so the combos the held keys could still make are the and of
+// their masks. That costs the same however many combos there are, and a key that isn't part of any combo is never
+// held back. Keys that could start a combo are held until:
+//
+// - no combo with more keys can still match: the combo made by the held keys fires
+// - a key that doesn't fit goes down, one of the held keys goes up or COMBO_TERM runs out: the combo made by the
+//   held keys fires if there is one, otherwise they are let through in the order they went down
+//
+// A combo is held until the first of its keys is released. It is sent on as COMBO_KEY of the left side, so a combo
+// can be a tap-hold key too
+
+static_assert(MAX_COMBOS <= 16, "combos are tracked in 16 bit masks");
+
+struct combo_key {
+	uint8_t side;
+	uint8_t key;
+};
+
+static struct combo_key held[MAX_COMBO_KEYS];
+static uint8_t held_count = 0;
+static uint16_t held_time;
+
+// The combos that have all the held keys in them
+static uint16_t candidates = 0;
+
+static uint16_t active_combos = 0;
+
+// Keys used up by a combo that fired, their releases don't go any further
+static uint8_t swallowed[NUM_KEYBOARD_SIDES][(NUM_PHYSICAL_KEYS + 7) / 8];
+
+static uint16_t combo_members(uint8_t side, uint8_t key) {
+
+	return pgm_read_word(&keymap_combo_members[side][key]);
+}
+
+static uint8_t lowest_combo(uint16_t combos) {
+
+	uint8_t combo = 0;
+	while(!(combos & 1)) {
+
+		combos >>= 1;
+		combo++;
+	}
+	return combo;
+}
+
+static void fire(uint8_t combo) {
+
+	for(uint8_t i = 0; i < held_count; ++i)
+		swallowed[held[i].side][held[i].key >> 3] |= 1 << (held[i].key & 7);
+
+	held_count = 0;
+	candidates = 0;
+	active_combos |= 1 << combo;
+
+	tap_hold_key_event(LEFT_KEYBOARD, COMBO_KEY(combo), true);
+}
+
+// Decide the held keys with nothing more to come
+static void settle(void) {
+
+	uint16_t complete = candidates & pgm_read_word(&keymap_combo_sizes[held_count]);
+
+	if(complete) {
+
+		fire(lowest_combo(complete));
+		return;
+	}
+
+	uint8_t num_keys = held_count;
+	held_count = 0;
+	candidates = 0;
+
+	for(uint8_t i = 0; i < num_keys; ++i)
+		tap_hold_key_event(held[i].side, held[i].key, true);
+}
+
+static void release_swallowed(uint8_t side, uint8_t key) {
+
+	swallowed[side][key >> 3] &= ~(1 << (key & 7));
+
+	uint16_t released = active_combos & combo_members(side, key);
+	active_combos &= ~released;
+
+	while(released) {
+
+		uint8_t combo = lowest_combo(released);
+		released &= ~(1 << combo);
+		tap_hold_key_event(LEFT_KEYBOARD, COMBO_KEY(combo), false);
+	}
+}
+
+void combo_init(void) {
+
+	held_count = 0;
+	candidates = 0;
+	active_combos = 0;
+
+	for(uint8_t side = 0; side < NUM_KEYBOARD_SIDES; ++side)
+		for(uint8_t i = 0; i < sizeof(swallowed[side]); ++i)
+			swallowed[side][i] = 0;
+}
+
+void combo_key_event(uint8_t side, uint8_t key, bool pressed) {
+
+	if(!pressed) {
+
+		for(uint8_t i = 0; i < held_count; ++i) {
+
+			if(held[i].side == side && held[i].key == key) {
+
+				settle();
+				break;
+			}
+		}
+
+		if(swallowed[side][key >> 3] & (1 << (key & 7)))
+			release_swallowed(side, key);
+		else
+			tap_hold_key_event(side, key, false);
+
+		return;
+	}
+
+	uint16_t members = combo_members(side, key);
+
+	// Doesn't fit with the held keys, decide those before looking at this one
+	if(held_count > 0 && (!(candidates & members) || held_count == MAX_COMBO_KEYS))
+		settle();
+
+	if(!members) {
+
+		tap_hold_key_event(side, key, true);
+		return;
+	}
+
+	if(held_count == 0) {
+
+		candidates = members;
+		held_time = timer_read();
+	} else {
+
+		candidates &= members;
+	}
+
+	held[held_count++] = (struct combo_key){side, key};
+
+	// Every candidate has all the held keys, so any that isn't complete needs more of them
+	uint16_t complete = candidates & pgm_read_word(&keymap_combo_sizes[held_count]);
+
+	if(complete && !(candidates & ~complete))
+		fire(lowest_combo(complete));
+}
+
+void combo_task(void) {
+
+	if(held_count > 0 && timer_elapsed(held_time) >= COMBO_TERM)
+		settle();
+}
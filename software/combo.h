@@ -0,0 +1,12 @@
+
+#if !defined(COMBO_H)
+#define COMBO_H
+
+#include <inttypes.h>
+#include <stdbool.h>
+
+void combo_init(void);
+void combo_key_event(uint8_t side, uint8_t key, bool pressed);
+void combo_task(void);
+
+#endif
@@ -0,0 +1,66 @@
+
+#include <inttypes.h>
+#include <stdbool.h>
+
+#include "consumer_keys.h"
+#include "keymap.h"
+#include "usb_keyboard.h"
+
+// Media keys go to the host on the consumer control interface, one bit each. A key pressed and released before its
+// report could be queued still goes in one report, so a quick tap isn't lost, and the report without it follows
+
+#define KEY_BIT(entry) (1 << ((entry) - MEDIA_MUTE))
+
+static uint8_t held_keys = 0;
+// Pressed since the last report was queued
+static uint8_t tapped_keys = 0;
+static uint8_t sent_keys = 0;
+
+void consumer_keys_init(void) {
+
+	held_keys = 0;
+	tapped_keys = 0;
+	sent_keys = 0;
+}
+
+void consumer_keys_press(uint16_t entry) {
+
+	held_keys |= KEY_BIT(entry);
+	tapped_keys |= KEY_BIT(entry);
+}
+
+void consumer_keys_release(uint16_t entry) {
+
+	held_keys &= ~KEY_BIT(entry);
+}
+
+// Whether there is a change the host hasn't been sent yet
+bool consumer_keys_busy(void) {
+
+	return (held_keys | tapped_keys) != sent_keys;
+}
+
+void consumer_keys_task(void) {
+
+	uint8_t keys = held_keys | tapped_keys;
+
+	if(keys == sent_keys) {
+
+		tapped_keys = 0;
+		return;
+	}
+
+	uint8_t report[CONSUMER_REPORT_SIZE] = {0};
+	report[CONSUMER_REPORT_KEYS] = keys;
+
+	// A media key pressed while the host is asleep wakes it, the report then goes out once it polls again
+	if(usb_suspended() && usb_remote_wakeup() != 0)
+		return;
+
+	// Refused while the last one is still waiting for the host, in which case try again next scan
+	if(usb_report_queue(CONSUMER_INTERFACE, report) != 0)
+		return;
+
+	sent_keys = keys;
+	tapped_keys = 0;
+}
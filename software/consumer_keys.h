@@ -0,0 +1,14 @@
+
+#if !defined(CONSUMER_KEYS_H)
+#define CONSUMER_KEYS_H
+
+#include <inttypes.h>
+#include <stdbool.h>
+
+void consumer_keys_init(void);
+void consumer_keys_press(uint16_t entry);
+void consumer_keys_release(uint16_t entry);
+bool consumer_keys_busy(void);
+void consumer_keys_task(void);
+
+#endif
@@ -290,12 +290,14 @@ section at the end of this file).
  * HID class is 3, no subclass and protocol required (but may be useful!)
  * CDC class is 2, use subclass 2 and protocol 1 for ACM
  */
-#define USB_CFG_HID_REPORT_DESCRIPTOR_LENGTH    63
+#include "../../usb_hid_desc.h"
+#define USB_CFG_HID_REPORT_DESCRIPTOR_LENGTH    HID_KEYBOARD_REPORT_DESC_SIZE
 /* Define this to the length of the HID report descriptor, if you implement
  * an HID device. Otherwise don't define it or define it to 0.
  * If you use this define, you must add a PROGMEM character array named
  * "usbHidReportDescriptor" to your code which contains the report descriptor.
  * Don't forget to keep the array and this define in sync!
+ * Here both come from the item list in usb_hid_desc.h, so they always are.
  */
 
 /* #define USB_PUBLIC static */
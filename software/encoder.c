@@ -0,0 +1,116 @@
+
+#include <inttypes.h>
+#include <stdbool.h>
+#include <assert.h>
+#define static_assert _Static_assert
+
+#include <avr/io.h>
+#include <avr/interrupt.h>
+#include <avr/pgmspace.h>
+
+#include "consumer_keys.h"
+#include "encoder.h"
+#include "keymap.h"
+
+// A rotary encoder on PD2 and PD3, which are INT2 and INT3. Both interrupt on any change and look up the step from
+// the last state of the pins to this one, so however fast it turns no step is missed and the scan loop never polls
+// the pins. The interrupt only ever adds to position and the scan loop only ever adds to consumed_position, each a
+// single byte, so neither has to turn interrupts off to read the other. Swap the pins if it turns the wrong way
+//
+// Each detent taps the entry for its direction on its own key, one detent per report with a report in between so
+// the host sees every release. Detents that come faster than that wait in position and follow on
+
+static_assert(NUM_ENCODERS == 1, "encoder.c only has pins for one encoder");
+
+#define ENCODER_PIN_A 2
+#define ENCODER_PIN_B 3
+#define ENCODER_PINS ((1 << ENCODER_PIN_A) | (1 << ENCODER_PIN_B))
+
+// Stops position getting so far ahead that the difference wraps round, about 30 detents
+#define MAX_STEPS_AHEAD 120
+
+// Indexed by the last state of the pins and this one, B then A in each, with A changing first going clockwise. Both
+// pins changing at once is a missed edge, which could have been either way, so it counts as nothing
+static const int8_t PROGMEM steps[16] = {
+	0, 1, -1, 0,
+	-1, 0, 0, 1,
+	1, 0, 0, -1,
+	0, -1, 1, 0
+};
+
+static uint8_t last_pins;
+static volatile uint8_t position = 0;
+static volatile uint8_t consumed_position = 0;
+
+// A detent was tapped and its release still has to reach the host
+static bool releasing = false;
+
+ISR(INT2_vect) {
+
+	uint8_t pins = (PIND & ENCODER_PINS) >> ENCODER_PIN_A;
+	int8_t step = pgm_read_byte(&steps[(last_pins << 2) | pins]);
+	last_pins = pins;
+
+	int8_t ahead = position - consumed_position;
+	if((step > 0 && ahead < MAX_STEPS_AHEAD) || (step < 0 && ahead > -MAX_STEPS_AHEAD))
+		position += step;
+}
+
+ISR_ALIAS(INT3_vect, INT2_vect);
+
+void encoder_init(void) {
+
+	// Inputs with pull ups, the encoder pulls them to ground
+	DDRD &= ~ENCODER_PINS;
+	PORTD |= ENCODER_PINS;
+
+	last_pins = (PIND & ENCODER_PINS) >> ENCODER_PIN_A;
+	position = 0;
+	consumed_position = 0;
+	releasing = false;
+
+	// Any change on INT2 and INT3
+	EICRA = (EICRA & ~((1 << ISC21) | (1 << ISC31))) | (1 << ISC20) | (1 << ISC30);
+	EIFR = (1 << INTF2) | (1 << INTF3);
+	EIMSK |= (1 << INT2) | (1 << INT3);
+}
+
+// Called once per scan after keymap_task, report_sent says whether the host has been given the last report. A detent
+// is a key tapped through the keymap, its report wakes a sleeping host wherever it is queued
+void encoder_task(bool report_sent) {
+
+	if(!report_sent)
+		return;
+
+	// keymap_task has just let go of the last detent, that report goes out first
+	if(releasing) {
+
+		releasing = false;
+		return;
+	}
+
+	// The report with the last media key tap or its release hasn't been queued yet
+	if(consumer_keys_busy())
+		return;
+
+	int8_t moved = position - consumed_position;
+	uint8_t direction;
+
+	if(moved >= ENCODER_STEPS_PER_DETENT) {
+
+		consumed_position += ENCODER_STEPS_PER_DETENT;
+		direction = ENCODER_CLOCKWISE;
+	} else if(moved <= -ENCODER_STEPS_PER_DETENT) {
+
+		consumed_position -= ENCODER_STEPS_PER_DETENT;
+		direction = ENCODER_COUNTER_CLOCKWISE;
+	} else {
+
+		return;
+	}
+
+	uint8_t key = ENCODER_KEY(0, direction);
+	keymap_press(LEFT_KEYBOARD, key, keymap_encoder_entry(0, direction));
+	keymap_release(LEFT_KEYBOARD, key);
+	releasing = true;
+}
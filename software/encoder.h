@@ -0,0 +1,14 @@
+
+#if !defined(ENCODER_H)
+#define ENCODER_H
+
+#include <inttypes.h>
+#include <stdbool.h>
+
+// Quadrature steps from one detent to the next, most encoders go through all four states
+#define ENCODER_STEPS_PER_DETENT 4
+
+void encoder_init(void);
+void encoder_task(bool report_sent);
+
+#endif
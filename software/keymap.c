@@ -0,0 +1,468 @@
+
+#include <inttypes.h>
+#include <stdbool.h>
+
+#include <avr/pgmspace.h>
+
+#include "keymap.h"
+#include "keymap_store.h"
+#include "combo.h"
+#include "consumer_keys.h"
+#include "leader.h"
+#include "macro.h"
+#include "mouse_keys.h"
+#include "tap_hold.h"
+#include "usb_key_ids.h"
+
+// Layers held by momentary keys, counted so two fn keys can be held at once
+static uint8_t momentary_counts[NUM_LAYERS];
+static uint8_t momentary_layers = 0;
+static uint8_t toggled_layers = 0;
+static uint8_t oneshot_layers = 0;
+// Layers switched on from outside, e.g. num lock from the host leds
+static uint8_t external_layers = 0;
+
+static uint8_t active_layers = 1 << LAYER_BASE;
+
+// The effective entry for every key given the active layers. Only rebuilt from flash when the layers change, so
+// looking up a key is always a single ram read however many layers there are
+static uint16_t effective_entries[NUM_KEYBOARD_SIDES][NUM_PHYSICAL_KEYS];
+
+// The entry each key resolved to when it went down. Used until it is released so changing layers while a key is
+// held doesn't change what it sends
+static uint16_t pressed_entries[NUM_KEYBOARD_SIDES][KEYMAP_NUM_KEYS];
+
+// Held keys in the order they went down, which is the order they go in the report. A key released before the host
+// has been sent a report with it down would never be seen, so its release waits for the next report
+#define PRESSED_SINCE_REPORT 0x01
+#define RELEASE_WAITING 0x02
+
+struct pressed_key {
+	uint8_t side;
+	uint8_t key;
+	uint8_t flags;
+};
+
+static struct pressed_key pressed_keys[KEYMAP_MAX_PRESSED];
+static uint8_t num_pressed_keys = 0;
+
+static void update_active_layers(void);
+
+// What pressing and releasing each kind of action does, on top of it going in the pressed list. Plain keys and
+// modifiers are only read from the pressed list by keymap_get_report, so they do nothing here
+typedef void (* action_handler)(uint16_t action);
+
+struct action_handlers {
+	action_handler press;
+	action_handler release;
+};
+
+static void do_nothing(uint16_t action) {
+}
+
+static void press_layer(uint16_t action) {
+
+	uint8_t layer = action & 0x07;
+	if(layer >= NUM_LAYERS)
+		return;
+
+	if(action < LAYER_TOGGLE(0)) {
+
+		momentary_counts[layer]++;
+		momentary_layers |= 1 << layer;
+	} else if(action < LAYER_ONESHOT(0)) {
+
+		toggled_layers ^= 1 << layer;
+	} else {
+
+		oneshot_layers |= 1 << layer;
+	}
+
+	update_active_layers();
+}
+
+static void release_layer(uint16_t action) {
+
+	uint8_t layer = action & 0x07;
+
+	if(action >= LAYER_TOGGLE(0) || layer >= NUM_LAYERS)
+		return;
+
+	if(momentary_counts[layer] > 0 && --momentary_counts[layer] == 0)
+		momentary_layers &= ~(1 << layer);
+
+	update_active_layers();
+}
+
+static void press_macro(uint16_t action) {
+
+	macro_play(ACTION_PAYLOAD(action));
+}
+
+static void press_leader(uint16_t action) {
+
+	leader_start();
+}
+
+// A tap-hold key is decided by tap_hold.c before it gets here, so it never does anything itself
+static const struct action_handlers PROGMEM action_kinds[NUM_ACTION_KINDS] = {
+	[ACTION_KEY] = {do_nothing, do_nothing},
+	[ACTION_MODIFIERS] = {do_nothing, do_nothing},
+	[ACTION_LAYER] = {press_layer, release_layer},
+	[ACTION_TAP_HOLD] = {do_nothing, do_nothing},
+	[ACTION_MACRO] = {press_macro, do_nothing},
+	[ACTION_MOUSE] = {mouse_keys_press, mouse_keys_release},
+	[ACTION_CONSUMER] = {consumer_keys_press, consumer_keys_release},
+	[ACTION_LEADER] = {press_leader, do_nothing}
+};
+
+// The compiled in tables, one per side with one row per layer, are generated from keymap_layout.txt. They stay in
+// flash and are only read when the layers or the keymap change, see refresh_effective_entries. Entries changed at
+// runtime are kept by keymap_store.c and take the place of these
+uint16_t keymap_default_entry(uint16_t location) {
+
+	// The locations of the right side follow on from the left side
+	if(location < NUM_LAYERS * NUM_PHYSICAL_KEYS)
+		return pgm_read_word(&keymap_left[0][0] + location);
+
+	return pgm_read_word(&keymap_right[0][0] + location - NUM_LAYERS * NUM_PHYSICAL_KEYS);
+}
+
+static uint16_t read_entry(uint16_t location) {
+
+	uint16_t entry;
+
+	if(keymap_store_get(location, &entry))
+		return entry;
+
+	return keymap_default_entry(location);
+}
+
+static void refresh_effective_entries(void) {
+
+	for(uint8_t i = 0; i < NUM_PHYSICAL_KEYS; ++i) {
+
+		uint16_t left = KEY_TRANSPARENT;
+		uint16_t right = KEY_TRANSPARENT;
+
+		for(int8_t layer = NUM_LAYERS - 1; layer >= 0; --layer) {
+
+			if(!(active_layers & (1 << layer)))
+				continue;
+
+			if(left == KEY_TRANSPARENT)
+				left = read_entry(KEYMAP_LOCATION(LEFT_KEYBOARD, layer, i));
+			if(right == KEY_TRANSPARENT)
+				right = read_entry(KEYMAP_LOCATION(RIGHT_KEYBOARD, layer, i));
+		}
+
+		effective_entries[LEFT_KEYBOARD][i] = left == KEY_TRANSPARENT ? KEY_RESERVED : left;
+		effective_entries[RIGHT_KEYBOARD][i] = right == KEY_TRANSPARENT ? KEY_RESERVED : right;
+	}
+}
+
+static void update_active_layers(void) {
+
+	uint8_t layers = (1 << LAYER_BASE) | momentary_layers | toggled_layers | oneshot_layers | external_layers;
+
+	if(layers == active_layers)
+		return;
+
+	active_layers = layers;
+	refresh_effective_entries();
+}
+
+void keymap_init(void) {
+
+	for(uint8_t i = 0; i < NUM_LAYERS; ++i)
+		momentary_counts[i] = 0;
+
+	momentary_layers = 0;
+	toggled_layers = 0;
+	oneshot_layers = 0;
+	external_layers = 0;
+	active_layers = 1 << LAYER_BASE;
+
+	for(uint8_t i = 0; i < KEYMAP_NUM_KEYS; ++i) {
+
+		pressed_entries[LEFT_KEYBOARD][i] = KEY_RESERVED;
+		pressed_entries[RIGHT_KEYBOARD][i] = KEY_RESERVED;
+	}
+
+	num_pressed_keys = 0;
+
+	keymap_store_init();
+	combo_init();
+	tap_hold_init();
+	leader_init();
+	macro_init();
+	mouse_keys_init();
+	consumer_keys_init();
+
+	refresh_effective_entries();
+}
+
+static int8_t find_pressed_key(uint8_t side, uint8_t key) {
+
+	for(uint8_t i = 0; i < num_pressed_keys; ++i)
+		if(pressed_keys[i].side == side && pressed_keys[i].key == key)
+			return i;
+
+	return -1;
+}
+
+static void release_now(uint8_t side, uint8_t key) {
+
+	uint16_t entry = pressed_entries[side][key];
+	pressed_entries[side][key] = KEY_RESERVED;
+
+	int8_t index = find_pressed_key(side, key);
+	if(index >= 0) {
+
+		num_pressed_keys--;
+		for(uint8_t i = index; i < num_pressed_keys; ++i)
+			pressed_keys[i] = pressed_keys[i + 1];
+	}
+
+	action_handler release = (action_handler)pgm_read_word(&action_kinds[ACTION_KIND(entry)].release);
+	release(entry);
+}
+
+// Key events go through combo.c and then tap_hold.c, which call keymap_press and keymap_release once they know
+// what each key sends
+void keymap_key_event(uint8_t side, uint8_t key, bool pressed) {
+
+	combo_key_event(side, key, pressed);
+}
+
+// Called once per scan, report_sent says whether the host has been given the last report
+void keymap_task(bool report_sent) {
+
+	// While a macro plays the reports are its own, so keys pressed meanwhile stay in the report until it is done
+	if(report_sent && !macro_playing()) {
+
+		uint8_t i = 0;
+		while(i < num_pressed_keys) {
+
+			if(pressed_keys[i].flags & RELEASE_WAITING) {
+
+				// Takes it out of the list
+				release_now(pressed_keys[i].side, pressed_keys[i].key);
+				continue;
+			}
+
+			pressed_keys[i++].flags = 0;
+		}
+	}
+
+	macro_task(report_sent);
+	combo_task();
+	tap_hold_task();
+	leader_task();
+}
+
+uint16_t keymap_lookup(uint8_t side, uint8_t key) {
+
+	if(key >= NUM_PHYSICAL_KEYS)
+		return pgm_read_word(&keymap_combo_entries[key - NUM_PHYSICAL_KEYS]);
+
+	return effective_entries[side][key];
+}
+
+// Encoders have an entry per direction on each layer, looked up when they turn rather than kept in effective_entries
+uint16_t keymap_encoder_entry(uint8_t encoder, uint8_t direction) {
+
+	for(int8_t layer = NUM_LAYERS - 1; layer >= 0; --layer) {
+
+		if(!(active_layers & (1 << layer)))
+			continue;
+
+		uint16_t entry = pgm_read_word(&keymap_encoders[layer][encoder][direction]);
+		if(entry != KEY_TRANSPARENT)
+			return entry;
+	}
+
+	return KEY_RESERVED;
+}
+
+void keymap_press(uint8_t side, uint8_t key, uint16_t entry) {
+
+	// Keys typed after the leader pick the sequence rather than being sent
+	if(leader_active() && ACTION_KIND(entry) == ACTION_KEY && entry != KEY_RESERVED) {
+
+		leader_key(ACTION_PAYLOAD(entry));
+		return;
+	}
+
+	// Down again before its last release went out, let that go first
+	if(find_pressed_key(side, key) >= 0)
+		release_now(side, key);
+
+	pressed_entries[side][key] = entry;
+
+	if(num_pressed_keys < KEYMAP_MAX_PRESSED)
+		pressed_keys[num_pressed_keys++] = (struct pressed_key){side, key, PRESSED_SINCE_REPORT};
+
+	// A one shot layer only lasts for the next key
+	if(ACTION_KIND(entry) != ACTION_LAYER)
+		oneshot_layers = 0;
+
+	action_handler press = (action_handler)pgm_read_word(&action_kinds[ACTION_KIND(entry)].press);
+	press(entry);
+
+	update_active_layers();
+}
+
+void keymap_release(uint8_t side, uint8_t key) {
+
+	int8_t index = find_pressed_key(side, key);
+
+	if(index >= 0 && (pressed_keys[index].flags & PRESSED_SINCE_REPORT)) {
+
+		pressed_keys[index].flags |= RELEASE_WAITING;
+		return;
+	}
+
+	release_now(side, key);
+}
+
+void keymap_set_layer(uint8_t layer, bool on) {
+
+	if(on)
+		external_layers |= 1 << layer;
+	else
+		external_layers &= ~(1 << layer);
+
+	update_active_layers();
+}
+
+uint16_t keymap_get_entry(uint8_t side, uint8_t layer, uint8_t key) {
+
+	return read_entry(KEYMAP_LOCATION(side, layer, key));
+}
+
+// Whether the handlers can carry out entry. The layout is checked by keymapc, an entry from a host tool could be
+// anything, and the handlers index arrays and shift bits by what is in the payload
+static bool valid_entry(uint16_t entry) {
+
+	if(entry == KEY_TRANSPARENT)
+		return true;
+
+	switch(ACTION_KIND(entry)) {
+
+	case ACTION_KEY:
+		return entry <= KEYMAP_MAX_USAGE;
+
+	case ACTION_MODIFIERS:
+		return entry <= MODIFIERS(0xFF);
+
+	// Momentary, toggle or oneshot, of a layer there is
+	case ACTION_LAYER:
+		return (entry & 0x07) < NUM_LAYERS && entry <= LAYER_ONESHOT(7);
+
+	case ACTION_TAP_HOLD:
+		return ACTION_PAYLOAD(entry) < NUM_TAP_HOLDS;
+
+	case ACTION_MACRO:
+		return ACTION_PAYLOAD(entry) < NUM_MACROS;
+
+	case ACTION_MOUSE:
+		return entry <= MOUSE_WHEEL_DOWN || (entry >= MOUSE_BUTTON(0) && entry < MOUSE_BUTTON(MOUSE_NUM_BUTTONS));
+
+	case ACTION_CONSUMER:
+		return entry <= MEDIA_STOP;
+
+	case ACTION_LEADER:
+		return entry == KEY_LEADER;
+	}
+
+	return false;
+}
+
+// Change an entry until it is changed again, it is saved to eeprom by keymap_store_task. Keys already held keep
+// sending what they were pressed as
+bool keymap_set_entry(uint8_t side, uint8_t layer, uint8_t key, uint16_t entry) {
+
+	if(side >= NUM_KEYBOARD_SIDES || layer >= NUM_LAYERS || key >= NUM_PHYSICAL_KEYS || !valid_entry(entry))
+		return false;
+
+	if(!keymap_store_set(KEYMAP_LOCATION(side, layer, key), entry))
+		return false;
+
+	if(active_layers & (1 << layer))
+		refresh_effective_entries();
+
+	return true;
+}
+
+// Carries out a command from a host tool and fills in its answer, see KEYMAP_COMMAND_GET_INFO
+void keymap_command(const uint8_t * command, uint8_t * answer) {
+
+	answer[0] = command[0];
+	answer[1] = KEYMAP_COMMAND_FAILED;
+	for(uint8_t i = 2; i < KEYMAP_COMMAND_SIZE; ++i)
+		answer[i] = command[i - 1];
+
+	uint8_t side = command[1];
+	uint8_t layer = command[2];
+	uint8_t key = command[3];
+	bool valid = side < NUM_KEYBOARD_SIDES && layer < NUM_LAYERS && key < NUM_PHYSICAL_KEYS;
+
+	if(command[0] == KEYMAP_COMMAND_GET_INFO) {
+
+		answer[1] = KEYMAP_COMMAND_OK;
+		answer[2] = NUM_KEYBOARD_SIDES;
+		answer[3] = NUM_LAYERS;
+		answer[4] = NUM_PHYSICAL_KEYS;
+	} else if(command[0] == KEYMAP_COMMAND_GET_ENTRY && valid) {
+
+		uint16_t entry = keymap_get_entry(side, layer, key);
+		answer[1] = KEYMAP_COMMAND_OK;
+		answer[5] = entry & 0xFF;
+		answer[6] = entry >> 8;
+	} else if(command[0] == KEYMAP_COMMAND_SET_ENTRY) {
+
+		if(keymap_set_entry(side, layer, key, command[4] | (command[5] << 8)))
+			answer[1] = KEYMAP_COMMAND_OK;
+	}
+}
+
+uint8_t keymap_layer_state(void) {
+
+	return active_layers;
+}
+
+void keymap_get_report(uint8_t * modifier_keys, uint8_t * keys, uint8_t max_keys) {
+
+	if(macro_playing()) {
+
+		macro_get_report(modifier_keys, keys, max_keys);
+		return;
+	}
+
+	uint8_t num_keys = 0;
+
+	*modifier_keys = 0;
+
+	for(uint8_t i = 0; i < max_keys; ++i)
+		keys[i] = KEY_RESERVED;
+
+	for(uint8_t i = 0; i < num_pressed_keys; ++i) {
+
+		uint16_t entry = pressed_entries[pressed_keys[i].side][pressed_keys[i].key];
+
+		if(ACTION_KIND(entry) == ACTION_MODIFIERS)
+			*modifier_keys |= ACTION_PAYLOAD(entry);
+		if(ACTION_KIND(entry) != ACTION_KEY || entry == KEY_RESERVED)
+			continue;
+
+		// Both halves have some keys in common, only report them once
+		bool duplicate = false;
+		for(uint8_t j = 0; j < num_keys; ++j)
+			duplicate |= keys[j] == entry;
+
+		// TODO: discard for now
+		if(!duplicate && num_keys < max_keys)
+			keys[num_keys++] = entry;
+	}
+}
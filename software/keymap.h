@@ -0,0 +1,164 @@
+
+#if !defined(KEYMAP_H)
+#define KEYMAP_H
+
+#include <inttypes.h>
+#include <stdbool.h>
+
+#define LEFT_KEYBOARD 0
+#define RIGHT_KEYBOARD 1
+#define NUM_KEYBOARD_SIDES 2
+
+#define NUM_MAIN_KEYS_ROWS 5
+#define NUM_MAIN_KEYS_COLS 7
+#define NUM_PHYSICAL_KEYS (NUM_MAIN_KEYS_ROWS * NUM_MAIN_KEYS_COLS)
+
+
+// Keymap entries are 16 bit actions, a kind in the top 4 bits and what to do in the other 12. Pressing or releasing
+// a key is one jump through the handlers for its kind, see keymap.c. A plain key is its hid usage, so KEY_A and the
+// rest of usb_key_ids.h can be used as they are and KEY_RESERVED is the key that sends nothing
+#define ACTION(kind, payload) (((uint16_t)(kind) << 12) | (payload))
+#define ACTION_KIND(action) ((action) >> 12)
+#define ACTION_PAYLOAD(action) ((action) & 0x0FFF)
+
+#define ACTION_KEY 0
+#define ACTION_MODIFIERS 1
+#define ACTION_LAYER 2
+#define ACTION_TAP_HOLD 3
+#define ACTION_MACRO 4
+#define ACTION_MOUSE 5
+#define ACTION_CONSUMER 6
+#define ACTION_LEADER 7
+#define NUM_ACTION_KINDS 8
+
+// Plain keys go in the report's key list, up to the last usage in the report descriptor
+#define KEYMAP_MAX_USAGE 0x68
+
+// The modifier bits in usb_key_ids.h, e.g. KEY_LEFT_SHIFT, go in the report's modifier byte
+#define MODIFIERS(bits) ACTION(ACTION_MODIFIERS, bits)
+
+#define LAYER_MOMENTARY(layer) ACTION(ACTION_LAYER, 0x00 | (layer))
+#define LAYER_TOGGLE(layer) ACTION(ACTION_LAYER, 0x08 | (layer))
+#define LAYER_ONESHOT(layer) ACTION(ACTION_LAYER, 0x10 | (layer))
+
+// Falls through to the next active layer down, the only entry that isn't an action
+#define KEY_TRANSPARENT 0xFFFF
+
+// Sends keymap_tap_holds[index].tap when tapped and acts as its hold entry, a modifier or LAYER_MOMENTARY, when held
+#define TAP_HOLD(index) ACTION(ACTION_TAP_HOLD, index)
+#define MAX_TAP_HOLDS 64
+
+// Tap-hold options, see tap_hold.c
+#define TAP_HOLD_PERMISSIVE 0x01
+#define TAP_HOLD_HOLD_ON_OTHER_PRESS 0x02
+#define TAP_HOLD_RETRO 0x04
+
+// Default tapping term in ms, a key held longer than this is held rather than tapped
+#define TAPPING_TERM 200
+
+// Mouse keys, see mouse_keys.c
+#define MOUSE_UP ACTION(ACTION_MOUSE, 0)
+#define MOUSE_DOWN ACTION(ACTION_MOUSE, 1)
+#define MOUSE_LEFT ACTION(ACTION_MOUSE, 2)
+#define MOUSE_RIGHT ACTION(ACTION_MOUSE, 3)
+#define MOUSE_WHEEL_UP ACTION(ACTION_MOUSE, 4)
+#define MOUSE_WHEEL_DOWN ACTION(ACTION_MOUSE, 5)
+#define MOUSE_BUTTON(button) ACTION(ACTION_MOUSE, 8 + (button))
+#define MOUSE_NUM_BUTTONS 5
+
+// Media keys, sent on the consumer control interface, see consumer_keys.c
+#define MEDIA_MUTE ACTION(ACTION_CONSUMER, 0)
+#define MEDIA_VOLUME_UP ACTION(ACTION_CONSUMER, 1)
+#define MEDIA_VOLUME_DOWN ACTION(ACTION_CONSUMER, 2)
+#define MEDIA_PLAY_PAUSE ACTION(ACTION_CONSUMER, 3)
+#define MEDIA_NEXT_TRACK ACTION(ACTION_CONSUMER, 4)
+#define MEDIA_PREVIOUS_TRACK ACTION(ACTION_CONSUMER, 5)
+#define MEDIA_STOP ACTION(ACTION_CONSUMER, 6)
+
+// Rotary encoders, each detent taps the entry for its direction in keymap_encoders, see encoder.c
+#define NUM_ENCODERS 1
+#define ENCODER_CLOCKWISE 0
+#define ENCODER_COUNTER_CLOCKWISE 1
+
+// Starts a leader sequence, the keys typed next pick what it does, see leader.c. Given up on if no key comes for
+// LEADER_TIMEOUT ms
+#define KEY_LEADER ACTION(ACTION_LEADER, 0)
+#define LEADER_TIMEOUT 1000
+
+// Types out keymap_macros from offset keymap_macro_offsets[index], see macro.c
+#define MACRO(index) ACTION(ACTION_MACRO, index)
+#define MAX_MACROS 16
+
+// A macro is a string of these, any byte from ' ' to '~' types that character
+#define MACRO_OP_END 0x00
+#define MACRO_OP_DOWN 0x01
+#define MACRO_OP_UP 0x02
+#define MACRO_OP_TAP 0x03
+#define MACRO_OP_WAIT 0x04
+
+// Keys pressed together within COMBO_TERM ms that send something else, see combo.c
+#define MAX_COMBOS 16
+#define MAX_COMBO_KEYS 4
+#define COMBO_TERM 50
+
+struct keymap_tap_hold {
+	uint16_t tap;
+	uint16_t hold;
+	uint16_t term;
+	uint8_t options;
+};
+
+// A node of the leader sequence trie, reached by typing key from its parent. Children are next to each other and
+// sorted by key, a node without children is the end of a sequence and sends action
+struct keymap_leader_node {
+	uint8_t key;
+	uint16_t action;
+	uint8_t num_children;
+	uint16_t first_child;
+};
+
+// Layers, their names and the tables come from keymap_layout.txt. At most 8, as many as the layer state has bits,
+// keymapc refuses more and the keymap store has a location for every entry of all 8
+#include "keymap_layout.h"
+
+// A held combo is an extra key after the physical ones, so the rest of the keymap treats it like any other key. The
+// action of a leader sequence is tapped on one more, and each direction of each encoder has one after that
+#define COMBO_KEY(combo) (NUM_PHYSICAL_KEYS + (combo))
+#define LEADER_KEY (NUM_PHYSICAL_KEYS + NUM_COMBOS)
+#define ENCODER_KEY(encoder, direction) (LEADER_KEY + 1 + (encoder) * 2 + (direction))
+#define KEYMAP_NUM_KEYS (NUM_PHYSICAL_KEYS + NUM_COMBOS + 1 + NUM_ENCODERS * 2)
+
+// Keys held at once that the report keeps the order of, more than the report can hold anyway
+#define KEYMAP_MAX_PRESSED 16
+
+// Commands from a host tool, KEYMAP_COMMAND_SIZE bytes padded with zeros, see keymap_command. The answer is the same
+// size: the command, KEYMAP_COMMAND_OK or KEYMAP_COMMAND_FAILED, then the command's own bytes and what it reads
+//
+// - KEYMAP_COMMAND_GET_INFO: sides, layers, physical keys
+// - KEYMAP_COMMAND_GET_ENTRY side, layer, key: entry low byte, entry high byte
+// - KEYMAP_COMMAND_SET_ENTRY side, layer, key, entry low byte, entry high byte
+#define KEYMAP_COMMAND_SIZE 8
+#define KEYMAP_COMMAND_GET_INFO 'i'
+#define KEYMAP_COMMAND_GET_ENTRY 'g'
+#define KEYMAP_COMMAND_SET_ENTRY 's'
+#define KEYMAP_COMMAND_OK 0
+#define KEYMAP_COMMAND_FAILED 1
+
+void keymap_init(void);
+void keymap_key_event(uint8_t side, uint8_t key, bool pressed);
+void keymap_task(bool report_sent);
+void keymap_set_layer(uint8_t layer, bool on);
+uint16_t keymap_get_entry(uint8_t side, uint8_t layer, uint8_t key);
+bool keymap_set_entry(uint8_t side, uint8_t layer, uint8_t key, uint16_t entry);
+void keymap_command(const uint8_t * command, uint8_t * answer);
+uint8_t keymap_layer_state(void);
+void keymap_get_report(uint8_t * modifier_keys, uint8_t * keys, uint8_t max_keys);
+
+// For the stages in front of the keymap, combo.c, tap_hold.c and encoder.c, which decide what a key sends before it is
+// pressed
+uint16_t keymap_lookup(uint8_t side, uint8_t key);
+uint16_t keymap_encoder_entry(uint8_t encoder, uint8_t direction);
+void keymap_press(uint8_t side, uint8_t key, uint16_t entry);
+void keymap_release(uint8_t side, uint8_t key);
+
+#endif
@@ -0,0 +1,114 @@
+
+// Generated by keymapc from ../keymap_layout.txt, edit that and rebuild rather than this
+
+#include <inttypes.h>
+#include <assert.h>
+
+#include <avr/pgmspace.h>
+
+#include "keymap.h"
+#include "keymap_layout.h"
+#include "usb_key_ids.h"
+
+#define static_assert _Static_assert
+
+static_assert(KEYMAP_LAYOUT_ROWS == NUM_MAIN_KEYS_ROWS && KEYMAP_LAYOUT_COLS == NUM_MAIN_KEYS_COLS,
+	"the layout doesn't match the key matrix");
+static_assert(KEYMAP_LAYOUT_ENCODERS == NUM_ENCODERS, "the layout doesn't match the encoders");
+
+const uint16_t PROGMEM keymap_left[NUM_LAYERS][NUM_PHYSICAL_KEYS] = {
+	[LAYER_BASE] = {
+		KEY_NUM_LOCK,              KEY_ESC,                 KEY_1,                   KEY_2,           KEY_3,                     KEY_4,            KEY_5,
+		KEY_TAB,                   KEY_LEFT_BRACE,          KEY_Q,                   KEY_W,           KEY_E,                     KEY_R,            KEY_T,
+		KEY_CAPS_LOCK,             KEY_HASH,                KEY_A,                   KEY_S,           KEY_D,                     KEY_F,            KEY_G,
+		MODIFIERS(KEY_LEFT_SHIFT), KEY_BACKSLASH,           KEY_Z,                   KEY_X,           KEY_C,                     KEY_V,            KEY_B,
+		MODIFIERS(KEY_LEFT_CTRL),  MODIFIERS(KEY_LEFT_GUI), MODIFIERS(KEY_LEFT_ALT), KEY_RESERVED,    LAYER_MOMENTARY(LAYER_FN), KEY_ENTER,        KEY_SPACE
+	},
+	[LAYER_FN] = {
+		KEY_TRANSPARENT,           KEY_TILDE,               KEY_F1,                  KEY_F2,          KEY_F3,                    KEY_F4,           KEY_F5,
+		KEY_TRANSPARENT,           KEY_TRANSPARENT,         KEY_TRANSPARENT,         KEY_TRANSPARENT, KEY_TRANSPARENT,           KEY_TRANSPARENT,  KEY_TRANSPARENT,
+		KEY_TRANSPARENT,           KEY_TRANSPARENT,         KEY_HOME,                KEY_PAGE_UP,     KEY_PAGE_DOWN,             KEY_END,          KEY_TRANSPARENT,
+		KEY_TRANSPARENT,           KEY_TRANSPARENT,         MOUSE_BUTTON(0),         MOUSE_BUTTON(2), MOUSE_BUTTON(1),           MOUSE_WHEEL_DOWN, MOUSE_WHEEL_UP,
+		KEY_TRANSPARENT,           KEY_TRANSPARENT,         KEY_TRANSPARENT,         KEY_TRANSPARENT, KEY_TRANSPARENT,           KEY_TRANSPARENT,  KEY_TRANSPARENT
+	},
+	[LAYER_NUM] = {
+		KEY_TRANSPARENT,           KEY_TRANSPARENT,         KEY_TRANSPARENT,         KEY_TRANSPARENT, KEY_TRANSPARENT,           KEY_TRANSPARENT,  KEY_TRANSPARENT,
+		KEY_TRANSPARENT,           KEY_TRANSPARENT,         KEY_TRANSPARENT,         KEY_TRANSPARENT, KEY_TRANSPARENT,           KEY_TRANSPARENT,  KEY_TRANSPARENT,
+		KEY_TRANSPARENT,           KEY_TRANSPARENT,         KEY_TRANSPARENT,         KEY_TRANSPARENT, KEY_TRANSPARENT,           KEY_TRANSPARENT,  KEY_TRANSPARENT,
+		KEY_TRANSPARENT,           KEY_TRANSPARENT,         KEY_TRANSPARENT,         KEY_TRANSPARENT, KEY_TRANSPARENT,           KEY_TRANSPARENT,  KEY_TRANSPARENT,
+		KEY_TRANSPARENT,           KEY_TRANSPARENT,         KEY_TRANSPARENT,         KEY_TRANSPARENT, KEY_TRANSPARENT,           KEY_TRANSPARENT,  KEY_TRANSPARENT
+	}
+};
+
+const uint16_t PROGMEM keymap_right[NUM_LAYERS][NUM_PHYSICAL_KEYS] = {
+	[LAYER_BASE] = {
+		KEY_6,           KEY_7,           KEY_8,                     KEY_9,           KEY_0,                    KEY_MINUS,                KEY_EQUAL,
+		KEY_Y,           KEY_U,           KEY_I,                     KEY_O,           KEY_P,                    KEY_RIGHT_BRACE,          KEY_DELETE,
+		KEY_H,           KEY_J,           KEY_K,                     KEY_L,           KEY_SEMICOLON,            KEY_QUOTE,                KEY_ENTER,
+		KEY_N,           KEY_M,           KEY_COMMA,                 KEY_PERIOD,      KEY_SLASH,                KEY_RESERVED,             MODIFIERS(KEY_RIGHT_SHIFT),
+		TAP_HOLD(0),     KEY_BACKSPACE,   LAYER_MOMENTARY(LAYER_FN), KEY_RESERVED,    MODIFIERS(KEY_RIGHT_ALT), MODIFIERS(KEY_RIGHT_GUI), MODIFIERS(KEY_RIGHT_CTRL)
+	},
+	[LAYER_FN] = {
+		KEY_F6,          KEY_F7,          KEY_F8,                    KEY_F9,          KEY_F10,                  KEY_F11,                  KEY_F12,
+		KEY_TRANSPARENT, KEY_TRANSPARENT, KEY_TRANSPARENT,           KEY_TRANSPARENT, KEY_PRINTSCREEN,          KEY_TRANSPARENT,          KEY_INSERT,
+		KEY_LEFT,        KEY_UP,          KEY_DOWN,                  KEY_RIGHT,       KEY_TRANSPARENT,          KEY_TRANSPARENT,          KEY_TRANSPARENT,
+		MOUSE_LEFT,      MOUSE_UP,        MOUSE_DOWN,                MOUSE_RIGHT,     KEY_TRANSPARENT,          KEY_TRANSPARENT,          KEY_TRANSPARENT,
+		KEY_TRANSPARENT, KEY_TRANSPARENT, KEY_TRANSPARENT,           KEY_TRANSPARENT, KEY_TRANSPARENT,          KEY_TRANSPARENT,          KEY_TRANSPARENT
+	},
+	[LAYER_NUM] = {
+		KEY_TRANSPARENT, KEYPAD_7,        KEYPAD_8,                  KEYPAD_9,        KEYPAD_ASTERIX,           KEY_TRANSPARENT,          KEY_TRANSPARENT,
+		KEY_TRANSPARENT, KEYPAD_4,        KEYPAD_5,                  KEYPAD_6,        KEYPAD_SLASH,             KEY_TRANSPARENT,          KEY_TRANSPARENT,
+		KEY_TRANSPARENT, KEYPAD_1,        KEYPAD_2,                  KEYPAD_3,        KEYPAD_PLUS,              KEY_TRANSPARENT,          KEY_TRANSPARENT,
+		KEY_TRANSPARENT, KEYPAD_ENTER,    KEYPAD_0,                  KEYPAD_PERIOD,   KEYPAD_MINUS,             KEY_TRANSPARENT,          KEY_TRANSPARENT,
+		KEY_TRANSPARENT, KEY_TRANSPARENT, KEY_TRANSPARENT,           KEY_TRANSPARENT, KEY_TRANSPARENT,          KEY_TRANSPARENT,          KEY_TRANSPARENT
+	}
+};
+
+// Tap, hold, tapping term and options of each TAP_HOLD entry
+const struct keymap_tap_hold PROGMEM keymap_tap_holds[] = {
+	[0] = {KEY_SPACE, LAYER_MOMENTARY(LAYER_FN), 200, TAP_HOLD_PERMISSIVE}
+};
+
+// The combos each key is part of, bit n is combo n
+const uint16_t PROGMEM keymap_combo_members[NUM_KEYBOARD_SIDES][NUM_PHYSICAL_KEYS] = {
+	{0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+		0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+		0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+		0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+		0x0000, 0x0000, 0x0000, 0x0000, 0x0001, 0x0000, 0x0000},
+	{0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+		0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+		0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+		0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+		0x0000, 0x0000, 0x0001, 0x0000, 0x0000, 0x0000, 0x0000}
+};
+
+// The combos with each number of keys
+const uint16_t PROGMEM keymap_combo_sizes[MAX_COMBO_KEYS + 1] = {0x0000, 0x0000, 0x0001, 0x0000, 0x0000};
+
+// What each combo sends
+const uint16_t PROGMEM keymap_combo_entries[] = {
+	[0] = LAYER_TOGGLE(LAYER_FN)
+};
+
+// The macros one after the other, each ends with MACRO_OP_END
+const uint8_t PROGMEM keymap_macros[] = {
+	MACRO_OP_END
+};
+
+// Where each macro starts in keymap_macros
+const uint16_t PROGMEM keymap_macro_offsets[] = {
+	0
+};
+
+// The leader sequences as a trie, key, action, number of children and first child
+const struct keymap_leader_node PROGMEM keymap_leader_nodes[NUM_LEADER_NODES] = {
+	[0] = {KEY_RESERVED, KEY_RESERVED, 0, 0}
+};
+
+// What each encoder sends on each layer, clockwise then counter-clockwise
+const uint16_t PROGMEM keymap_encoders[NUM_LAYERS][NUM_ENCODERS][2] = {
+	[LAYER_BASE] = {{MEDIA_VOLUME_UP, MEDIA_VOLUME_DOWN}},
+	[LAYER_FN] = {{MOUSE_WHEEL_DOWN, MOUSE_WHEEL_UP}},
+	[LAYER_NUM] = {{KEY_TRANSPARENT, KEY_TRANSPARENT}}
+};
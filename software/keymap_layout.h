@@ -0,0 +1,44 @@
+
+// Generated by keymapc from ../keymap_layout.txt, edit that and rebuild rather than this
+
+#if !defined(KEYMAP_LAYOUT_H)
+#define KEYMAP_LAYOUT_H
+
+#include <inttypes.h>
+
+#define KEYMAP_LAYOUT_ROWS 5
+#define KEYMAP_LAYOUT_COLS 7
+#define KEYMAP_LAYOUT_ENCODERS 1
+
+// Layers, the highest active layer wins
+#define LAYER_BASE 0
+#define LAYER_FN 1
+#define LAYER_NUM 2
+#define NUM_LAYERS 3
+
+// Keys that are a modifier, a layer key or a tap-hold key on any layer, bit n is key n
+#define KEYMAP_LEFT_MODIFIER_KEYS 0x0070200000ULL
+#define KEYMAP_LEFT_LAYER_KEYS 0x0100000000ULL
+#define KEYMAP_LEFT_TAP_HOLD_KEYS 0x0000000000ULL
+#define KEYMAP_RIGHT_MODIFIER_KEYS 0x0708000000ULL
+#define KEYMAP_RIGHT_LAYER_KEYS 0x0040000000ULL
+#define KEYMAP_RIGHT_TAP_HOLD_KEYS 0x0010000000ULL
+
+#define NUM_TAP_HOLDS 1
+#define NUM_COMBOS 1
+#define NUM_MACROS 0
+
+#define NUM_LEADER_NODES 1
+
+extern const uint16_t keymap_left[NUM_LAYERS][KEYMAP_LAYOUT_ROWS * KEYMAP_LAYOUT_COLS];
+extern const uint16_t keymap_right[NUM_LAYERS][KEYMAP_LAYOUT_ROWS * KEYMAP_LAYOUT_COLS];
+extern const struct keymap_tap_hold keymap_tap_holds[];
+extern const uint16_t keymap_combo_members[NUM_KEYBOARD_SIDES][KEYMAP_LAYOUT_ROWS * KEYMAP_LAYOUT_COLS];
+extern const uint16_t keymap_combo_sizes[MAX_COMBO_KEYS + 1];
+extern const uint16_t keymap_combo_entries[];
+extern const uint8_t keymap_macros[];
+extern const uint16_t keymap_macro_offsets[];
+extern const struct keymap_leader_node keymap_leader_nodes[NUM_LEADER_NODES];
+extern const uint16_t keymap_encoders[NUM_LAYERS][KEYMAP_LAYOUT_ENCODERS][2];
+
+#endif
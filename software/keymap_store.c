@@ -0,0 +1,402 @@
+
+#include <inttypes.h>
+#include <stdbool.h>
+#include <assert.h>
+
+#include <avr/io.h>
+#include <avr/eeprom.h>
+
+#include "keymap_store.h"
+
+#define static_assert _Static_assert
+
+// The eeprom is split into two banks. Edits are appended to a log in the active bank, so an edit only writes a
+// couple of bytes and consecutive edits land on different cells. When the log is full the overrides still in use
+// are copied to the start of the other bank, which then becomes the active one
+#define STORE_NUM_BANKS 2
+#define STORE_BANK_SIZE 512
+#define STORE_HEADER_SIZE 4
+#define STORE_RECORD_SIZE 4
+#define STORE_RECORDS_PER_BANK ((STORE_BANK_SIZE - STORE_HEADER_SIZE) / STORE_RECORD_SIZE)
+
+// The header is written last when a bank is filled, so a bank with a good header is always complete. The newest
+// generation wins if both banks are good
+#define STORE_MAGIC_OFFSET 0
+#define STORE_LAYOUT_LOW_OFFSET 1
+#define STORE_LAYOUT_HIGH_OFFSET 2
+#define STORE_GENERATION_OFFSET 3
+#define STORE_MAGIC 0x4D
+#define STORE_LAYOUT KEYMAP_NUM_LOCATIONS
+
+// A record is an entry then its location, both low byte first. The high byte of the location is written last, and
+// erased eeprom reads as 0xFF, which is never the high byte of a location, so the log ends at the first record
+// without one
+#define STORE_ENTRY_LOW_OFFSET 0
+#define STORE_ENTRY_HIGH_OFFSET 1
+#define STORE_LOCATION_LOW_OFFSET 2
+#define STORE_LOCATION_HIGH_OFFSET 3
+#define STORE_NO_LOCATION 0xFF
+
+static_assert(STORE_NUM_BANKS * STORE_BANK_SIZE <= E2END + 1, "keymap store doesn't fit in the eeprom");
+static_assert(KEYMAP_NUM_LOCATIONS <= STORE_NO_LOCATION * 256UL, "a location could look like the end of the log");
+static_assert(STORE_RECORDS_PER_BANK <= 0xFF, "records are counted in a byte");
+static_assert(KEYMAP_STORE_MAX_OVERRIDES <= 32, "overrides are tracked in 32 bit masks");
+static_assert(KEYMAP_STORE_MAX_OVERRIDES < STORE_RECORDS_PER_BANK - 1, "a compacted log has no room to append");
+
+// Overrides in ram. A slot set back to its default entry is kept until that has been written out
+static uint16_t override_locations[KEYMAP_STORE_MAX_OVERRIDES];
+static uint16_t override_entries[KEYMAP_STORE_MAX_OVERRIDES];
+static uint32_t override_used = 0;
+static uint32_t override_dirty = 0;
+
+// One bit per location, so a location without an override is answered without searching the slots
+static uint8_t override_mask[(KEYMAP_NUM_LOCATIONS + 7) / 8];
+
+static uint8_t active_bank = 0;
+static uint8_t active_generation = 0;
+static bool active_bank_valid = false;
+static uint8_t next_record = 0;
+
+// Writes are spread over calls to keymap_store_task, one eeprom byte each, so the scan loop never waits for the
+// eeprom
+enum store_write_state {
+	WRITE_IDLE,
+	WRITE_APPEND_ENTRY_LOW,
+	WRITE_APPEND_ENTRY_HIGH,
+	WRITE_APPEND_LOCATION_LOW,
+	WRITE_APPEND_LOCATION_HIGH,
+	WRITE_COMPACT_LAYOUT_LOW,
+	WRITE_COMPACT_LAYOUT_HIGH,
+	WRITE_COMPACT_GENERATION,
+	WRITE_COMPACT_ENTRY,
+	WRITE_COMPACT_ENTRY_HIGH,
+	WRITE_COMPACT_LOCATION_LOW,
+	WRITE_COMPACT_LOCATION_HIGH,
+	WRITE_COMPACT_MAGIC
+};
+
+static uint8_t write_state = WRITE_IDLE;
+static uint8_t write_slot = 0;
+static uint16_t write_location = 0;
+static uint16_t write_entry = 0;
+static uint8_t compact_bank = 0;
+static uint8_t compact_record = 0;
+
+static uint8_t * store_address(uint8_t bank, uint16_t offset) {
+
+	return (uint8_t *)(bank * STORE_BANK_SIZE + offset);
+}
+
+static uint8_t * record_address(uint8_t bank, uint8_t record, uint8_t offset) {
+
+	return store_address(bank, STORE_HEADER_SIZE + record * STORE_RECORD_SIZE + offset);
+}
+
+static bool bank_is_valid(uint8_t bank) {
+
+	return eeprom_read_byte(store_address(bank, STORE_MAGIC_OFFSET)) == STORE_MAGIC &&
+		eeprom_read_byte(store_address(bank, STORE_LAYOUT_LOW_OFFSET)) == (STORE_LAYOUT & 0xFF) &&
+		eeprom_read_byte(store_address(bank, STORE_LAYOUT_HIGH_OFFSET)) == STORE_LAYOUT >> 8;
+}
+
+static int8_t find_override(uint16_t location) {
+
+	if(!(override_mask[location >> 3] & (1 << (location & 7))))
+		return -1;
+
+	for(uint8_t i = 0; i < KEYMAP_STORE_MAX_OVERRIDES; ++i)
+		if((override_used & ((uint32_t)1 << i)) && override_locations[i] == location)
+			return i;
+
+	return -1;
+}
+
+static int8_t add_override(uint16_t location) {
+
+	for(uint8_t i = 0; i < KEYMAP_STORE_MAX_OVERRIDES; ++i) {
+
+		if(!(override_used & ((uint32_t)1 << i))) {
+
+			override_used |= (uint32_t)1 << i;
+			override_locations[i] = location;
+			override_mask[location >> 3] |= 1 << (location & 7);
+			return i;
+		}
+	}
+
+	return -1;
+}
+
+static void remove_override(uint8_t slot) {
+
+	uint16_t location = override_locations[slot];
+
+	override_used &= ~((uint32_t)1 << slot);
+	override_dirty &= ~((uint32_t)1 << slot);
+	override_mask[location >> 3] &= ~(1 << (location & 7));
+}
+
+static bool override_is_default(uint8_t slot) {
+
+	return override_entries[slot] == keymap_default_entry(override_locations[slot]);
+}
+
+static uint8_t lowest_slot(uint32_t slots) {
+
+	uint8_t slot = 0;
+	while(!(slots & 1)) {
+
+		slots >>= 1;
+		slot++;
+	}
+	return slot;
+}
+
+// Replay the log of a bank into ram, later records replace earlier ones
+static void load_bank(uint8_t bank) {
+
+	uint8_t record;
+	for(record = 0; record < STORE_RECORDS_PER_BANK; ++record) {
+
+		uint16_t location = eeprom_read_byte(record_address(bank, record, STORE_LOCATION_LOW_OFFSET)) |
+			(eeprom_read_byte(record_address(bank, record, STORE_LOCATION_HIGH_OFFSET)) << 8);
+
+		if(location >= KEYMAP_NUM_LOCATIONS)
+			break;
+
+		uint16_t entry = eeprom_read_byte(record_address(bank, record, STORE_ENTRY_LOW_OFFSET)) |
+			(eeprom_read_byte(record_address(bank, record, STORE_ENTRY_HIGH_OFFSET)) << 8);
+		int8_t slot = find_override(location);
+
+		if(entry == keymap_default_entry(location)) {
+
+			if(slot >= 0)
+				remove_override(slot);
+			continue;
+		}
+
+		if(slot < 0)
+			slot = add_override(location);
+
+		if(slot >= 0)
+			override_entries[slot] = entry;
+	}
+
+	next_record = record;
+}
+
+void keymap_store_init(void) {
+
+	override_used = 0;
+	override_dirty = 0;
+	for(uint8_t i = 0; i < sizeof(override_mask); ++i)
+		override_mask[i] = 0;
+
+	write_state = WRITE_IDLE;
+	next_record = 0;
+
+	bool valid[STORE_NUM_BANKS];
+	for(uint8_t bank = 0; bank < STORE_NUM_BANKS; ++bank)
+		valid[bank] = bank_is_valid(bank);
+
+	active_bank_valid = valid[0] || valid[1];
+	if(!active_bank_valid)
+		return;
+
+	uint8_t generation0 = eeprom_read_byte(store_address(0, STORE_GENERATION_OFFSET));
+	uint8_t generation1 = eeprom_read_byte(store_address(1, STORE_GENERATION_OFFSET));
+
+	// The generation wraps, so compare the difference rather than the values
+	if(valid[0] && valid[1])
+		active_bank = (int8_t)(generation1 - generation0) > 0 ? 1 : 0;
+	else
+		active_bank = valid[1] ? 1 : 0;
+
+	active_generation = active_bank ? generation1 : generation0;
+
+	load_bank(active_bank);
+}
+
+bool keymap_store_get(uint16_t location, uint16_t * entry) {
+
+	int8_t slot = find_override(location);
+
+	if(slot < 0)
+		return false;
+
+	*entry = override_entries[slot];
+	return true;
+}
+
+bool keymap_store_set(uint16_t location, uint16_t entry) {
+
+	int8_t slot = find_override(location);
+
+	if(slot < 0) {
+
+		if(entry == keymap_default_entry(location))
+			return true;
+
+		slot = add_override(location);
+
+		// All the slots are in use
+		if(slot < 0)
+			return false;
+	} else if(override_entries[slot] == entry) {
+
+		return true;
+	}
+
+	// Editing the same key again before it has been written only writes the last value
+	override_entries[slot] = entry;
+	override_dirty |= (uint32_t)1 << slot;
+	return true;
+}
+
+static void start_compaction(void) {
+
+	// Overrides back at their default are simply left out of the new bank
+	for(uint8_t i = 0; i < KEYMAP_STORE_MAX_OVERRIDES; ++i)
+		if((override_used & ((uint32_t)1 << i)) && override_is_default(i))
+			remove_override(i);
+
+	// Everything left is about to be written
+	override_dirty = 0;
+
+	compact_bank = active_bank_valid ? active_bank ^ 1 : 0;
+	compact_record = 0;
+	write_slot = 0;
+
+	eeprom_update_byte(store_address(compact_bank, STORE_MAGIC_OFFSET), 0xFF);
+	write_state = WRITE_COMPACT_LAYOUT_LOW;
+}
+
+void keymap_store_task(void) {
+
+	if(!eeprom_is_ready())
+		return;
+
+	switch(write_state) {
+
+	case WRITE_IDLE:
+
+		if(override_dirty == 0)
+			return;
+
+		// The last record in a bank is kept free so the log always ends in an empty location
+		if(!active_bank_valid || next_record >= STORE_RECORDS_PER_BANK - 1) {
+
+			start_compaction();
+			return;
+		}
+
+		write_slot = lowest_slot(override_dirty);
+		write_location = override_locations[write_slot];
+		write_entry = override_entries[write_slot];
+		override_dirty &= ~((uint32_t)1 << write_slot);
+
+		// End the log after this record before writing it, so a reset part way through loses only this edit
+		eeprom_update_byte(record_address(active_bank, next_record + 1, STORE_LOCATION_HIGH_OFFSET), STORE_NO_LOCATION);
+		write_state = WRITE_APPEND_ENTRY_LOW;
+		break;
+
+	case WRITE_APPEND_ENTRY_LOW:
+
+		eeprom_update_byte(record_address(active_bank, next_record, STORE_ENTRY_LOW_OFFSET), write_entry);
+		write_state = WRITE_APPEND_ENTRY_HIGH;
+		break;
+
+	case WRITE_APPEND_ENTRY_HIGH:
+
+		eeprom_update_byte(record_address(active_bank, next_record, STORE_ENTRY_HIGH_OFFSET), write_entry >> 8);
+		write_state = WRITE_APPEND_LOCATION_LOW;
+		break;
+
+	case WRITE_APPEND_LOCATION_LOW:
+
+		eeprom_update_byte(record_address(active_bank, next_record, STORE_LOCATION_LOW_OFFSET), write_location);
+		write_state = WRITE_APPEND_LOCATION_HIGH;
+		break;
+
+	case WRITE_APPEND_LOCATION_HIGH:
+
+		eeprom_update_byte(record_address(active_bank, next_record, STORE_LOCATION_HIGH_OFFSET), write_location >> 8);
+		next_record++;
+
+		// Once a return to the default is stored the slot can be reused
+		if(!(override_dirty & ((uint32_t)1 << write_slot)) && override_is_default(write_slot))
+			remove_override(write_slot);
+
+		write_state = WRITE_IDLE;
+		break;
+
+	case WRITE_COMPACT_LAYOUT_LOW:
+
+		eeprom_update_byte(store_address(compact_bank, STORE_LAYOUT_LOW_OFFSET), STORE_LAYOUT & 0xFF);
+		write_state = WRITE_COMPACT_LAYOUT_HIGH;
+		break;
+
+	case WRITE_COMPACT_LAYOUT_HIGH:
+
+		eeprom_update_byte(store_address(compact_bank, STORE_LAYOUT_HIGH_OFFSET), STORE_LAYOUT >> 8);
+		write_state = WRITE_COMPACT_GENERATION;
+		break;
+
+	case WRITE_COMPACT_GENERATION:
+
+		eeprom_update_byte(store_address(compact_bank, STORE_GENERATION_OFFSET), active_generation + 1);
+		write_state = WRITE_COMPACT_ENTRY;
+		break;
+
+	case WRITE_COMPACT_ENTRY:
+
+		while(write_slot < KEYMAP_STORE_MAX_OVERRIDES && !(override_used & ((uint32_t)1 << write_slot)))
+			write_slot++;
+
+		if(write_slot == KEYMAP_STORE_MAX_OVERRIDES) {
+
+			eeprom_update_byte(record_address(compact_bank, compact_record, STORE_LOCATION_HIGH_OFFSET),
+				STORE_NO_LOCATION);
+			write_state = WRITE_COMPACT_MAGIC;
+			break;
+		}
+
+		// Copied, so an edit made while the record is being written can't tear it
+		write_location = override_locations[write_slot];
+		write_entry = override_entries[write_slot];
+		eeprom_update_byte(record_address(compact_bank, compact_record, STORE_ENTRY_LOW_OFFSET), write_entry);
+		write_state = WRITE_COMPACT_ENTRY_HIGH;
+		break;
+
+	case WRITE_COMPACT_ENTRY_HIGH:
+
+		eeprom_update_byte(record_address(compact_bank, compact_record, STORE_ENTRY_HIGH_OFFSET), write_entry >> 8);
+		write_state = WRITE_COMPACT_LOCATION_LOW;
+		break;
+
+	case WRITE_COMPACT_LOCATION_LOW:
+
+		eeprom_update_byte(record_address(compact_bank, compact_record, STORE_LOCATION_LOW_OFFSET), write_location);
+		write_state = WRITE_COMPACT_LOCATION_HIGH;
+		break;
+
+	case WRITE_COMPACT_LOCATION_HIGH:
+
+		eeprom_update_byte(record_address(compact_bank, compact_record, STORE_LOCATION_HIGH_OFFSET),
+			write_location >> 8);
+		compact_record++;
+		write_slot++;
+		write_state = WRITE_COMPACT_ENTRY;
+		break;
+
+	case WRITE_COMPACT_MAGIC:
+
+		eeprom_update_byte(store_address(compact_bank, STORE_MAGIC_OFFSET), STORE_MAGIC);
+		active_bank = compact_bank;
+		active_generation++;
+		active_bank_valid = true;
+		next_record = compact_record;
+		write_state = WRITE_IDLE;
+		break;
+	}
+}
@@ -0,0 +1,26 @@
+
+#if !defined(KEYMAP_STORE_H)
+#define KEYMAP_STORE_H
+
+#include <inttypes.h>
+#include <stdbool.h>
+
+#include "keymap.h"
+
+// Keymap entries changed at runtime, kept in eeprom on top of the defaults compiled into flash. Every entry of
+// every layer on both sides has a location, up to 8 layers of them fit in the 16 bits a record keeps
+#define KEYMAP_NUM_LOCATIONS (NUM_KEYBOARD_SIDES * NUM_LAYERS * NUM_PHYSICAL_KEYS)
+#define KEYMAP_LOCATION(side, layer, key) (((side) * NUM_LAYERS + (layer)) * NUM_PHYSICAL_KEYS + (key))
+
+// How many entries can differ from the defaults at once, each one costs 3 bytes of ram
+#define KEYMAP_STORE_MAX_OVERRIDES 32
+
+// The compiled in entry for a location, from keymap.c
+uint16_t keymap_default_entry(uint16_t location);
+
+void keymap_store_init(void);
+bool keymap_store_get(uint16_t location, uint16_t * entry);
+bool keymap_store_set(uint16_t location, uint16_t entry);
+void keymap_store_task(void);
+
+#endif
@@ -0,0 +1,1666 @@
+
+// keymapc - compile a keyboard layout into the keymap tables used by keymap.c
+//
+// keymapc [-k usb_key_ids.h] [-l LAYER,LAYER,...] [-o output] layout
+//
+// The layout is either a text grid or a keyboard-layout-editor json file (anything ending in .json). Both sides
+// are described together, each row holds the left side's columns followed by the right side's. Writes output.h
+// with the layer numbers and key masks and output.c with the tables, which go in flash.
+//
+// Text grid:
+//
+//   # comment
+//   layer BASE
+//   ESC 1 2 3 4 5 6 | 7 8 9 0 MINUS EQUAL DELETE
+//   ...
+//   layer FN
+//   _ F1 F2 ...
+//   layer NUM external
+//   ...
+//
+// An external layer is switched on by the firmware rather than by a key.
+//
+// Keyboard-layout-editor: the legends of a key, separated by newlines, are its entry on each layer given with -l.
+//
+// Entries are the names in usb_key_ids.h with or without the KEY_ prefix, modifiers as LEFT_CTRL etc., _ for
+// transparent, NO for nothing and MO(layer), TG(layer) or OSL(layer) for layer keys. Names aren't case sensitive.
+// Mouse keys are MOUSE_UP, MOUSE_DOWN, MOUSE_LEFT, MOUSE_RIGHT, MOUSE_WHEEL_UP, MOUSE_WHEEL_DOWN and MOUSE_BUTTON1
+// to MOUSE_BUTTON5, see mouse_keys.c. Media keys are MEDIA_MUTE, MEDIA_VOLUME_UP, MEDIA_VOLUME_DOWN, MEDIA_PLAY_PAUSE,
+// MEDIA_NEXT_TRACK, MEDIA_PREVIOUS_TRACK and MEDIA_STOP, see consumer_keys.c.
+//
+// Tap-hold keys send one key when tapped and act as a modifier or a layer key when held. They are written with no
+// spaces as MT(modifier,key[,term][,option...]) or LT(layer,key[,term][,option...]). The term is the tapping term
+// in ms, the options PERMISSIVE, HOLD_ON_OTHER_PRESS and RETRO, see tap_hold.c.
+//
+// The text grid can also have combos, keys pressed together that send something else, see combo.c:
+//
+//   combo L4.4 R4.2 = TG(FN)
+//
+// with each key given as its side, row and column counting from 0.
+//
+// And macros, played by MACRO(name) keys, see macro.c:
+//
+//   macro SIGNATURE = "Regards,\nJo" WAIT(50) TAP(ENTER)
+//   macro COPY = DOWN(LEFT_CTRL) TAP(C) UP(LEFT_CTRL)
+//
+// Text in quotes is typed as it is on a us layout, with \n for enter, \t for tab and \" and \\ for themselves.
+// DOWN and UP hold a key or modifier and let it go, TAP presses it for one report and WAIT waits that many ms.
+//
+// And leader sequences, the keys typed after a LEADER key and what they send, see leader.c:
+//
+//   leader S I = MACRO(SIGNATURE)
+//   leader T N = TG(NUM)
+//
+// No sequence can be the start of another, so each one is decided as soon as its last key is typed.
+//
+// And in a layer, what each rotary encoder sends for a detent clockwise and counter-clockwise, see encoder.c:
+//
+//   encoder 0 = MEDIA_VOLUME_UP MEDIA_VOLUME_DOWN
+//
+// An encoder a layer doesn't mention is transparent there.
+
+#include <ctype.h>
+#include <stdarg.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// These have to match keymap.h, the generated code checks that they do
+#define NUM_KEYBOARD_SIDES 2
+#define NUM_ROWS 5
+#define NUM_COLS 7
+#define NUM_KEYS (NUM_ROWS * NUM_COLS)
+#define NUM_ENCODERS 1
+#define MAX_LAYERS 8
+
+#define KEY_RESERVED 0
+#define KEY_MOD_FIRST 0xE0
+#define KEY_MOD_LAST 0xE7
+#define KEYMAP_MAX_USAGE 0x68
+#define ACTION(kind, payload) (((uint16_t)(kind) << 12) | (payload))
+#define ACTION_KIND(action) ((action) >> 12)
+#define ACTION_PAYLOAD(action) ((action) & 0x0FFF)
+#define ACTION_MODIFIERS 1
+#define ACTION_LAYER 2
+#define ACTION_TAP_HOLD 3
+#define ACTION_MACRO 4
+#define ACTION_MOUSE 5
+#define ACTION_CONSUMER 6
+#define ACTION_LEADER 7
+#define MODIFIERS(bits) ACTION(ACTION_MODIFIERS, bits)
+#define LAYER_MOMENTARY(layer) ACTION(ACTION_LAYER, 0x00 | (layer))
+#define LAYER_TOGGLE(layer) ACTION(ACTION_LAYER, 0x08 | (layer))
+#define LAYER_ONESHOT(layer) ACTION(ACTION_LAYER, 0x10 | (layer))
+#define KEY_TRANSPARENT 0xFFFF
+#define TAP_HOLD(index) ACTION(ACTION_TAP_HOLD, index)
+#define MAX_TAP_HOLDS 64
+#define MAX_COMBOS 16
+#define MAX_COMBO_KEYS 4
+#define MACRO(index) ACTION(ACTION_MACRO, index)
+#define MAX_MACROS 16
+#define MACRO_OP_END 0x00
+#define MACRO_OP_DOWN 0x01
+#define MACRO_OP_UP 0x02
+#define MACRO_OP_TAP 0x03
+#define MACRO_OP_WAIT 0x04
+#define MAX_MACRO_BYTES 256
+#define KEY_LEADER ACTION(ACTION_LEADER, 0)
+#define MOUSE_UP ACTION(ACTION_MOUSE, 0)
+#define MOUSE_BUTTON(button) ACTION(ACTION_MOUSE, 8 + (button))
+#define MOUSE_NUM_BUTTONS 5
+#define MEDIA_MUTE ACTION(ACTION_CONSUMER, 0)
+#define MAX_LEADER_SEQUENCES 1024
+#define MAX_LEADER_LENGTH 8
+#define MAX_LEADER_NODES (MAX_LEADER_SEQUENCES * MAX_LEADER_LENGTH + 1)
+
+#define MAX_NAME 48
+#define MAX_KEY_IDS 256
+
+struct key_id {
+	char name[MAX_NAME];
+	uint8_t value;
+};
+
+static struct key_id key_ids[MAX_KEY_IDS];
+static int num_key_ids = 0;
+
+static char layer_names[MAX_LAYERS][MAX_NAME];
+static int num_layers = 0;
+
+// Layers the firmware switches on itself, e.g. from the num lock led, rather than from a key
+static uint8_t external_layers = 0;
+
+// The value and the name written to the tables for every entry
+static uint16_t entries[MAX_LAYERS][NUM_KEYBOARD_SIDES][NUM_KEYS];
+static char entry_names[MAX_LAYERS][NUM_KEYBOARD_SIDES][NUM_KEYS][MAX_NAME + 24];
+
+// The same for each encoder's clockwise and counter-clockwise detents
+static uint16_t encoder_entries[MAX_LAYERS][NUM_ENCODERS][2];
+static char encoder_names[MAX_LAYERS][NUM_ENCODERS][2][MAX_NAME + 24];
+
+// Tap-hold keys, keys with the same settings share one
+struct tap_hold {
+	char tap[MAX_NAME + 8];
+	char hold[MAX_NAME + 24];
+	char layer[MAX_NAME];
+	char term[16];
+	char options[80];
+};
+
+static struct tap_hold tap_holds[MAX_TAP_HOLDS];
+static int num_tap_holds = 0;
+
+struct combo {
+	int num_keys;
+	int sides[MAX_COMBO_KEYS];
+	int keys[MAX_COMBO_KEYS];
+	uint16_t entry;
+	char entry_name[MAX_NAME + 24];
+};
+
+static struct combo combos[MAX_COMBOS];
+static int num_combos = 0;
+
+// The bytes of each macro along with what to write for them in the table
+struct macro {
+	char name[MAX_NAME];
+	int length;
+	uint8_t bytes[MAX_MACRO_BYTES];
+	char byte_names[MAX_MACRO_BYTES][MAX_NAME + 8];
+};
+
+static struct macro macros[MAX_MACROS];
+static int num_macros = 0;
+
+struct leader_sequence {
+	int length;
+	uint8_t keys[MAX_LEADER_LENGTH];
+	char key_names[MAX_LEADER_LENGTH][MAX_NAME + 8];
+	uint16_t action;
+	char action_name[MAX_NAME + 24];
+};
+
+static struct leader_sequence leader_sequences[MAX_LEADER_SEQUENCES];
+static int num_leader_sequences = 0;
+
+// The sequences as a trie, each node's children in a list sorted by key. Node 0 is the leader key itself
+struct leader_node {
+	uint8_t key;
+	const char * key_name;
+	int sequence;
+	int first_child;
+	int next_sibling;
+	int num_children;
+};
+
+static struct leader_node leader_nodes[MAX_LEADER_NODES] = {
+	[0] = {KEY_RESERVED, "KEY_RESERVED", -1, -1, -1, 0}
+};
+static int num_leader_nodes = 1;
+
+static const char * input_name = "";
+static int input_line = 0;
+static int num_warnings = 0;
+
+static void fail(const char * format, ...) {
+
+	va_list args;
+	va_start(args, format);
+	fprintf(stderr, "%s:%d: error: ", input_name, input_line);
+	vfprintf(stderr, format, args);
+	fprintf(stderr, "\n");
+	va_end(args);
+	exit(1);
+}
+
+static void warn(const char * format, ...) {
+
+	va_list args;
+	va_start(args, format);
+	fprintf(stderr, "%s: warning: ", input_name);
+	vfprintf(stderr, format, args);
+	fprintf(stderr, "\n");
+	va_end(args);
+	num_warnings++;
+}
+
+static void to_upper(char * string) {
+
+	for(; *string; ++string)
+		*string = toupper((unsigned char)*string);
+}
+
+// Pick up every "#define KEY... value" from usb_key_ids.h
+static void load_key_ids(const char * path) {
+
+	FILE * file = fopen(path, "r");
+	if(!file) {
+
+		fprintf(stderr, "keymapc: can't open %s\n", path);
+		exit(1);
+	}
+
+	char line[256];
+	while(fgets(line, sizeof(line), file)) {
+
+		char name[MAX_NAME];
+		char value[32];
+
+		if(sscanf(line, " #define %47s %31s", name, value) != 2 || strncmp(name, "KEY", 3) != 0)
+			continue;
+
+		char * end;
+		long number = strtol(value, &end, 0);
+		if(*end != '\0' || number < 0 || number > 0xFF || num_key_ids == MAX_KEY_IDS)
+			continue;
+
+		strcpy(key_ids[num_key_ids].name, name);
+		key_ids[num_key_ids].value = number;
+		num_key_ids++;
+	}
+
+	fclose(file);
+}
+
+static const struct key_id * find_key_id(const char * name) {
+
+	for(int i = 0; i < num_key_ids; ++i)
+		if(strcmp(key_ids[i].name, name) == 0)
+			return &key_ids[i];
+
+	return NULL;
+}
+
+static int find_layer(const char * name) {
+
+	for(int i = 0; i < num_layers; ++i)
+		if(strcmp(layer_names[i], name) == 0)
+			return i;
+
+	return -1;
+}
+
+static void add_layer(const char * name) {
+
+	char upper[MAX_NAME];
+	snprintf(upper, sizeof(upper), "%s", name);
+	to_upper(upper);
+
+	if(upper[0] == '\0')
+		fail("empty layer name");
+	if(find_layer(upper) >= 0)
+		fail("layer %s is defined twice", upper);
+	if(num_layers == MAX_LAYERS)
+		fail("more than %d layers", MAX_LAYERS);
+
+	for(int encoder = 0; encoder < NUM_ENCODERS; ++encoder) {
+
+		for(int direction = 0; direction < 2; ++direction) {
+
+			encoder_entries[num_layers][encoder][direction] = KEY_TRANSPARENT;
+			strcpy(encoder_names[num_layers][encoder][direction], "KEY_TRANSPARENT");
+		}
+	}
+
+	strcpy(layer_names[num_layers++], upper);
+}
+
+// Modifiers are written without MOD_, so LEFT_SHIFT is the usage rather than the bit in usb_key_ids.h. Macros and
+// leader sequences use the usage, entries use modifier_entry
+static const struct key_id * find_usage(const char * name, char * full_name, size_t size) {
+
+	const char * prefixes[] = {"KEY_MOD_", "KEY_", ""};
+	const char * unprefixed = strncmp(name, "KEY_", 4) == 0 ? name + 4 : name;
+
+	for(unsigned i = 0; i < sizeof(prefixes) / sizeof(prefixes[0]); ++i) {
+
+		snprintf(full_name, size, "%s%s", prefixes[i], i < 2 ? unprefixed : name);
+
+		const struct key_id * id = find_key_id(full_name);
+		if(!id)
+			continue;
+
+		if(id->value > KEYMAP_MAX_USAGE && (id->value < KEY_MOD_FIRST || id->value > KEY_MOD_LAST))
+			fail("%s is past the last usage in the report descriptor (0x%02X)", full_name, KEYMAP_MAX_USAGE);
+
+		return id;
+	}
+
+	return NULL;
+}
+
+static bool is_modifier_usage(uint8_t usage) {
+
+	return usage >= KEY_MOD_FIRST && usage <= KEY_MOD_LAST;
+}
+
+// The entry for a modifier usage found by find_usage, with the bit from usb_key_ids.h in its name
+static uint16_t modifier_entry(uint8_t usage, char * name, size_t size) {
+
+	char bit_name[MAX_NAME];
+	snprintf(bit_name, sizeof(bit_name), "KEY_%.40s", name + strlen("KEY_MOD_"));
+	snprintf(name, size, "MODIFIERS(%s)", bit_name);
+
+	return MODIFIERS(1 << (usage - KEY_MOD_FIRST));
+}
+
+// MT(modifier,key,...) or LT(layer,key,...), name is already upper case
+static uint16_t parse_tap_hold(const char * token, const char * name) {
+
+	struct tap_hold tap_hold;
+	memset(&tap_hold, 0, sizeof(tap_hold));
+	strcpy(tap_hold.term, "TAPPING_TERM");
+	strcpy(tap_hold.options, "0");
+
+	char arguments[MAX_NAME];
+	snprintf(arguments, sizeof(arguments), "%s", name + 3);
+	char * close = strchr(arguments, ')');
+	if(!close || close[1] != '\0')
+		fail("missing ) in %s", token);
+	*close = '\0';
+
+	int argument = 0;
+	for(char * value = strtok(arguments, ","); value; value = strtok(NULL, ","), ++argument) {
+
+		if(argument == 0 && name[0] == 'M') {
+
+			const struct key_id * id = find_usage(value, tap_hold.hold, sizeof(tap_hold.hold));
+			if(!id || !is_modifier_usage(id->value))
+				fail("%s isn't a modifier in %s", value, token);
+			modifier_entry(id->value, tap_hold.hold, sizeof(tap_hold.hold));
+		} else if(argument == 0) {
+
+			// The layer number is filled in by resolve_entries
+			snprintf(tap_hold.layer, sizeof(tap_hold.layer), "%s", value);
+		} else if(argument == 1) {
+
+			const struct key_id * id = find_usage(value, tap_hold.tap, sizeof(tap_hold.tap));
+			if(!id || id->value > KEYMAP_MAX_USAGE)
+				fail("%s isn't a key in %s", value, token);
+		} else if(isdigit((unsigned char)value[0])) {
+
+			int term = atoi(value);
+			if(argument != 2 || term <= 0 || term > 10000)
+				fail("bad tapping term %s in %s", value, token);
+			snprintf(tap_hold.term, sizeof(tap_hold.term), "%d", term);
+		} else {
+
+			if(strcmp(value, "PERMISSIVE") != 0 && strcmp(value, "HOLD_ON_OTHER_PRESS") != 0 && strcmp(value, "RETRO") != 0)
+				fail("unknown tap-hold option %s in %s", value, token);
+
+			size_t length = strlen(tap_hold.options);
+			if(strcmp(tap_hold.options, "0") == 0)
+				length = 0;
+			snprintf(tap_hold.options + length, sizeof(tap_hold.options) - length, "%sTAP_HOLD_%s",
+				length ? " | " : "", value);
+		}
+	}
+
+	if(argument < 2)
+		fail("expected a modifier or layer and a key in %s", token);
+
+	for(int i = 0; i < num_tap_holds; ++i)
+		if(memcmp(&tap_holds[i], &tap_hold, sizeof(tap_hold)) == 0)
+			return TAP_HOLD(i);
+
+	if(num_tap_holds == MAX_TAP_HOLDS)
+		fail("more than %d different tap-hold keys", MAX_TAP_HOLDS);
+
+	tap_holds[num_tap_holds] = tap_hold;
+	return TAP_HOLD(num_tap_holds++);
+}
+
+// Turn one entry of the layout into its value and the name to write in the table. Layer keys can refer to layers
+// defined later, so they are checked once everything has been read
+static void parse_entry(const char * token, uint16_t * entry, char * entry_name) {
+
+	char name[MAX_NAME];
+	snprintf(name, sizeof(name), "%s", token);
+	to_upper(name);
+
+	if(strcmp(name, "_") == 0 || strcmp(name, "TRANSPARENT") == 0) {
+
+		*entry = KEY_TRANSPARENT;
+		strcpy(entry_name, "KEY_TRANSPARENT");
+		return;
+	}
+
+	if(strcmp(name, "NO") == 0) {
+
+		*entry = KEY_RESERVED;
+		strcpy(entry_name, "KEY_RESERVED");
+		return;
+	}
+
+	if(strcmp(name, "LEADER") == 0) {
+
+		*entry = KEY_LEADER;
+		strcpy(entry_name, "KEY_LEADER");
+		return;
+	}
+
+	// In the same order as their values
+	static const char * mouse_directions[] = {
+		"MOUSE_UP", "MOUSE_DOWN", "MOUSE_LEFT", "MOUSE_RIGHT", "MOUSE_WHEEL_UP", "MOUSE_WHEEL_DOWN"
+	};
+
+	for(unsigned i = 0; i < sizeof(mouse_directions) / sizeof(mouse_directions[0]); ++i) {
+
+		if(strcmp(name, mouse_directions[i]) == 0) {
+
+			*entry = MOUSE_UP + i;
+			strcpy(entry_name, mouse_directions[i]);
+			return;
+		}
+	}
+
+	// In the same order as their values too
+	static const char * media_keys[] = {
+		"MEDIA_MUTE", "MEDIA_VOLUME_UP", "MEDIA_VOLUME_DOWN", "MEDIA_PLAY_PAUSE", "MEDIA_NEXT_TRACK",
+		"MEDIA_PREVIOUS_TRACK", "MEDIA_STOP"
+	};
+
+	for(unsigned i = 0; i < sizeof(media_keys) / sizeof(media_keys[0]); ++i) {
+
+		if(strcmp(name, media_keys[i]) == 0) {
+
+			*entry = MEDIA_MUTE + i;
+			strcpy(entry_name, media_keys[i]);
+			return;
+		}
+	}
+
+	int button;
+	char extra;
+	if(sscanf(name, "MOUSE_BUTTON%d%c", &button, &extra) == 1) {
+
+		if(button < 1 || button > MOUSE_NUM_BUTTONS)
+			fail("there are only mouse buttons 1 to %d", MOUSE_NUM_BUTTONS);
+
+		*entry = MOUSE_BUTTON(button - 1);
+		snprintf(entry_name, MAX_NAME + 24, "MOUSE_BUTTON(%d)", button - 1);
+		return;
+	}
+
+	static const struct {
+		const char * prefix;
+		const char * macro;
+		uint16_t base;
+	} layer_actions[] = {
+		{"MO(", "LAYER_MOMENTARY", LAYER_MOMENTARY(0)},
+		{"TG(", "LAYER_TOGGLE", LAYER_TOGGLE(0)},
+		{"OSL(", "LAYER_ONESHOT", LAYER_ONESHOT(0)}
+	};
+
+	for(unsigned i = 0; i < sizeof(layer_actions) / sizeof(layer_actions[0]); ++i) {
+
+		size_t length = strlen(layer_actions[i].prefix);
+		if(strncmp(name, layer_actions[i].prefix, length) != 0)
+			continue;
+
+		char target[MAX_NAME];
+		snprintf(target, sizeof(target), "%s", name + length);
+		char * close = strchr(target, ')');
+		if(!close || close[1] != '\0')
+			fail("missing ) in %s", token);
+		*close = '\0';
+
+		// The layer number is filled in by resolve_entries
+		*entry = layer_actions[i].base;
+		snprintf(entry_name, MAX_NAME + 24, "%s(LAYER_%s)", layer_actions[i].macro, target);
+		return;
+	}
+
+	if(strncmp(name, "MACRO(", 6) == 0) {
+
+		char target[MAX_NAME];
+		snprintf(target, sizeof(target), "%s", name + 6);
+		char * close = strchr(target, ')');
+		if(!close || close[1] != '\0')
+			fail("missing ) in %s", token);
+		*close = '\0';
+
+		// The macro number is filled in by resolve_entries, macros can be defined after the keys that play them
+		*entry = MACRO(0);
+		snprintf(entry_name, MAX_NAME + 24, "MACRO(MACRO_%s)", target);
+		return;
+	}
+
+	if(strncmp(name, "MT(", 3) == 0 || strncmp(name, "LT(", 3) == 0) {
+
+		*entry = parse_tap_hold(token, name);
+		snprintf(entry_name, MAX_NAME + 24, "TAP_HOLD(%d)", ACTION_PAYLOAD(*entry));
+		return;
+	}
+
+	const struct key_id * id = find_usage(name, entry_name, MAX_NAME + 24);
+	if(!id)
+		fail("unknown key %s", token);
+
+	*entry = is_modifier_usage(id->value) ? modifier_entry(id->value, entry_name, MAX_NAME + 24) : id->value;
+}
+
+static int find_macro(const char * name) {
+
+	for(int i = 0; i < num_macros; ++i)
+		if(strcmp(macros[i].name, name) == 0)
+			return i;
+
+	return -1;
+}
+
+static void resolve_entry(uint16_t * entry, const char * entry_name, const char * where) {
+
+	if(*entry == MACRO(0)) {
+
+		// The name is MACRO(MACRO_NAME)
+		char target[MAX_NAME];
+		snprintf(target, sizeof(target), "%s", entry_name + 12);
+		target[strlen(target) - 1] = '\0';
+
+		int macro = find_macro(target);
+		if(macro < 0)
+			fail("%s refers to undefined macro %s", where, target);
+
+		*entry = MACRO(macro);
+		return;
+	}
+
+	if(ACTION_KIND(*entry) != ACTION_LAYER)
+		return;
+
+	// The name is MACRO(LAYER_NAME)
+	char target[MAX_NAME];
+	snprintf(target, sizeof(target), "%s", strstr(entry_name, "(LAYER_") + 7);
+	target[strlen(target) - 1] = '\0';
+
+	int target_layer = find_layer(target);
+	if(target_layer < 0)
+		fail("%s refers to undefined layer %s", where, target);
+
+	*entry |= target_layer;
+}
+
+static void resolve_entries(void) {
+
+	input_line = 0;
+
+	for(int i = 0; i < num_tap_holds; ++i) {
+
+		if(tap_holds[i].layer[0] == '\0')
+			continue;
+
+		if(find_layer(tap_holds[i].layer) < 0)
+			fail("tap-hold key %d refers to undefined layer %s", i, tap_holds[i].layer);
+
+		snprintf(tap_holds[i].hold, sizeof(tap_holds[i].hold), "LAYER_MOMENTARY(LAYER_%s)", tap_holds[i].layer);
+	}
+
+	for(int layer = 0; layer < num_layers; ++layer) {
+
+		for(int side = 0; side < NUM_KEYBOARD_SIDES; ++side) {
+
+			for(int key = 0; key < NUM_KEYS; ++key) {
+
+				char where[MAX_NAME * 2];
+				snprintf(where, sizeof(where), "layer %.47s, %s side, key %d", layer_names[layer], side ? "right" : "left",
+					key);
+				resolve_entry(&entries[layer][side][key], entry_names[layer][side][key], where);
+			}
+		}
+	}
+
+	for(int layer = 0; layer < num_layers; ++layer) {
+
+		for(int encoder = 0; encoder < NUM_ENCODERS; ++encoder) {
+
+			for(int direction = 0; direction < 2; ++direction) {
+
+				char where[MAX_NAME * 2];
+				snprintf(where, sizeof(where), "layer %.47s, encoder %d", layer_names[layer], encoder);
+				resolve_entry(&encoder_entries[layer][encoder][direction], encoder_names[layer][encoder][direction],
+					where);
+			}
+		}
+	}
+
+	for(int i = 0; i < num_combos; ++i) {
+
+		char where[MAX_NAME];
+		snprintf(where, sizeof(where), "combo %d", i);
+		resolve_entry(&combos[i].entry, combos[i].entry_name, where);
+	}
+
+	for(int i = 0; i < num_leader_sequences; ++i) {
+
+		char where[MAX_NAME];
+		snprintf(where, sizeof(where), "leader sequence %d", i);
+		resolve_entry(&leader_sequences[i].action, leader_sequences[i].action_name, where);
+	}
+}
+
+// Put one row of keys into a layer, the first half of the row is the left side
+static void add_row(char tokens[][MAX_NAME], int num_tokens, int layer, int row) {
+
+	if(row >= NUM_ROWS)
+		fail("layer %s has more than %d rows", layer_names[layer], NUM_ROWS);
+	if(num_tokens != NUM_KEYBOARD_SIDES * NUM_COLS)
+		fail("row %d of layer %s has %d keys, expected %d", row, layer_names[layer], num_tokens,
+			NUM_KEYBOARD_SIDES * NUM_COLS);
+
+	for(int i = 0; i < num_tokens; ++i) {
+
+		int side = i / NUM_COLS;
+		int key = row * NUM_COLS + i % NUM_COLS;
+		parse_entry(tokens[i], &entries[layer][side][key], entry_names[layer][side][key]);
+	}
+}
+
+// combo KEY KEY ... = ENTRY, each KEY is L or R then row.column
+static void add_combo(char tokens[][MAX_NAME], int num_tokens) {
+
+	if(num_combos == MAX_COMBOS)
+		fail("more than %d combos", MAX_COMBOS);
+
+	struct combo * combo = &combos[num_combos];
+	memset(combo, 0, sizeof(*combo));
+
+	int i;
+	for(i = 1; i < num_tokens && strcmp(tokens[i], "=") != 0; ++i) {
+
+		char side;
+		int row, col;
+		char extra;
+
+		if(sscanf(tokens[i], "%c%d.%d%c", &side, &row, &col, &extra) != 3 || (toupper(side) != 'L' && toupper(side) != 'R'))
+			fail("bad combo key %s, expected L or R then row.column", tokens[i]);
+		if(row < 0 || row >= NUM_ROWS || col < 0 || col >= NUM_COLS)
+			fail("combo key %s is outside the matrix", tokens[i]);
+		if(combo->num_keys == MAX_COMBO_KEYS)
+			fail("combos have at most %d keys", MAX_COMBO_KEYS);
+
+		combo->sides[combo->num_keys] = toupper(side) == 'R';
+		combo->keys[combo->num_keys] = row * NUM_COLS + col;
+
+		for(int j = 0; j < combo->num_keys; ++j)
+			if(combo->sides[j] == combo->sides[combo->num_keys] && combo->keys[j] == combo->keys[combo->num_keys])
+				fail("%s is in the combo twice", tokens[i]);
+
+		combo->num_keys++;
+	}
+
+	if(combo->num_keys < 2)
+		fail("a combo needs at least 2 keys");
+	if(i != num_tokens - 2)
+		fail("expected combo KEY KEY ... = ENTRY");
+
+	parse_entry(tokens[num_tokens - 1], &combo->entry, combo->entry_name);
+	if(combo->entry == KEY_TRANSPARENT)
+		fail("a combo can't be transparent");
+
+	// Two combos with the same keys could never both be used
+	for(int j = 0; j < num_combos; ++j) {
+
+		if(combos[j].num_keys != combo->num_keys)
+			continue;
+
+		int matches = 0;
+		for(int a = 0; a < combo->num_keys; ++a)
+			for(int b = 0; b < combo->num_keys; ++b)
+				matches += combo->sides[a] == combos[j].sides[b] && combo->keys[a] == combos[j].keys[b];
+
+		if(matches == combo->num_keys)
+			fail("combo has the same keys as combo %d", j);
+	}
+
+	num_combos++;
+}
+
+// encoder N = CLOCKWISE COUNTER_CLOCKWISE, for the layer it is in
+static void add_encoder(char tokens[][MAX_NAME], int num_tokens, int layer) {
+
+	char * end;
+	long encoder = num_tokens == 5 ? strtol(tokens[1], &end, 10) : -1;
+
+	if(num_tokens != 5 || *end != '\0' || strcmp(tokens[2], "=") != 0)
+		fail("expected encoder N = CLOCKWISE COUNTER_CLOCKWISE");
+	if(encoder < 0 || encoder >= NUM_ENCODERS)
+		fail("there %s only %d encoder%s", NUM_ENCODERS == 1 ? "is" : "are", NUM_ENCODERS, NUM_ENCODERS == 1 ? "" : "s");
+
+	for(int direction = 0; direction < 2; ++direction) {
+
+		uint16_t * entry = &encoder_entries[layer][encoder][direction];
+		parse_entry(tokens[3 + direction], entry, encoder_names[layer][encoder][direction]);
+
+		// Each detent is a press and a release straight after, so there is nothing to hold
+		if(*entry != KEY_TRANSPARENT && ACTION_KIND(*entry) == ACTION_TAP_HOLD)
+			fail("an encoder can't send %s", tokens[3 + direction]);
+	}
+}
+
+// Walk the trie along a sequence, adding the nodes that aren't there yet
+static void add_leader_nodes(int index) {
+
+	const struct leader_sequence * sequence = &leader_sequences[index];
+	int node = 0;
+
+	for(int i = 0; i < sequence->length; ++i) {
+
+		if(leader_nodes[node].sequence >= 0)
+			fail("leader sequence starts with leader sequence %d, so it could never be typed",
+				leader_nodes[node].sequence);
+
+		int * link = &leader_nodes[node].first_child;
+		while(*link >= 0 && leader_nodes[*link].key < sequence->keys[i])
+			link = &leader_nodes[*link].next_sibling;
+
+		if(*link < 0 || leader_nodes[*link].key != sequence->keys[i]) {
+
+			int child = num_leader_nodes++;
+			leader_nodes[child] = (struct leader_node){sequence->keys[i], sequence->key_names[i], -1, -1, *link, 0};
+			*link = child;
+			leader_nodes[node].num_children++;
+		}
+
+		node = *link;
+	}
+
+	if(leader_nodes[node].sequence >= 0)
+		fail("leader sequence has the same keys as leader sequence %d", leader_nodes[node].sequence);
+	if(leader_nodes[node].num_children > 0)
+		fail("leader sequence is the start of another one, so it could never be decided");
+
+	leader_nodes[node].sequence = index;
+}
+
+// leader KEY KEY ... = ENTRY
+static void add_leader(char tokens[][MAX_NAME], int num_tokens) {
+
+	if(num_leader_sequences == MAX_LEADER_SEQUENCES)
+		fail("more than %d leader sequences", MAX_LEADER_SEQUENCES);
+
+	struct leader_sequence * sequence = &leader_sequences[num_leader_sequences];
+	memset(sequence, 0, sizeof(*sequence));
+
+	int i;
+	for(i = 1; i < num_tokens && strcmp(tokens[i], "=") != 0; ++i) {
+
+		if(sequence->length == MAX_LEADER_LENGTH)
+			fail("leader sequences have at most %d keys", MAX_LEADER_LENGTH);
+
+		char name[MAX_NAME];
+		snprintf(name, sizeof(name), "%s", tokens[i]);
+		to_upper(name);
+
+		const struct key_id * id = find_usage(name, sequence->key_names[sequence->length], MAX_NAME + 8);
+		if(!id || id->value == KEY_RESERVED || id->value > KEYMAP_MAX_USAGE)
+			fail("%s isn't a key that can be in a leader sequence", tokens[i]);
+
+		sequence->keys[sequence->length++] = id->value;
+	}
+
+	if(sequence->length == 0 || i != num_tokens - 2)
+		fail("expected leader KEY KEY ... = ENTRY");
+
+	parse_entry(tokens[num_tokens - 1], &sequence->action, sequence->action_name);
+	if(sequence->action == KEY_TRANSPARENT || sequence->action == KEY_LEADER ||
+		ACTION_KIND(sequence->action) == ACTION_TAP_HOLD)
+		fail("a leader sequence can't send %s", tokens[num_tokens - 1]);
+
+	add_leader_nodes(num_leader_sequences++);
+}
+
+static void add_macro_byte(struct macro * macro, uint8_t value, const char * name) {
+
+	if(macro->length == MAX_MACRO_BYTES)
+		fail("macro %s is longer than %d bytes", macro->name, MAX_MACRO_BYTES);
+
+	macro->bytes[macro->length] = value;
+	snprintf(macro->byte_names[macro->length], sizeof(macro->byte_names[0]), "%s", name);
+	macro->length++;
+}
+
+static void add_macro_character(struct macro * macro, char character) {
+
+	char name[MAX_NAME + 8];
+
+	if(character == '\n' || character == '\t') {
+
+		const struct key_id * id = find_usage(character == '\n' ? "ENTER" : "TAB", name, sizeof(name));
+		if(!id)
+			fail("no %s in the key ids", character == '\n' ? "ENTER" : "TAB");
+
+		add_macro_byte(macro, MACRO_OP_TAP, "MACRO_OP_TAP");
+		add_macro_byte(macro, id->value, name);
+		return;
+	}
+
+	if(character < ' ' || character > '~')
+		fail("macro %s can only type printable ascii", macro->name);
+
+	if(character == '\'' || character == '\\')
+		snprintf(name, sizeof(name), "'\\%c'", character);
+	else
+		snprintf(name, sizeof(name), "'%c'", character);
+
+	add_macro_byte(macro, character, name);
+}
+
+// DOWN(KEY), UP(KEY), TAP(KEY) or WAIT(ms)
+static void add_macro_action(struct macro * macro, const char * token) {
+
+	static const struct {
+		const char * prefix;
+		const char * name;
+		uint8_t op;
+	} actions[] = {
+		{"DOWN(", "MACRO_OP_DOWN", MACRO_OP_DOWN},
+		{"UP(", "MACRO_OP_UP", MACRO_OP_UP},
+		{"TAP(", "MACRO_OP_TAP", MACRO_OP_TAP},
+		{"WAIT(", "MACRO_OP_WAIT", MACRO_OP_WAIT}
+	};
+
+	char name[MAX_NAME];
+	snprintf(name, sizeof(name), "%s", token);
+	to_upper(name);
+
+	for(unsigned i = 0; i < sizeof(actions) / sizeof(actions[0]); ++i) {
+
+		size_t length = strlen(actions[i].prefix);
+		if(strncmp(name, actions[i].prefix, length) != 0)
+			continue;
+
+		char argument[MAX_NAME];
+		snprintf(argument, sizeof(argument), "%s", name + length);
+		char * close = strchr(argument, ')');
+		if(!close || close[1] != '\0')
+			fail("missing ) in %s", token);
+		*close = '\0';
+
+		add_macro_byte(macro, actions[i].op, actions[i].name);
+
+		if(actions[i].op == MACRO_OP_WAIT) {
+
+			char * end;
+			long time = strtol(argument, &end, 10);
+			if(*end != '\0' || time <= 0 || time > 0xFFFF)
+				fail("bad wait %s in macro %s", token, macro->name);
+
+			char low[8], high[8];
+			snprintf(low, sizeof(low), "0x%02lX", time & 0xFF);
+			snprintf(high, sizeof(high), "0x%02lX", time >> 8);
+			add_macro_byte(macro, time & 0xFF, low);
+			add_macro_byte(macro, time >> 8, high);
+			return;
+		}
+
+		char usage_name[MAX_NAME + 8];
+		const struct key_id * id = find_usage(argument, usage_name, sizeof(usage_name));
+		if(!id)
+			fail("unknown key %s in macro %s", argument, macro->name);
+
+		add_macro_byte(macro, id->value, usage_name);
+		return;
+	}
+
+	fail("unknown macro action %s, expected \"text\", DOWN(key), UP(key), TAP(key) or WAIT(ms)", token);
+}
+
+// macro NAME = ..., read from the raw line as the text can have spaces and #s in it
+static void add_macro(char * line) {
+
+	if(num_macros == MAX_MACROS)
+		fail("more than %d macros", MAX_MACROS);
+
+	struct macro * macro = &macros[num_macros];
+	memset(macro, 0, sizeof(*macro));
+
+	char * cursor = strstr(line, "macro") + 5;
+	int consumed = 0;
+	if(sscanf(cursor, " %47[A-Za-z0-9_] = %n", macro->name, &consumed) != 1 || consumed == 0)
+		fail("expected macro NAME = ...");
+	cursor += consumed;
+
+	to_upper(macro->name);
+	if(find_macro(macro->name) >= 0)
+		fail("macro %s is defined twice", macro->name);
+
+	while(*cursor && *cursor != '#') {
+
+		if(isspace((unsigned char)*cursor)) {
+
+			cursor++;
+			continue;
+		}
+
+		if(*cursor == '"') {
+
+			for(cursor++; *cursor != '"'; cursor++) {
+
+				if(*cursor == '\0' || *cursor == '\n')
+					fail("unterminated text in macro %s", macro->name);
+
+				char character = *cursor;
+				if(character == '\\') {
+
+					cursor++;
+					if(*cursor == 'n')
+						character = '\n';
+					else if(*cursor == 't')
+						character = '\t';
+					else if(*cursor == '"' || *cursor == '\\')
+						character = *cursor;
+					else
+						fail("unknown escape \\%c in macro %s", *cursor, macro->name);
+				}
+
+				add_macro_character(macro, character);
+			}
+
+			cursor++;
+			continue;
+		}
+
+		char token[MAX_NAME];
+		size_t length = strcspn(cursor, " \t\r\n#\"");
+		snprintf(token, sizeof(token), "%.*s", (int)length, cursor);
+		cursor += length;
+
+		add_macro_action(macro, token);
+	}
+
+	if(macro->length == 0)
+		fail("macro %s is empty", macro->name);
+
+	add_macro_byte(macro, MACRO_OP_END, "MACRO_OP_END");
+	num_macros++;
+}
+
+static void read_grid(FILE * file) {
+
+	char line[1024];
+	int layer = -1;
+	int row = 0;
+
+	while(fgets(line, sizeof(line), file)) {
+
+		input_line++;
+
+		// Macro text can have anything in it, so these lines are taken apart separately
+		char keyword[8];
+		if(sscanf(line, " %7s", keyword) == 1 && strcmp(keyword, "macro") == 0) {
+
+			add_macro(line);
+			continue;
+		}
+
+		char * comment = strchr(line, '#');
+		if(comment)
+			*comment = '\0';
+
+		char tokens[NUM_KEYBOARD_SIDES * NUM_COLS + 2][MAX_NAME];
+		int num_tokens = 0;
+		int split = -1;
+
+		for(char * token = strtok(line, " \t\r\n"); token; token = strtok(NULL, " \t\r\n")) {
+
+			if(strcmp(token, "|") == 0) {
+
+				split = num_tokens;
+				continue;
+			}
+
+			if(num_tokens == NUM_KEYBOARD_SIDES * NUM_COLS + 2)
+				fail("too many keys in row");
+			snprintf(tokens[num_tokens++], MAX_NAME, "%s", token);
+		}
+
+		if(num_tokens == 0)
+			continue;
+
+		if(strcmp(tokens[0], "layer") == 0) {
+
+			if(num_tokens != 2 && (num_tokens != 3 || strcmp(tokens[2], "external") != 0))
+				fail("expected layer NAME or layer NAME external");
+			if(layer >= 0 && row != NUM_ROWS)
+				fail("layer %s has %d rows, expected %d", layer_names[layer], row, NUM_ROWS);
+
+			add_layer(tokens[1]);
+			layer = num_layers - 1;
+			row = 0;
+
+			if(num_tokens == 3)
+				external_layers |= 1 << layer;
+			continue;
+		}
+
+		if(strcmp(tokens[0], "combo") == 0) {
+
+			add_combo(tokens, num_tokens);
+			continue;
+		}
+
+		if(strcmp(tokens[0], "leader") == 0) {
+
+			add_leader(tokens, num_tokens);
+			continue;
+		}
+
+		if(layer < 0)
+			fail("keys before the first layer");
+
+		if(strcmp(tokens[0], "encoder") == 0) {
+
+			add_encoder(tokens, num_tokens, layer);
+			continue;
+		}
+
+		// The split is optional, but if it is there it has to be in the middle
+		if(split >= 0 && split != NUM_COLS)
+			fail("| after %d keys, expected %d", split, NUM_COLS);
+
+		add_row(tokens, num_tokens, layer, row++);
+	}
+
+	if(layer < 0)
+		fail("no layers");
+	if(row != NUM_ROWS)
+		fail("layer %s has %d rows, expected %d", layer_names[layer], row, NUM_ROWS);
+}
+
+// Just enough json for keyboard-layout-editor's raw data: an array of rows, each an array of legends, with
+// objects in between for key sizes and the like which don't matter here
+static int json_next(FILE * file) {
+
+	int c;
+	while((c = fgetc(file)) != EOF) {
+
+		if(c == '\n')
+			input_line++;
+		if(!isspace(c))
+			return c;
+	}
+	return EOF;
+}
+
+static void json_string(FILE * file, char * out, size_t size) {
+
+	size_t length = 0;
+	int c;
+
+	while((c = fgetc(file)) != '"') {
+
+		if(c == EOF)
+			fail("unterminated string");
+
+		if(c == '\\') {
+
+			c = fgetc(file);
+			if(c == 'n')
+				c = '\n';
+		}
+
+		if(length + 1 < size)
+			out[length++] = c;
+	}
+
+	out[length] = '\0';
+}
+
+static void json_skip_object(FILE * file) {
+
+	int depth = 1;
+	char ignored[256];
+
+	while(depth > 0) {
+
+		int c = json_next(file);
+		if(c == EOF)
+			fail("unterminated object");
+		else if(c == '"')
+			json_string(file, ignored, sizeof(ignored));
+		else if(c == '{')
+			depth++;
+		else if(c == '}')
+			depth--;
+	}
+}
+
+static void read_kle(FILE * file) {
+
+	if(num_layers == 0)
+		add_layer("BASE");
+
+	input_line = 1;
+	if(json_next(file) != '[')
+		fail("expected [");
+
+	int row = 0;
+
+	for(;;) {
+
+		int c = json_next(file);
+
+		if(c == ']')
+			break;
+		if(c == ',')
+			continue;
+		if(c == '{') {
+
+			// Metadata
+			json_skip_object(file);
+			continue;
+		}
+		if(c != '[')
+			fail("expected a row");
+
+		static char tokens[MAX_LAYERS][NUM_KEYBOARD_SIDES * NUM_COLS][MAX_NAME];
+		int num_keys = 0;
+
+		while((c = json_next(file)) != ']') {
+
+			if(c == ',')
+				continue;
+			if(c == '{') {
+
+				json_skip_object(file);
+				continue;
+			}
+			if(c != '"')
+				fail("expected a key legend");
+
+			char legend[256];
+			json_string(file, legend, sizeof(legend));
+
+			if(num_keys == NUM_KEYBOARD_SIDES * NUM_COLS)
+				fail("row %d has more than %d keys", row, NUM_KEYBOARD_SIDES * NUM_COLS);
+
+			// Legend n is the entry on layer n, missing legends are transparent except on the base layer
+			char * line = legend;
+			for(int layer = 0; layer < num_layers; ++layer) {
+
+				char * end = line ? strchr(line, '\n') : NULL;
+				if(end)
+					*end = '\0';
+
+				const char * entry = line && *line ? line : layer == 0 ? "NO" : "_";
+				snprintf(tokens[layer][num_keys], MAX_NAME, "%.47s", entry);
+
+				line = end ? end + 1 : NULL;
+			}
+
+			num_keys++;
+		}
+
+		for(int layer = 0; layer < num_layers; ++layer)
+			add_row(tokens[layer], num_keys, layer, row);
+		row++;
+	}
+
+	if(row != NUM_ROWS)
+		fail("%d rows, expected %d", row, NUM_ROWS);
+}
+
+static uint64_t key_mask(int side, bool (* match)(uint16_t)) {
+
+	uint64_t mask = 0;
+
+	for(int layer = 0; layer < num_layers; ++layer)
+		for(int key = 0; key < NUM_KEYS; ++key)
+			if(match(entries[layer][side][key]))
+				mask |= (uint64_t)1 << key;
+
+	return mask;
+}
+
+static bool is_modifier(uint16_t entry) {
+
+	return ACTION_KIND(entry) == ACTION_MODIFIERS;
+}
+
+static bool is_layer_key(uint16_t entry) {
+
+	return ACTION_KIND(entry) == ACTION_LAYER;
+}
+
+static bool is_tap_hold_key(uint16_t entry) {
+
+	return ACTION_KIND(entry) == ACTION_TAP_HOLD;
+}
+
+static bool is_macro_key(uint16_t entry) {
+
+	return ACTION_KIND(entry) == ACTION_MACRO;
+}
+
+static void check_layout(void) {
+
+	input_line = 0;
+
+	for(int side = 0; side < NUM_KEYBOARD_SIDES; ++side) {
+
+		const char * side_name = side ? "right" : "left";
+
+		for(int key = 0; key < NUM_KEYS; ++key)
+			if(entries[0][side][key] == KEY_TRANSPARENT)
+				fail("%s side, key %d is transparent on the base layer", side_name, key);
+
+		// The same usage twice on one side of a layer is allowed, but more often than not a mistake
+		for(int layer = 0; layer < num_layers; ++layer) {
+
+			for(int key = 0; key < NUM_KEYS; ++key) {
+
+				uint16_t entry = entries[layer][side][key];
+				if(entry == KEY_RESERVED || entry == KEY_TRANSPARENT)
+					continue;
+
+				for(int other = key + 1; other < NUM_KEYS; ++other)
+					if(entries[layer][side][other] == entry)
+						warn("%s is on keys %d and %d of the %s side of layer %s", entry_names[layer][side][key], key,
+							other, side_name, layer_names[layer]);
+			}
+		}
+	}
+
+	// A layer nothing switches to is never used, unless the firmware turns it on itself
+	uint8_t reachable = 1 | external_layers;
+	for(int side = 0; side < NUM_KEYBOARD_SIDES; ++side)
+		for(int layer = 0; layer < num_layers; ++layer)
+			for(int key = 0; key < NUM_KEYS; ++key)
+				if(is_layer_key(entries[layer][side][key]))
+					reachable |= 1 << (entries[layer][side][key] & 0x07);
+
+	for(int i = 0; i < num_tap_holds; ++i)
+		if(tap_holds[i].layer[0] != '\0')
+			reachable |= 1 << find_layer(tap_holds[i].layer);
+
+	for(int i = 0; i < num_combos; ++i)
+		if(is_layer_key(combos[i].entry))
+			reachable |= 1 << (combos[i].entry & 0x07);
+
+	for(int i = 0; i < num_leader_sequences; ++i)
+		if(is_layer_key(leader_sequences[i].action))
+			reachable |= 1 << (leader_sequences[i].action & 0x07);
+
+	for(int layer = 0; layer < num_layers; ++layer)
+		for(int encoder = 0; encoder < NUM_ENCODERS; ++encoder)
+			for(int direction = 0; direction < 2; ++direction)
+				if(is_layer_key(encoder_entries[layer][encoder][direction]))
+					reachable |= 1 << (encoder_entries[layer][encoder][direction] & 0x07);
+
+	for(int layer = 0; layer < num_layers; ++layer)
+		if(!(reachable & (1 << layer)))
+			warn("no key switches to layer %s", layer_names[layer]);
+
+	unsigned played = 0;
+	for(int side = 0; side < NUM_KEYBOARD_SIDES; ++side)
+		for(int layer = 0; layer < num_layers; ++layer)
+			for(int key = 0; key < NUM_KEYS; ++key)
+				if(is_macro_key(entries[layer][side][key]))
+					played |= 1 << ACTION_PAYLOAD(entries[layer][side][key]);
+
+	for(int i = 0; i < num_combos; ++i)
+		if(is_macro_key(combos[i].entry))
+			played |= 1 << ACTION_PAYLOAD(combos[i].entry);
+
+	for(int i = 0; i < num_leader_sequences; ++i)
+		if(is_macro_key(leader_sequences[i].action))
+			played |= 1 << ACTION_PAYLOAD(leader_sequences[i].action);
+
+	for(int layer = 0; layer < num_layers; ++layer)
+		for(int encoder = 0; encoder < NUM_ENCODERS; ++encoder)
+			for(int direction = 0; direction < 2; ++direction)
+				if(is_macro_key(encoder_entries[layer][encoder][direction]))
+					played |= 1 << ACTION_PAYLOAD(encoder_entries[layer][encoder][direction]);
+
+	for(int i = 0; i < num_macros; ++i)
+		if(!(played & (1 << i)))
+			warn("no key plays macro %s", macros[i].name);
+
+	bool have_leader = false;
+	for(int side = 0; side < NUM_KEYBOARD_SIDES; ++side)
+		for(int layer = 0; layer < num_layers; ++layer)
+			for(int key = 0; key < NUM_KEYS; ++key)
+				have_leader |= entries[layer][side][key] == KEY_LEADER;
+
+	for(int i = 0; i < num_combos; ++i)
+		have_leader |= combos[i].entry == KEY_LEADER;
+
+	for(int layer = 0; layer < num_layers; ++layer)
+		for(int encoder = 0; encoder < NUM_ENCODERS; ++encoder)
+			for(int direction = 0; direction < 2; ++direction)
+				have_leader |= encoder_entries[layer][encoder][direction] == KEY_LEADER;
+
+	if(num_leader_sequences > 0 && !have_leader)
+		warn("there are leader sequences but no LEADER key");
+}
+
+static FILE * open_output(const char * base, const char * extension) {
+
+	char path[1024];
+	snprintf(path, sizeof(path), "%s%s", base, extension);
+
+	FILE * file = fopen(path, "w");
+	if(!file) {
+
+		fprintf(stderr, "keymapc: can't write %s\n", path);
+		exit(1);
+	}
+	return file;
+}
+
+static void write_header(FILE * file, const char * base) {
+
+	const char * include_name = strrchr(base, '/') ? strrchr(base, '/') + 1 : base;
+
+	char guard[MAX_NAME * 2];
+	snprintf(guard, sizeof(guard), "%s_H", include_name);
+	to_upper(guard);
+	for(char * c = guard; *c; ++c)
+		if(!isalnum((unsigned char)*c))
+			*c = '_';
+
+	fprintf(file, "\n// Generated by keymapc from %s, edit that and rebuild rather than this\n\n", input_name);
+	fprintf(file, "#if !defined(%s)\n#define %s\n\n#include <inttypes.h>\n\n", guard, guard);
+
+	fprintf(file, "#define KEYMAP_LAYOUT_ROWS %d\n", NUM_ROWS);
+	fprintf(file, "#define KEYMAP_LAYOUT_COLS %d\n", NUM_COLS);
+	fprintf(file, "#define KEYMAP_LAYOUT_ENCODERS %d\n\n", NUM_ENCODERS);
+
+	fprintf(file, "// Layers, the highest active layer wins\n");
+	for(int layer = 0; layer < num_layers; ++layer)
+		fprintf(file, "#define LAYER_%s %d\n", layer_names[layer], layer);
+	fprintf(file, "#define NUM_LAYERS %d\n\n", num_layers);
+
+	fprintf(file, "// Keys that are a modifier, a layer key or a tap-hold key on any layer, bit n is key n\n");
+	for(int side = 0; side < NUM_KEYBOARD_SIDES; ++side) {
+
+		const char * side_name = side ? "RIGHT" : "LEFT";
+		fprintf(file, "#define KEYMAP_%s_MODIFIER_KEYS 0x%010llXULL\n", side_name,
+			(unsigned long long)key_mask(side, is_modifier));
+		fprintf(file, "#define KEYMAP_%s_LAYER_KEYS 0x%010llXULL\n", side_name,
+			(unsigned long long)key_mask(side, is_layer_key));
+		fprintf(file, "#define KEYMAP_%s_TAP_HOLD_KEYS 0x%010llXULL\n", side_name,
+			(unsigned long long)key_mask(side, is_tap_hold_key));
+	}
+
+	fprintf(file, "\n#define NUM_TAP_HOLDS %d\n", num_tap_holds);
+	fprintf(file, "#define NUM_COMBOS %d\n", num_combos);
+
+	if(num_macros > 0)
+		fprintf(file, "\n// Macros, for MACRO(index)\n");
+	for(int i = 0; i < num_macros; ++i)
+		fprintf(file, "#define MACRO_%s %d\n", macros[i].name, i);
+	fprintf(file, "#define NUM_MACROS %d\n", num_macros);
+	fprintf(file, "\n#define NUM_LEADER_NODES %d\n", num_leader_nodes);
+
+	fprintf(file, "\nextern const uint16_t keymap_left[NUM_LAYERS][KEYMAP_LAYOUT_ROWS * KEYMAP_LAYOUT_COLS];\n");
+	fprintf(file, "extern const uint16_t keymap_right[NUM_LAYERS][KEYMAP_LAYOUT_ROWS * KEYMAP_LAYOUT_COLS];\n");
+	fprintf(file, "extern const struct keymap_tap_hold keymap_tap_holds[];\n");
+	fprintf(file, "extern const uint16_t keymap_combo_members[NUM_KEYBOARD_SIDES][KEYMAP_LAYOUT_ROWS * KEYMAP_LAYOUT_COLS];\n");
+	fprintf(file, "extern const uint16_t keymap_combo_sizes[MAX_COMBO_KEYS + 1];\n");
+	fprintf(file, "extern const uint16_t keymap_combo_entries[];\n");
+	fprintf(file, "extern const uint8_t keymap_macros[];\n");
+	fprintf(file, "extern const uint16_t keymap_macro_offsets[];\n");
+	fprintf(file, "extern const struct keymap_leader_node keymap_leader_nodes[NUM_LEADER_NODES];\n");
+	fprintf(file, "extern const uint16_t keymap_encoders[NUM_LAYERS][KEYMAP_LAYOUT_ENCODERS][2];\n");
+	fprintf(file, "\n#endif\n");
+}
+
+static void write_table(FILE * file, int side) {
+
+	// Line the columns up
+	int widths[NUM_COLS] = {0};
+	for(int layer = 0; layer < num_layers; ++layer) {
+
+		for(int key = 0; key < NUM_KEYS; ++key) {
+
+			int width = strlen(entry_names[layer][side][key]) + 2;
+			if(width > widths[key % NUM_COLS])
+				widths[key % NUM_COLS] = width;
+		}
+	}
+
+	fprintf(file, "const uint16_t PROGMEM keymap_%s[NUM_LAYERS][NUM_PHYSICAL_KEYS] = {\n", side ? "right" : "left");
+
+	for(int layer = 0; layer < num_layers; ++layer) {
+
+		fprintf(file, "\t[LAYER_%s] = {\n", layer_names[layer]);
+
+		for(int row = 0; row < NUM_ROWS; ++row) {
+
+			fprintf(file, "\t\t");
+			for(int col = 0; col < NUM_COLS; ++col) {
+
+				int key = row * NUM_COLS + col;
+				bool last = key == NUM_KEYS - 1;
+				fprintf(file, "%s%s", entry_names[layer][side][key], last ? "" : ",");
+				if(col < NUM_COLS - 1)
+					fprintf(file, "%*s", widths[col] - (int)strlen(entry_names[layer][side][key]) - 1, "");
+			}
+			fprintf(file, "\n");
+		}
+
+		fprintf(file, "\t}%s\n", layer < num_layers - 1 ? "," : "");
+	}
+
+	fprintf(file, "};\n");
+}
+
+// Breadth first, so the children of every node end up next to each other in key order
+static void write_leader_nodes(FILE * file) {
+
+	static int order[MAX_LEADER_NODES];
+	int num_ordered = 1;
+	order[0] = 0;
+
+	fprintf(file, "\n// The leader sequences as a trie, key, action, number of children and first child\n");
+	fprintf(file, "const struct keymap_leader_node PROGMEM keymap_leader_nodes[NUM_LEADER_NODES] = {\n");
+
+	for(int i = 0; i < num_ordered; ++i) {
+
+		const struct leader_node * node = &leader_nodes[order[i]];
+		int first_child = num_ordered;
+
+		for(int child = node->first_child; child >= 0; child = leader_nodes[child].next_sibling)
+			order[num_ordered++] = child;
+
+		const char * action = node->sequence >= 0 ? leader_sequences[node->sequence].action_name : "KEY_RESERVED";
+		fprintf(file, "\t[%d] = {%s, %s, %d, %d}%s\n", i, node->key_name, action, node->num_children,
+			node->num_children ? first_child : 0, i < num_leader_nodes - 1 ? "," : "");
+	}
+
+	fprintf(file, "};\n");
+}
+
+static void write_source(FILE * file, const char * base) {
+
+	const char * include_name = strrchr(base, '/') ? strrchr(base, '/') + 1 : base;
+
+	fprintf(file, "\n// Generated by keymapc from %s, edit that and rebuild rather than this\n\n", input_name);
+	fprintf(file, "#include <inttypes.h>\n#include <assert.h>\n\n#include <avr/pgmspace.h>\n\n");
+	fprintf(file, "#include \"keymap.h\"\n#include \"%s.h\"\n#include \"usb_key_ids.h\"\n\n", include_name);
+	fprintf(file, "#define static_assert _Static_assert\n\n");
+	fprintf(file, "static_assert(KEYMAP_LAYOUT_ROWS == NUM_MAIN_KEYS_ROWS && KEYMAP_LAYOUT_COLS == NUM_MAIN_KEYS_COLS,\n");
+	fprintf(file, "\t\"the layout doesn't match the key matrix\");\n");
+	fprintf(file, "static_assert(KEYMAP_LAYOUT_ENCODERS == NUM_ENCODERS, \"the layout doesn't match the encoders\");\n\n");
+
+	write_table(file, 0);
+	fprintf(file, "\n");
+	write_table(file, 1);
+
+	fprintf(file, "\n// Tap, hold, tapping term and options of each TAP_HOLD entry\n");
+	fprintf(file, "const struct keymap_tap_hold PROGMEM keymap_tap_holds[] = {\n");
+	for(int i = 0; i < num_tap_holds; ++i)
+		fprintf(file, "\t[%d] = {%s, %s, %s, %s}%s\n", i, tap_holds[i].tap, tap_holds[i].hold, tap_holds[i].term,
+			tap_holds[i].options, i < num_tap_holds - 1 ? "," : "");
+
+	// Never empty, keymap.c always refers to it
+	if(num_tap_holds == 0)
+		fprintf(file, "\t{KEY_RESERVED, KEY_RESERVED, 0, 0}\n");
+	fprintf(file, "};\n");
+
+	// Matching a combo is then just ands of these, however many combos there are
+	fprintf(file, "\n// The combos each key is part of, bit n is combo n\n");
+	fprintf(file, "const uint16_t PROGMEM keymap_combo_members[NUM_KEYBOARD_SIDES][NUM_PHYSICAL_KEYS] = {\n");
+	for(int side = 0; side < NUM_KEYBOARD_SIDES; ++side) {
+
+		fprintf(file, "\t{");
+		for(int key = 0; key < NUM_KEYS; ++key) {
+
+			unsigned members = 0;
+			for(int i = 0; i < num_combos; ++i)
+				for(int j = 0; j < combos[i].num_keys; ++j)
+					if(combos[i].sides[j] == side && combos[i].keys[j] == key)
+						members |= 1 << i;
+
+			fprintf(file, "%s0x%04X", key == 0 ? "" : key % NUM_COLS == 0 ? ",\n\t\t" : ", ", members);
+		}
+		fprintf(file, "}%s\n", side < NUM_KEYBOARD_SIDES - 1 ? "," : "");
+	}
+	fprintf(file, "};\n");
+
+	fprintf(file, "\n// The combos with each number of keys\n");
+	fprintf(file, "const uint16_t PROGMEM keymap_combo_sizes[MAX_COMBO_KEYS + 1] = {");
+	for(int size = 0; size <= MAX_COMBO_KEYS; ++size) {
+
+		unsigned mask = 0;
+		for(int i = 0; i < num_combos; ++i)
+			if(combos[i].num_keys == size)
+				mask |= 1 << i;
+
+		fprintf(file, "%s0x%04X", size ? ", " : "", mask);
+	}
+	fprintf(file, "};\n");
+
+	fprintf(file, "\n// What each combo sends\n");
+	fprintf(file, "const uint16_t PROGMEM keymap_combo_entries[] = {\n");
+	for(int i = 0; i < num_combos; ++i)
+		fprintf(file, "\t[%d] = %s%s\n", i, combos[i].entry_name, i < num_combos - 1 ? "," : "");
+
+	// Never empty either
+	if(num_combos == 0)
+		fprintf(file, "\tKEY_RESERVED\n");
+	fprintf(file, "};\n");
+
+	fprintf(file, "\n// The macros one after the other, each ends with MACRO_OP_END\n");
+	fprintf(file, "const uint8_t PROGMEM keymap_macros[] = {\n");
+	for(int i = 0; i < num_macros; ++i) {
+
+		fprintf(file, "\t// %s\n", macros[i].name);
+		for(int j = 0; j < macros[i].length; ++j) {
+
+			bool last = i == num_macros - 1 && j == macros[i].length - 1;
+			bool line_end = j % 16 == 15 || j == macros[i].length - 1;
+			fprintf(file, "%s%s%s", j % 16 == 0 ? "\t" : "", macros[i].byte_names[j], last ? "" : ",");
+			fprintf(file, "%s", line_end ? "\n" : " ");
+		}
+	}
+
+	if(num_macros == 0)
+		fprintf(file, "\tMACRO_OP_END\n");
+	fprintf(file, "};\n");
+
+	fprintf(file, "\n// Where each macro starts in keymap_macros\n");
+	fprintf(file, "const uint16_t PROGMEM keymap_macro_offsets[] = {\n");
+	int offset = 0;
+	for(int i = 0; i < num_macros; ++i) {
+
+		fprintf(file, "\t[MACRO_%s] = %d%s\n", macros[i].name, offset, i < num_macros - 1 ? "," : "");
+		offset += macros[i].length;
+	}
+
+	if(num_macros == 0)
+		fprintf(file, "\t0\n");
+	fprintf(file, "};\n");
+
+	write_leader_nodes(file);
+
+	fprintf(file, "\n// What each encoder sends on each layer, clockwise then counter-clockwise\n");
+	fprintf(file, "const uint16_t PROGMEM keymap_encoders[NUM_LAYERS][NUM_ENCODERS][2] = {\n");
+	for(int layer = 0; layer < num_layers; ++layer) {
+
+		fprintf(file, "\t[LAYER_%s] = {", layer_names[layer]);
+		for(int encoder = 0; encoder < NUM_ENCODERS; ++encoder)
+			fprintf(file, "%s{%s, %s}", encoder ? ", " : "", encoder_names[layer][encoder][0],
+				encoder_names[layer][encoder][1]);
+		fprintf(file, "}%s\n", layer < num_layers - 1 ? "," : "");
+	}
+	fprintf(file, "};\n");
+}
+
+int main(int argc, char ** argv) {
+
+	const char * key_ids_path = "../usb_key_ids.h";
+	const char * output = "keymap_layout";
+	const char * layers = NULL;
+	int arg;
+
+	for(arg = 1; arg < argc && argv[arg][0] == '-'; arg += 2) {
+
+		if(arg + 1 >= argc)
+			break;
+		if(strcmp(argv[arg], "-k") == 0)
+			key_ids_path = argv[arg + 1];
+		else if(strcmp(argv[arg], "-o") == 0)
+			output = argv[arg + 1];
+		else if(strcmp(argv[arg], "-l") == 0)
+			layers = argv[arg + 1];
+		else
+			break;
+	}
+
+	if(arg != argc - 1) {
+
+		fprintf(stderr, "usage: keymapc [-k usb_key_ids.h] [-l LAYER,LAYER,...] [-o output] layout\n");
+		return 1;
+	}
+
+	load_key_ids(key_ids_path);
+
+	input_name = argv[arg];
+	FILE * file = fopen(input_name, "r");
+	if(!file) {
+
+		fprintf(stderr, "keymapc: can't open %s\n", input_name);
+		return 1;
+	}
+
+	size_t length = strlen(input_name);
+	bool kle = length > 5 && strcmp(input_name + length - 5, ".json") == 0;
+
+	if(layers) {
+
+		if(!kle)
+			fail("-l is only for keyboard-layout-editor files, the grid names its own layers");
+
+		char names[256];
+		snprintf(names, sizeof(names), "%s", layers);
+		for(char * name = strtok(names, ","); name; name = strtok(NULL, ","))
+			add_layer(name);
+	}
+
+	if(kle)
+		read_kle(file);
+	else
+		read_grid(file);
+	fclose(file);
+
+	resolve_entries();
+	check_layout();
+
+	FILE * header = open_output(output, ".h");
+	write_header(header, output);
+	fclose(header);
+
+	FILE * source = open_output(output, ".c");
+	write_source(source, output);
+	fclose(source);
+
+	fprintf(stderr, "keymapc: %d layers, %d bytes of flash, %d warnings\n", num_layers,
+		num_layers * NUM_KEYBOARD_SIDES * NUM_KEYS * (int)sizeof(entries[0][0][0]), num_warnings);
+
+	return 0;
+}
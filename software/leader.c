@@ -0,0 +1,79 @@
+
+#include <inttypes.h>
+#include <stdbool.h>
+
+#include <avr/pgmspace.h>
+
+#include "keymap.h"
+#include "leader.h"
+#include "timer.h"
+
+// After KEY_LEADER the keys typed are taken by the leader rather than sent. Each one moves down the trie of
+// sequences keymapc builds in flash, finding the child among the current node's sorted children, so a key costs
+// the same however many sequences there are. A sequence sends its action as soon as its last key is typed, as no
+// sequence is the start of another one. A key that doesn't carry on any sequence ends it without sending anything.
+// Modifiers and layer keys still work as usual, so a sequence can have keys from other layers or shifted keys
+
+static bool active = false;
+static uint16_t node;
+static uint16_t last_key_time;
+
+void leader_init(void) {
+
+	active = false;
+}
+
+void leader_start(void) {
+
+	active = true;
+	node = 0;
+	last_key_time = timer_read();
+}
+
+bool leader_active(void) {
+
+	return active;
+}
+
+void leader_key(uint8_t entry) {
+
+	uint16_t first_child = pgm_read_word(&keymap_leader_nodes[node].first_child);
+	uint8_t num_children = pgm_read_byte(&keymap_leader_nodes[node].num_children);
+
+	// Binary search of the children
+	uint8_t low = 0;
+	uint8_t high = num_children;
+	while(low < high) {
+
+		uint8_t middle = (low + high) / 2;
+
+		if(pgm_read_byte(&keymap_leader_nodes[first_child + middle].key) < entry)
+			low = middle + 1;
+		else
+			high = middle;
+	}
+
+	if(low == num_children || pgm_read_byte(&keymap_leader_nodes[first_child + low].key) != entry) {
+
+		active = false;
+		return;
+	}
+
+	node = first_child + low;
+	last_key_time = timer_read();
+
+	if(pgm_read_byte(&keymap_leader_nodes[node].num_children) > 0)
+		return;
+
+	active = false;
+
+	// Let go again once the host has seen it
+	keymap_press(LEFT_KEYBOARD, LEADER_KEY, pgm_read_word(&keymap_leader_nodes[node].action));
+	keymap_release(LEFT_KEYBOARD, LEADER_KEY);
+}
+
+void leader_task(void) {
+
+	if(active && timer_elapsed(last_key_time) >= LEADER_TIMEOUT)
+		active = false;
+}
@@ -0,0 +1,14 @@
+
+#if !defined(LEADER_H)
+#define LEADER_H
+
+#include <inttypes.h>
+#include <stdbool.h>
+
+void leader_init(void);
+void leader_start(void);
+bool leader_active(void);
+void leader_key(uint8_t entry);
+void leader_task(void);
+
+#endif
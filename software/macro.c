@@ -0,0 +1,269 @@
+
+#include <inttypes.h>
+#include <stdbool.h>
+
+#include <avr/pgmspace.h>
+
+#include "keymap.h"
+#include "macro.h"
+#include "timer.h"
+#include "usb_key_ids.h"
+
+// A macro plays one step each time the host has been handed the report from the step before, so it never waits
+// in a loop and the keys keep being scanned. The report queue only takes a report once the last one has been
+// collected, so a macro goes as fast as the host polls. While it plays its report takes the place of the keymap's:
+//
+// - MACRO_OP_DOWN usage, MACRO_OP_UP usage: hold a key or modifier down or let it go
+// - MACRO_OP_TAP usage: press a key, it is let go in the next report
+// - MACRO_OP_WAIT low high: wait that many ms
+// - ' ' to '~': type the character on a us layout, with shift if it needs it. The next character goes in the very
+//   next report unless it is on the same key or needs shift changed, in which case the key is let go first
+// - MACRO_OP_END
+//
+// Keys held in the macro are let go when it ends
+
+#define SHIFTED 0x80
+
+// The usages of the characters that aren't letters or digits, from ' ' to '~'
+static const uint8_t PROGMEM punctuation_usages['~' - ' ' + 1] = {
+	[' ' - ' '] = KEY_SPACE,
+	['!' - ' '] = KEY_1 | SHIFTED,
+	['"' - ' '] = KEY_QUOTE | SHIFTED,
+	['#' - ' '] = KEY_3 | SHIFTED,
+	['$' - ' '] = KEY_4 | SHIFTED,
+	['%' - ' '] = KEY_5 | SHIFTED,
+	['&' - ' '] = KEY_7 | SHIFTED,
+	['\'' - ' '] = KEY_QUOTE,
+	['(' - ' '] = KEY_9 | SHIFTED,
+	[')' - ' '] = KEY_0 | SHIFTED,
+	['*' - ' '] = KEY_8 | SHIFTED,
+	['+' - ' '] = KEY_EQUAL | SHIFTED,
+	[',' - ' '] = KEY_COMMA,
+	['-' - ' '] = KEY_MINUS,
+	['.' - ' '] = KEY_PERIOD,
+	['/' - ' '] = KEY_SLASH,
+	[':' - ' '] = KEY_SEMICOLON | SHIFTED,
+	[';' - ' '] = KEY_SEMICOLON,
+	['<' - ' '] = KEY_COMMA | SHIFTED,
+	['=' - ' '] = KEY_EQUAL,
+	['>' - ' '] = KEY_PERIOD | SHIFTED,
+	['?' - ' '] = KEY_SLASH | SHIFTED,
+	['@' - ' '] = KEY_2 | SHIFTED,
+	['[' - ' '] = KEY_LEFT_BRACE,
+	['\\' - ' '] = KEY_AMERICAN_BACKSLASH,
+	[']' - ' '] = KEY_RIGHT_BRACE,
+	['^' - ' '] = KEY_6 | SHIFTED,
+	['_' - ' '] = KEY_MINUS | SHIFTED,
+	['`' - ' '] = KEY_TILDE,
+	['{' - ' '] = KEY_LEFT_BRACE | SHIFTED,
+	['|' - ' '] = KEY_AMERICAN_BACKSLASH | SHIFTED,
+	['}' - ' '] = KEY_RIGHT_BRACE | SHIFTED,
+	['~' - ' '] = KEY_TILDE | SHIFTED
+};
+
+static bool playing = false;
+static uint16_t position;
+
+static bool waiting = false;
+static uint16_t wait_start;
+static uint16_t wait_time;
+
+static uint8_t held_modifiers = 0;
+static uint8_t held_keys[MACRO_MAX_HELD_KEYS];
+
+// The key of the last MACRO_OP_TAP or character, let go in the next report
+static uint8_t tapped = KEY_RESERVED;
+static bool tapped_shifted = false;
+
+static bool is_character(uint8_t op) {
+
+	return op >= ' ' && op <= '~';
+}
+
+static uint8_t character_usage(uint8_t character) {
+
+	if(character >= 'a' && character <= 'z')
+		return KEY_A + character - 'a';
+	if(character >= 'A' && character <= 'Z')
+		return (KEY_A + character - 'A') | SHIFTED;
+	if(character >= '1' && character <= '9')
+		return KEY_1 + character - '1';
+	if(character == '0')
+		return KEY_0;
+
+	return pgm_read_byte(&punctuation_usages[character - ' ']);
+}
+
+static uint8_t next_byte(void) {
+
+	return pgm_read_byte(&keymap_macros[position++]);
+}
+
+static void hold(uint8_t usage) {
+
+	if(usage >= KEY_MOD_LEFT_CTRL && usage <= KEY_MOD_RIGHT_GUI) {
+
+		held_modifiers |= 1 << (usage - KEY_MOD_LEFT_CTRL);
+		return;
+	}
+
+	for(uint8_t i = 0; i < MACRO_MAX_HELD_KEYS; ++i) {
+
+		if(held_keys[i] == KEY_RESERVED) {
+
+			held_keys[i] = usage;
+			return;
+		}
+	}
+}
+
+static void let_go(uint8_t usage) {
+
+	if(usage >= KEY_MOD_LEFT_CTRL && usage <= KEY_MOD_RIGHT_GUI) {
+
+		held_modifiers &= ~(1 << (usage - KEY_MOD_LEFT_CTRL));
+		return;
+	}
+
+	for(uint8_t i = 0; i < MACRO_MAX_HELD_KEYS; ++i)
+		if(held_keys[i] == usage)
+			held_keys[i] = KEY_RESERVED;
+}
+
+static void stop(void) {
+
+	playing = false;
+	waiting = false;
+	held_modifiers = 0;
+	tapped = KEY_RESERVED;
+
+	for(uint8_t i = 0; i < MACRO_MAX_HELD_KEYS; ++i)
+		held_keys[i] = KEY_RESERVED;
+}
+
+// Move on to the next report
+static void step(void) {
+
+	uint8_t op = pgm_read_byte(&keymap_macros[position]);
+
+	if(tapped != KEY_RESERVED) {
+
+		uint8_t previous = tapped;
+		tapped = KEY_RESERVED;
+
+		if(!is_character(op) || previous >= KEY_MOD_LEFT_CTRL)
+			return;
+
+		// A different key with the same shift can go straight in its place
+		uint8_t usage = character_usage(op);
+		if((usage & ~SHIFTED) == previous || ((usage & SHIFTED) != 0) != tapped_shifted)
+			return;
+	}
+
+	position++;
+
+	if(is_character(op)) {
+
+		uint8_t usage = character_usage(op);
+		tapped = usage & ~SHIFTED;
+		tapped_shifted = (usage & SHIFTED) != 0;
+		return;
+	}
+
+	switch(op) {
+
+	case MACRO_OP_DOWN:
+
+		hold(next_byte());
+		break;
+
+	case MACRO_OP_UP:
+
+		let_go(next_byte());
+		break;
+
+	case MACRO_OP_TAP:
+
+		tapped = next_byte();
+		tapped_shifted = false;
+		break;
+
+	case MACRO_OP_WAIT:
+
+		wait_time = next_byte();
+		wait_time |= next_byte() << 8;
+		wait_start = timer_read();
+		waiting = true;
+		break;
+
+	default:
+
+		stop();
+		break;
+	}
+}
+
+void macro_init(void) {
+
+	stop();
+}
+
+// A macro started while another one plays is ignored
+void macro_play(uint8_t index) {
+
+	if(playing)
+		return;
+
+	playing = true;
+	position = pgm_read_word(&keymap_macro_offsets[index]);
+
+	step();
+}
+
+bool macro_playing(void) {
+
+	return playing;
+}
+
+// Called once per scan, report_sent says whether the host has been given the last report
+void macro_task(bool report_sent) {
+
+	if(!playing || !report_sent)
+		return;
+
+	if(waiting) {
+
+		if(timer_elapsed(wait_start) < wait_time)
+			return;
+
+		waiting = false;
+	}
+
+	step();
+}
+
+void macro_get_report(uint8_t * modifier_keys, uint8_t * keys, uint8_t max_keys) {
+
+	uint8_t num_keys = 0;
+
+	*modifier_keys = held_modifiers;
+
+	for(uint8_t i = 0; i < max_keys; ++i)
+		keys[i] = KEY_RESERVED;
+
+	for(uint8_t i = 0; i < MACRO_MAX_HELD_KEYS; ++i)
+		if(held_keys[i] != KEY_RESERVED && num_keys < max_keys)
+			keys[num_keys++] = held_keys[i];
+
+	if(tapped == KEY_RESERVED)
+		return;
+
+	if(tapped_shifted)
+		*modifier_keys |= 1 << (KEY_MOD_LEFT_SHIFT - KEY_MOD_LEFT_CTRL);
+
+	// MACRO_OP_TAP can tap a modifier too
+	if(tapped >= KEY_MOD_LEFT_CTRL && tapped <= KEY_MOD_RIGHT_GUI)
+		*modifier_keys |= 1 << (tapped - KEY_MOD_LEFT_CTRL);
+	else if(num_keys < max_keys)
+		keys[num_keys] = tapped;
+}
@@ -0,0 +1,17 @@
+
+#if !defined(MACRO_H)
+#define MACRO_H
+
+#include <inttypes.h>
+#include <stdbool.h>
+
+// Keys a macro can hold down with MACRO_OP_DOWN at once, besides the modifiers
+#define MACRO_MAX_HELD_KEYS 4
+
+void macro_init(void);
+void macro_play(uint8_t index);
+bool macro_playing(void);
+void macro_task(bool report_sent);
+void macro_get_report(uint8_t * modifier_keys, uint8_t * keys, uint8_t max_keys);
+
+#endif
@@ -0,0 +1,244 @@
+
+#include <inttypes.h>
+#include <stdbool.h>
+
+#include "keymap.h"
+#include "mouse_keys.h"
+#include "timer.h"
+#include "usb_keyboard.h"
+
+// Keys that move the pointer, turn the wheel and click. Movement is worked out from the time since the last report
+// in fixed point, keeping the fraction of a pixel for next time, so it is smooth whatever the loop rate. The mouse
+// interface accumulates, so when the host hasn't collected the last report the new movement is added to it as long
+// as it fits, and a report goes out on every poll while a key is held. Movement from a pointing device goes in the
+// same reports. With no mouse key held and nothing from the pointing device the task returns straight away
+
+#define DIRECTION_BIT(entry) (1 << ((entry) - MOUSE_UP))
+#define MOVE_BITS (DIRECTION_BIT(MOUSE_UP) | DIRECTION_BIT(MOUSE_DOWN) | DIRECTION_BIT(MOUSE_LEFT) | \
+	DIRECTION_BIT(MOUSE_RIGHT))
+#define WHEEL_BITS (DIRECTION_BIT(MOUSE_WHEEL_UP) | DIRECTION_BIT(MOUSE_WHEEL_DOWN))
+
+// Keeps speed * time in 16 bits if the loop stalls
+#define MAX_STEP_TIME 32
+
+// 1/sqrt(2) in 1/256ths, so diagonals aren't faster
+#define DIAGONAL_SCALE 181
+
+static uint8_t held_directions = 0;
+static uint8_t buttons = 0;
+static bool buttons_changed = false;
+
+static uint16_t last_step_time;
+static uint16_t move_start_time;
+static uint16_t wheel_start_time;
+
+// Fractions of a pixel and of a notch still to be sent
+static uint16_t move_remainder;
+static uint16_t wheel_remainder;
+
+// Movement and buttons from a pointing device, which go in the same report as the keys
+static int16_t pointer_x = 0;
+static int16_t pointer_y = 0;
+static uint8_t pointer_buttons = 0;
+
+// A wheel key let go before it turned a whole notch still turns one, so a tap, e.g. from an encoder, always scrolls
+static bool wheel_turned;
+static int8_t wheel_taps = 0;
+
+// Quadratic, so a short press still moves a pixel at a time
+static uint16_t speed(uint16_t * start_time, uint16_t initial_speed, uint16_t max_speed) {
+
+	uint16_t held_time = timer_elapsed(*start_time);
+
+	// Keep the start from wrapping round on a long hold
+	if(held_time > (1 << MOUSE_RAMP_SHIFT)) {
+
+		held_time = 1 << MOUSE_RAMP_SHIFT;
+		*start_time = timer_read() - held_time;
+	}
+
+	uint16_t ramp = ((uint32_t)held_time * held_time) >> MOUSE_RAMP_SHIFT;
+	return initial_speed + (((uint32_t)(max_speed - initial_speed) * ramp) >> MOUSE_RAMP_SHIFT);
+}
+
+// Whole units moved in step_time, the rest is kept for the next step
+static int8_t step(uint16_t * remainder, uint16_t step_speed, uint8_t step_time) {
+
+	*remainder += step_speed * step_time;
+
+	uint16_t units = *remainder >> 8;
+	*remainder &= 0xFF;
+
+	return units > 127 ? 127 : units;
+}
+
+// Pointing device movement still to go out, kept until a report has room for it. Only past this much, if the host
+// stops polling, is any lost
+static int16_t clamp(int16_t value) {
+
+	return value > 1024 ? 1024 : value < -1024 ? -1024 : value;
+}
+
+static int8_t clamp_report(int16_t value) {
+
+	return value > 127 ? 127 : value < -127 ? -127 : value;
+}
+
+static int8_t axis(int8_t units, uint16_t negative, uint16_t positive) {
+
+	int8_t value = 0;
+
+	if(held_directions & DIRECTION_BIT(positive))
+		value += units;
+	if(held_directions & DIRECTION_BIT(negative))
+		value -= units;
+
+	return value;
+}
+
+void mouse_keys_init(void) {
+
+	held_directions = 0;
+	buttons = 0;
+	buttons_changed = false;
+	wheel_taps = 0;
+	pointer_x = 0;
+	pointer_y = 0;
+	pointer_buttons = 0;
+}
+
+void mouse_keys_press(uint16_t entry) {
+
+	if(entry >= MOUSE_BUTTON(0)) {
+
+		buttons |= 1 << (entry - MOUSE_BUTTON(0));
+		buttons_changed = true;
+		return;
+	}
+
+	uint16_t now = timer_read();
+
+	if(held_directions == 0)
+		last_step_time = now;
+
+	// Speeding up starts again from the first key of each kind
+	if(!(held_directions & MOVE_BITS) && (DIRECTION_BIT(entry) & MOVE_BITS)) {
+
+		move_start_time = now;
+		move_remainder = 0;
+	}
+
+	if(!(held_directions & WHEEL_BITS) && (DIRECTION_BIT(entry) & WHEEL_BITS)) {
+
+		wheel_start_time = now;
+		wheel_remainder = 0;
+		wheel_turned = false;
+	}
+
+	held_directions |= DIRECTION_BIT(entry);
+}
+
+void mouse_keys_release(uint16_t entry) {
+
+	if(entry >= MOUSE_BUTTON(0)) {
+
+		buttons &= ~(1 << (entry - MOUSE_BUTTON(0)));
+		buttons_changed = true;
+		return;
+	}
+
+	held_directions &= ~DIRECTION_BIT(entry);
+
+	if((DIRECTION_BIT(entry) & WHEEL_BITS) && !(held_directions & WHEEL_BITS) && !wheel_turned && wheel_taps > -127 &&
+		wheel_taps < 127)
+		wheel_taps += entry == MOUSE_WHEEL_UP ? 1 : -1;
+}
+
+// Adds movement from a pointing device, e.g. ps2_mouse.c, to the next report
+void mouse_keys_pointer(int16_t x, int16_t y, uint8_t new_buttons) {
+
+	pointer_x = clamp(pointer_x + x);
+	pointer_y = clamp(pointer_y + y);
+
+	if(new_buttons != pointer_buttons) {
+
+		pointer_buttons = new_buttons;
+		buttons_changed = true;
+	}
+}
+
+void mouse_keys_task(void) {
+
+	if(held_directions == 0 && !buttons_changed && wheel_taps == 0 && pointer_x == 0 && pointer_y == 0)
+		return;
+
+	uint8_t report[MOUSE_REPORT_SIZE] = {0};
+	report[MOUSE_REPORT_BUTTONS] = buttons | pointer_buttons;
+
+	uint16_t elapsed = timer_elapsed(last_step_time);
+	uint16_t step_time = elapsed > MAX_STEP_TIME ? MAX_STEP_TIME : elapsed;
+
+	// Only kept once the report is queued, one that is refused is worked out again next scan over the longer time
+	uint16_t next_move_remainder = move_remainder;
+	uint16_t next_wheel_remainder = wheel_remainder;
+	bool turned = false;
+
+	if(held_directions & MOVE_BITS) {
+
+		int8_t x = axis(1, MOUSE_LEFT, MOUSE_RIGHT);
+		int8_t y = axis(1, MOUSE_UP, MOUSE_DOWN);
+		uint16_t move_speed = speed(&move_start_time, MOUSE_INITIAL_SPEED, MOUSE_MAX_SPEED);
+
+		if(x != 0 && y != 0)
+			move_speed = ((uint32_t)move_speed * DIAGONAL_SCALE) >> 8;
+
+		int8_t pixels = step(&next_move_remainder, move_speed, step_time);
+		report[MOUSE_REPORT_X] = axis(pixels, MOUSE_LEFT, MOUSE_RIGHT);
+		report[MOUSE_REPORT_Y] = axis(pixels, MOUSE_UP, MOUSE_DOWN);
+	}
+
+	if(held_directions & WHEEL_BITS) {
+
+		uint16_t wheel_speed = speed(&wheel_start_time, MOUSE_WHEEL_INITIAL_SPEED, MOUSE_WHEEL_MAX_SPEED);
+
+		int8_t notches = step(&next_wheel_remainder, wheel_speed, step_time);
+		report[MOUSE_REPORT_WHEEL] = axis(notches, MOUSE_WHEEL_DOWN, MOUSE_WHEEL_UP);
+		turned = notches != 0;
+	}
+
+	if(report[MOUSE_REPORT_WHEEL] == 0)
+		report[MOUSE_REPORT_WHEEL] = wheel_taps;
+
+	// What doesn't fit in this report goes in the next one
+	int8_t x = clamp_report((int8_t)report[MOUSE_REPORT_X] + pointer_x);
+	int8_t y = clamp_report((int8_t)report[MOUSE_REPORT_Y] + pointer_y);
+	int16_t pointer_x_sent = x - (int8_t)report[MOUSE_REPORT_X];
+	int16_t pointer_y_sent = y - (int8_t)report[MOUSE_REPORT_Y];
+	report[MOUSE_REPORT_X] = x;
+	report[MOUSE_REPORT_Y] = y;
+
+	// Otherwise there is nothing whole to send yet, only the fractions are kept
+	if(buttons_changed || report[MOUSE_REPORT_X] != 0 || report[MOUSE_REPORT_Y] != 0 ||
+		report[MOUSE_REPORT_WHEEL] != 0) {
+
+		// A mouse key or the stick moving while the host is asleep wakes it, the report goes out once it polls again
+		if(usb_suspended() && usb_remote_wakeup() != 0)
+			return;
+
+		// Refused when the last report is still waiting and this one doesn't fit in it
+		if(usb_report_queue(MOUSE_INTERFACE, report) != 0)
+			return;
+
+		buttons_changed = false;
+		wheel_turned |= turned;
+		if(report[MOUSE_REPORT_WHEEL] == (uint8_t)wheel_taps)
+			wheel_taps = 0;
+
+		pointer_x -= pointer_x_sent;
+		pointer_y -= pointer_y_sent;
+	}
+
+	last_step_time += elapsed;
+	move_remainder = next_move_remainder;
+	wheel_remainder = next_wheel_remainder;
+}
@@ -0,0 +1,22 @@
+
+#if !defined(MOUSE_KEYS_H)
+#define MOUSE_KEYS_H
+
+#include <inttypes.h>
+#include <stdbool.h>
+
+// Speeds are in 1/256ths of a pixel or of a wheel notch per ms. Each one starts at its initial speed and curves up
+// to its maximum over 2^MOUSE_RAMP_SHIFT ms of being held
+#define MOUSE_INITIAL_SPEED 64
+#define MOUSE_MAX_SPEED 640
+#define MOUSE_WHEEL_INITIAL_SPEED 3
+#define MOUSE_WHEEL_MAX_SPEED 12
+#define MOUSE_RAMP_SHIFT 10
+
+void mouse_keys_init(void);
+void mouse_keys_press(uint16_t entry);
+void mouse_keys_release(uint16_t entry);
+void mouse_keys_pointer(int16_t x, int16_t y, uint8_t buttons);
+void mouse_keys_task(void);
+
+#endif
@@ -0,0 +1,154 @@
+
+#include <inttypes.h>
+#include <stdbool.h>
+
+#include <avr/io.h>
+#include <avr/interrupt.h>
+
+#include "ps2.h"
+#include "ps2_frame.h"
+#include "timer.h"
+
+// A PS/2 device with its clock on PE6, which is INT6, and its data on PD4. Both lines are open collector, driven
+// low or let go to be pulled up. The interrupt runs on each falling edge of the device's clock and only moves one
+// bit, so a frame costs eleven short interrupts spread over about a millisecond rather than a wait in the scan loop.
+// Received bits go to ps2_frame.c, which puts them together into frames for ps2_read in the scan loop
+//
+// To send, the host holds the clock low for at least 100us, which ps2_task ends on a later scan rather than waiting,
+// then pulls data low for the start bit and lets the clock go. The device then clocks the byte in, and acks it
+
+#define CLOCK_PIN 6
+#define DATA_PIN 4
+
+#define RECEIVING 0
+#define INHIBITING 1
+#define SENDING 2
+
+static volatile uint8_t state = RECEIVING;
+
+static uint8_t bit_count = 0;
+static uint8_t send_byte;
+static uint8_t send_ones;
+static uint16_t inhibit_time;
+
+static void clock_low(void) {
+
+	PORTE &= ~(1 << CLOCK_PIN);
+	DDRE |= 1 << CLOCK_PIN;
+}
+
+static void clock_release(void) {
+
+	DDRE &= ~(1 << CLOCK_PIN);
+	PORTE |= 1 << CLOCK_PIN;
+}
+
+static void data_low(void) {
+
+	PORTD &= ~(1 << DATA_PIN);
+	DDRD |= 1 << DATA_PIN;
+}
+
+static void data_release(void) {
+
+	DDRD &= ~(1 << DATA_PIN);
+	PORTD |= 1 << DATA_PIN;
+}
+
+static void send_bit(void) {
+
+	if(bit_count < 8) {
+
+		if(send_byte & (1 << bit_count)) {
+
+			data_release();
+			send_ones++;
+		} else {
+
+			data_low();
+		}
+	} else if(bit_count == 8) {
+
+		// Odd parity
+		if(send_ones & 1)
+			data_low();
+		else
+			data_release();
+	} else if(bit_count == 9) {
+
+		// Stop bit
+		data_release();
+	} else {
+
+		// The device pulled data low to ack, a nack is answered with 0xFE which the caller sees
+		state = RECEIVING;
+		bit_count = 0;
+		return;
+	}
+
+	bit_count++;
+}
+
+ISR(INT6_vect) {
+
+	if(state == SENDING)
+		send_bit();
+	else
+		ps2_frame_bit(PIND & (1 << DATA_PIN), timer_read());
+}
+
+void ps2_init(void) {
+
+	EIMSK &= ~(1 << INT6);
+
+	clock_release();
+	data_release();
+
+	state = RECEIVING;
+	ps2_frame_init();
+
+	// Falling edges of the clock
+	EICRB = (EICRB & ~(1 << ISC60)) | (1 << ISC61);
+	EIFR = 1 << INTF6;
+	EIMSK |= 1 << INT6;
+}
+
+// Starts sending a byte, false if the last one is still going. Whatever the device was sending is thrown away
+bool ps2_send(uint8_t byte) {
+
+	if(state != RECEIVING)
+		return false;
+
+	EIMSK &= ~(1 << INT6);
+
+	send_byte = byte;
+	send_ones = 0;
+	bit_count = 0;
+	ps2_frame_cut();
+
+	clock_low();
+	inhibit_time = timer_read();
+	state = INHIBITING;
+
+	return true;
+}
+
+bool ps2_sending(void) {
+
+	return state != RECEIVING;
+}
+
+// Called once per scan, lets go of the clock once it has been held long enough to send
+void ps2_task(void) {
+
+	// The timer only counts whole ms, 2 makes sure at least one has gone by
+	if(state != INHIBITING || timer_elapsed(inhibit_time) < 2)
+		return;
+
+	data_low();
+	state = SENDING;
+
+	EIFR = 1 << INTF6;
+	EIMSK |= 1 << INT6;
+	clock_release();
+}
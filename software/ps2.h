@@ -0,0 +1,22 @@
+
+#if !defined(PS2_H)
+#define PS2_H
+
+#include <inttypes.h>
+#include <stdbool.h>
+
+// What ps2_read found
+#define PS2_NONE 0
+#define PS2_BYTE 1
+#define PS2_BAD_FRAME 2
+
+// Frames received but not read yet, a power of two
+#define PS2_BUFFER_SIZE 16
+
+void ps2_init(void);
+bool ps2_send(uint8_t byte);
+bool ps2_sending(void);
+uint8_t ps2_read(uint8_t * byte);
+void ps2_task(void);
+
+#endif
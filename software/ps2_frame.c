@@ -0,0 +1,85 @@
+
+#include <inttypes.h>
+#include <stdbool.h>
+
+#include "ps2.h"
+#include "ps2_frame.h"
+
+// The receiving half of ps2.c, frames put together from the bits the device clocks out. Nothing here touches the
+// hardware, ps2.c's interrupt reads the data line and hands the bit over, so bit streams can be fed in from anywhere
+// by calling ps2_frame_bit once per falling clock edge
+
+// A frame that stops for longer than this was cut off, the next bit starts a new one
+#define FRAME_TIMEOUT 2
+
+static uint8_t bit_count = 0;
+static uint16_t frame = 0;
+static uint16_t last_bit_time;
+
+// Written by the interrupt at head, read by the scan loop at tail
+static volatile uint16_t frames[PS2_BUFFER_SIZE];
+static volatile uint8_t frames_head = 0;
+static volatile uint8_t frames_tail = 0;
+
+// Drops the frame in progress and everything not read yet
+void ps2_frame_init(void) {
+
+	ps2_frame_cut();
+	frames_head = 0;
+	frames_tail = 0;
+}
+
+// Drops the frame in progress, e.g. when the host takes the lines to send
+void ps2_frame_cut(void) {
+
+	bit_count = 0;
+	frame = 0;
+}
+
+// One bit, read on a falling edge of the clock at now ms. Only called from the interrupt on the device
+void ps2_frame_bit(bool data, uint16_t now) {
+
+	if(bit_count > 0 && (uint16_t)(now - last_bit_time) > FRAME_TIMEOUT) {
+
+		bit_count = 0;
+		frame = 0;
+	}
+	last_bit_time = now;
+
+	if(data)
+		frame |= 1 << bit_count;
+
+	if(++bit_count < 11)
+		return;
+
+	uint8_t next = (frames_head + 1) & (PS2_BUFFER_SIZE - 1);
+	if(next != frames_tail) {
+
+		frames[frames_head] = frame;
+		frames_head = next;
+	}
+
+	bit_count = 0;
+	frame = 0;
+}
+
+// The oldest frame received, PS2_BAD_FRAME if its start, stop or parity bit is wrong
+uint8_t ps2_read(uint8_t * byte) {
+
+	if(frames_tail == frames_head)
+		return PS2_NONE;
+
+	uint16_t received = frames[frames_tail];
+	frames_tail = (frames_tail + 1) & (PS2_BUFFER_SIZE - 1);
+
+	*byte = received >> 1;
+
+	uint8_t ones = 0;
+	for(uint8_t i = 1; i < 10; ++i)
+		ones += (received >> i) & 1;
+
+	if((received & 0x0001) || !(received & 0x0400) || !(ones & 1))
+		return PS2_BAD_FRAME;
+
+	return PS2_BYTE;
+}
@@ -0,0 +1,11 @@
+#if !defined(PS2_FRAME_H)
+#define PS2_FRAME_H
+
+#include <inttypes.h>
+#include <stdbool.h>
+
+void ps2_frame_init(void);
+void ps2_frame_cut(void);
+void ps2_frame_bit(bool data, uint16_t now);
+
+#endif
@@ -0,0 +1,217 @@
+
+#include <inttypes.h>
+#include <stdbool.h>
+
+#include "mouse_keys.h"
+#include "ps2.h"
+#include "ps2_mouse.h"
+#include "timer.h"
+
+// A PS/2 pointing stick, e.g. a trackpoint or a Sprintek SK8702, set up in stream mode at PS2_MOUSE_SAMPLE_RATE. The
+// setup is a list of commands, each sent once the last one is acked, so nothing waits in the scan loop. Once it
+// streams, each three byte packet is added to the mouse report through mouse_keys.c, which merges everything until
+// the host's next poll. A device that stops answering, or is plugged in again and says hello, is set up again
+//
+// Only ps2.c touches the hardware, so this can be fed bytes from anywhere
+
+#define PS2_RESET 0xFF
+#define PS2_SET_SAMPLE_RATE 0xF3
+#define PS2_ENABLE_REPORTING 0xF4
+#define PS2_ACK 0xFA
+#define PS2_SELF_TEST_PASSED 0xAA
+#define PS2_MOUSE_ID 0x00
+
+// The bits of the first byte of a packet
+#define PACKET_BUTTONS 0x07
+#define PACKET_ALWAYS_SET 0x08
+#define PACKET_X_SIGN 0x10
+#define PACKET_Y_SIGN 0x20
+#define PACKET_X_OVERFLOW 0x40
+#define PACKET_Y_OVERFLOW 0x80
+
+// The self test after a reset can take the best part of a second
+#define RESET_TIMEOUT 1000
+#define ACK_TIMEOUT 50
+// Bytes of one packet come within a few ms of each other, a longer gap means a byte was lost
+#define PACKET_TIMEOUT 10
+// When nothing answers, e.g. nothing is plugged in
+#define RETRY_TIME 1000
+
+// Sent in order, starting again from the top after a reset
+static const uint8_t setup_commands[] = {
+	PS2_RESET,
+	PS2_SET_SAMPLE_RATE, PS2_MOUSE_SAMPLE_RATE,
+	PS2_ENABLE_REPORTING
+};
+
+#define NUM_SETUP_COMMANDS (sizeof(setup_commands) / sizeof(setup_commands[0]))
+
+#define SENDING 0
+#define WAITING_FOR_ACK 1
+#define WAITING_FOR_SELF_TEST 2
+#define WAITING_FOR_ID 3
+#define STREAMING 4
+#define RETRYING 5
+
+static uint8_t state;
+static uint8_t command;
+static uint16_t state_time;
+
+static uint8_t packet[3];
+static uint8_t packet_length;
+static uint16_t last_byte_time;
+
+// The packet so far is self test passed and the id, after a pause. 0xAA is a good first byte of a packet as well, so
+// it was the stick plugged in again only if no third byte comes
+static bool maybe_reconnected;
+
+static void set_state(uint8_t new_state) {
+
+	state = new_state;
+	state_time = timer_read();
+}
+
+static void restart(uint8_t new_state) {
+
+	ps2_init();
+	command = 0;
+	set_state(new_state);
+}
+
+static void next_command(void) {
+
+	if(++command == NUM_SETUP_COMMANDS) {
+
+		packet_length = 0;
+		maybe_reconnected = false;
+		last_byte_time = timer_read();
+		set_state(STREAMING);
+		return;
+	}
+
+	set_state(SENDING);
+}
+
+static void add_packet(void) {
+
+	// Overflowed movement isn't worth anything, the stick was pushed past what fits and the next packet catches up
+	if(packet[0] & (PACKET_X_OVERFLOW | PACKET_Y_OVERFLOW)) {
+
+		mouse_keys_pointer(0, 0, packet[0] & PACKET_BUTTONS);
+		return;
+	}
+
+	int16_t x = packet[1] - ((packet[0] & PACKET_X_SIGN) ? 256 : 0);
+	int16_t y = packet[2] - ((packet[0] & PACKET_Y_SIGN) ? 256 : 0);
+
+	// Up is positive for PS/2 and down for usb
+	mouse_keys_pointer(x, -y, packet[0] & PACKET_BUTTONS);
+}
+
+static void stream_byte(uint8_t byte) {
+
+	bool pause = timer_elapsed(last_byte_time) > PACKET_TIMEOUT;
+	last_byte_time = timer_read();
+
+	if(pause)
+		packet_length = 0;
+
+	// The first byte of a packet always has this bit set, anything else is the middle of a packet we lost track of
+	if(packet_length == 0 && !(byte & PACKET_ALWAYS_SET))
+		return;
+
+	if(packet_length == 0)
+		maybe_reconnected = pause && byte == PS2_SELF_TEST_PASSED;
+	else if(packet_length == 1)
+		maybe_reconnected = maybe_reconnected && byte == PS2_MOUSE_ID;
+
+	packet[packet_length++] = byte;
+
+	if(packet_length < 3)
+		return;
+
+	add_packet();
+	packet_length = 0;
+}
+
+static void setup_byte(uint8_t byte) {
+
+	if(state == WAITING_FOR_ACK && byte == PS2_ACK) {
+
+		if(setup_commands[command] == PS2_RESET)
+			set_state(WAITING_FOR_SELF_TEST);
+		else
+			next_command();
+	} else if(state == WAITING_FOR_SELF_TEST && byte == PS2_SELF_TEST_PASSED) {
+
+		set_state(WAITING_FOR_ID);
+	} else if(state == WAITING_FOR_ID && byte == PS2_MOUSE_ID) {
+
+		next_command();
+	}
+}
+
+void ps2_mouse_init(void) {
+
+	restart(SENDING);
+}
+
+// Called once per scan, before mouse_keys_task so the movement goes in this scan's report
+void ps2_mouse_task(void) {
+
+	ps2_task();
+
+	uint8_t byte;
+	uint8_t result;
+
+	while((result = ps2_read(&byte)) != PS2_NONE) {
+
+		if(result == PS2_BAD_FRAME) {
+
+			// The rest of the packet is no use without this byte
+			packet_length = 0;
+			continue;
+		}
+
+		if(state == STREAMING)
+			stream_byte(byte);
+		else
+			setup_byte(byte);
+	}
+
+	switch(state) {
+
+	case SENDING:
+
+		if(ps2_send(setup_commands[command]))
+			set_state(WAITING_FOR_ACK);
+		else if(timer_elapsed(state_time) > ACK_TIMEOUT)
+			restart(RETRYING);
+		break;
+
+	case WAITING_FOR_ACK:
+	case WAITING_FOR_ID:
+
+		if(timer_elapsed(state_time) > ACK_TIMEOUT)
+			restart(RETRYING);
+		break;
+
+	case STREAMING:
+
+		if(maybe_reconnected && packet_length == 2 && timer_elapsed(last_byte_time) > PACKET_TIMEOUT)
+			restart(SENDING);
+		break;
+
+	case WAITING_FOR_SELF_TEST:
+
+		if(timer_elapsed(state_time) > RESET_TIMEOUT)
+			restart(RETRYING);
+		break;
+
+	case RETRYING:
+
+		if(timer_elapsed(state_time) > RETRY_TIME)
+			set_state(SENDING);
+		break;
+	}
+}
@@ -0,0 +1,14 @@
+
+#if !defined(PS2_MOUSE_H)
+#define PS2_MOUSE_H
+
+#include <inttypes.h>
+#include <stdbool.h>
+
+// Reports a second, 200 is the most a PS/2 mouse can be asked for
+#define PS2_MOUSE_SAMPLE_RATE 200
+
+void ps2_mouse_init(void);
+void ps2_mouse_task(void);
+
+#endif
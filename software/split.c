@@ -0,0 +1,995 @@
+#include <inttypes.h>
+#include <stdbool.h>
+#include <assert.h>
+#define static_assert _Static_assert
+
+#include <avr/interrupt.h>
+#include <avr/pgmspace.h>
+
+#include "split.h"
+#include "timer.h"
+#include "twi.h"
+
+// Every module, the other half included, queues a press or release event for every key that changes, each with the
+// next sequence number, and keeps its matrix as of its last event. Sequence numbers are a byte and wrap, only
+// differences are compared
+//
+// At startup the master tells every address that answers it is a slave and reads its descriptor: which side its keys
+// are on, the first of that side's keys they stand for, how many there are, and the format of its answers. From then
+// on it only talks to the modules it found, and every SPLIT_REPROBE_INTERVAL ms goes through the same steps with each
+// address where there is none, so a half plugged in later is picked up. A module's keys are let go as soon as it
+// misses an exchange, in case it was pulled out with some down, and one that misses SPLIT_MAX_FAILURES in a row is
+// taken as unplugged and looked for again like any other. One that comes back is out of sync, so the first thing it
+// is asked for is a checkpoint. Any request from the master tells a
+// module it is a slave just as well, so one restarted by a glitch on the cable before the master gave up on it
+// doesn't wait for a command that isn't coming
+//
+// Every exchange takes the bus once: the master writes a header, then with a repeated start reads the answer. The
+// header is the request, the host's leds and the master's active layers, which the module keeps, and the sequence
+// number of the first event the master is missing, which tells the module the master has everything before it.
+// Every answer starts with the sequence number of the module's next event. A read always clocks in as many bytes as
+// the master asks for, whatever a module has left unsaid reads as 0xFF off the pull ups, so every answer also says
+// how much of it is real: how many events follow, or how many keys the matrix has
+//
+// The master reads just the events it knows it is missing, none at all when it is only passing on new leds or
+// checking in. If it falls further behind than the queue, reads something that doesn't add up, or hasn't for
+// SPLIT_CHECKPOINT_INTERVAL ms, it asks for a checkpoint instead: the whole matrix as a bitmap along with the
+// sequence number it is up to date with
+//
+// The master only reads when told to. Once it has asked for a checkpoint, a module takes the bus itself whenever it
+// has events the master hasn't acknowledged or heard about and writes SPLIT_NOTIFY, its number and its next sequence
+// number to SPLIT_MASTER_ADDRESS, much like smbus host notify. The master still checks in on every module in case a
+// notification went missing, every SPLIT_POLL_INTERVAL ms while it has keys down and every SPLIT_IDLE_POLL_INTERVAL
+// ms otherwise. Modules with something to do are served in turn before any of that, so the wait for a key only grows
+// with the number of modules whose keys are changing at the same moment, not with how many there are
+//
+// - SPLIT_REQUEST_EVENTS header: next sequence, how many events follow, the events from the first missing on, oldest
+//   first. SPLIT_EVENTS_LOST for how many if some of them are gone from the queue
+// - SPLIT_REQUEST_CHECKPOINT header: next sequence, SPLIT_VERSION, number of keys, matrix
+// - SPLIT_REQUEST_DESCRIPTOR header: next sequence, SPLIT_VERSION, SPLIT_FORMAT_EVENTS, side, first key, keys
+// - SPLIT_REQUEST_PROBE pattern, without a header: next sequence, the pattern with every bit flipped
+//
+// A module never builds an answer in the twi interrupt. The scan loop keeps two, each with the checkpoint and the
+// last SPLIT_EVENT_QUEUE_SIZE events, fills the one the interrupt isn't sending from and hands it over. When the
+// master next reads, the interrupt swaps it in and sends straight out of it, so the master never gets half of one
+// answer and half of the next
+//
+// The link starts at TWI_FREQ. Once the modules have answered, the master tries each speed in link_speeds from the
+// fastest, echoing SPLIT_PROBE_ROUNDS patterns off every module at each, and stays at the first where every one
+// comes back intact. A module found later echoes SPLIT_RECHECK_ROUNDS before it is synced, one exchange at a time in
+// turn with the others, at the link's speed or from the fastest again if no other module is there. A pattern that
+// comes back wrong, or SPLIT_MAX_GARBLED garbled answers within SPLIT_GARBLED_INTERVAL ms, slow the link a step and
+// every module is checked again at the new speed
+
+#define SPLIT_VERSION 5
+#define SPLIT_MATRIX_SIZE ((SPLIT_NUM_KEYS + 7) / 8)
+#define SPLIT_CHECKPOINT_SIZE(num_keys) (3 + ((num_keys) + 7) / 8)
+#define SPLIT_EVENTS_SIZE(count) (2 + (count))
+#define SPLIT_DESCRIPTOR_SIZE 6
+
+// The only format of answer so far, the events and checkpoints above
+#define SPLIT_FORMAT_EVENTS 1
+
+// Master to slave, the first byte of a write
+#define SPLIT_COMMAND_SLAVE 'S'
+#define SPLIT_REQUEST_NONE 0
+#define SPLIT_REQUEST_EVENTS 'E'
+#define SPLIT_REQUEST_CHECKPOINT 'C'
+#define SPLIT_REQUEST_DESCRIPTOR 'D'
+#define SPLIT_REQUEST_PROBE 'P'
+
+// Request, leds, layers, first missing sequence
+#define SPLIT_HEADER_SIZE 4
+
+// Slave to master
+#define SPLIT_NOTIFY 'N'
+
+#define SPLIT_PROBE_SIZE 8
+#define SPLIT_PROBE_ROUNDS 16
+// A module found while the link runs passes fewer, its keys wait on them. Garbled answers still slow the link later
+#define SPLIT_RECHECK_ROUNDS 4
+
+// An event is the key with this bit set for a press
+#define SPLIT_EVENT_PRESSED 0x80
+#define SPLIT_EVENT_KEY 0x7F
+#define SPLIT_EVENTS_LOST 0xFF
+
+static_assert((SPLIT_EVENT_QUEUE_SIZE & (SPLIT_EVENT_QUEUE_SIZE - 1)) == 0, "the event queue is indexed with a mask");
+static_assert(SPLIT_EVENTS_SIZE(SPLIT_EVENT_QUEUE_SIZE) <= TWI_BUFFER_LENGTH, "a full queue doesn't fit in one read");
+static_assert(SPLIT_EVENT_QUEUE_SIZE < SPLIT_EVENTS_LOST, "a full queue's count reads as lost events");
+static_assert(SPLIT_NUM_KEYS <= SPLIT_EVENT_KEY + 1, "key numbers don't fit in an event");
+static_assert(SPLIT_SLAVE_ADDRESS + SPLIT_MAX_MODULES <= SPLIT_MASTER_ADDRESS, "a module would answer as the master");
+static_assert(SPLIT_MAX_MODULES <= 8, "notified modules are a bit each in a byte");
+static_assert(SPLIT_MODULE < SPLIT_MAX_MODULES, "the master doesn't look for this module");
+static_assert(SPLIT_MODULE_FIRST_KEY + SPLIT_MODULE_NUM_KEYS <= SPLIT_NUM_KEYS, "the module's keys don't fit its side");
+
+// In kHz, 1 MHz is as fast as a 16 MHz slave can follow
+static const uint16_t PROGMEM link_speeds[] = {1000, 400, TWI_FREQ / 1000};
+#define NUM_LINK_SPEEDS (sizeof(link_speeds) / sizeof(link_speeds[0]))
+
+// Slave, the events and the matrix belong to the scan loop, the twi interrupt only sees the answers built from them.
+// An answer's events start with two spare bytes, the interrupt puts the sequence number and the count in the two
+// bytes before the first event it sends. Those events are never needed again: the master only ever asks for later
+// ones
+struct answer {
+	uint8_t checkpoint[SPLIT_CHECKPOINT_SIZE(SPLIT_MODULE_NUM_KEYS)];
+	uint8_t events[SPLIT_EVENTS_SIZE(SPLIT_EVENT_QUEUE_SIZE)];
+};
+
+static uint8_t matrix[SPLIT_MATRIX_SIZE];
+static uint8_t events[SPLIT_EVENT_QUEUE_SIZE];
+static volatile uint8_t next_sequence = 0;
+static volatile uint8_t acked_sequence = 0;
+static struct answer answers[2];
+static volatile uint8_t front_answer = 0;
+static volatile bool back_answer_ready = false;
+static volatile bool slave_selected = false;
+static volatile uint8_t request = SPLIT_REQUEST_NONE;
+static volatile uint8_t request_sequence;
+static uint8_t probe_answer[1 + SPLIT_PROBE_SIZE];
+static uint8_t descriptor_answer[SPLIT_DESCRIPTOR_SIZE];
+static volatile uint8_t host_leds = 0;
+static volatile uint8_t host_layers = 0;
+static volatile bool notify_enabled = false;
+static bool notifying = false;
+static uint8_t notify_message[] = {SPLIT_NOTIFY, SPLIT_MODULE, 0};
+static uint8_t notified_sequence = 0;
+
+// Master, a module for each address, present once it has answered with a descriptor we understand
+struct module {
+	bool present;
+	// Exchanges in a row it hasn't answered
+	uint8_t failures;
+	uint8_t side;
+	uint8_t first_key;
+	uint8_t num_keys;
+	uint8_t matrix[SPLIT_MATRIX_SIZE];
+	// Probe exchanges it still has to pass at the link's speed, nothing else is asked of it until then
+	uint8_t probe_rounds;
+	bool synced;
+	uint8_t expected_sequence;
+	// Its next sequence as far as the master has heard, never behind expected_sequence
+	uint8_t slave_sequence;
+	// As last sent
+	uint8_t leds;
+	uint8_t layers;
+	uint16_t last_checkpoint_time;
+	uint16_t last_poll_time;
+};
+
+static struct module modules[SPLIT_MAX_MODULES];
+static volatile uint8_t notified_modules = 0;
+static volatile uint8_t notify_sequences[SPLIT_MAX_MODULES];
+
+// Transfers are started by one call to split_master_task and finished by a later one, one module at a time
+enum link_state {
+	LINK_IDLE,
+	LINK_REQUESTING_EVENTS,
+	LINK_READING_EVENTS,
+	LINK_REQUESTING_CHECKPOINT,
+	LINK_READING_CHECKPOINT,
+	LINK_SELECTING,
+	LINK_REQUESTING_DESCRIPTOR,
+	LINK_READING_DESCRIPTOR,
+	LINK_WRITING_PROBE,
+	LINK_READING_PROBE
+};
+
+static uint8_t link_state = LINK_IDLE;
+static uint8_t link_module = 0;
+static uint8_t link_command[1 + SPLIT_PROBE_SIZE];
+static uint8_t link_packet[SPLIT_EVENTS_SIZE(SPLIT_EVENT_QUEUE_SIZE)];
+static uint8_t link_count;
+static uint8_t link_speed_index = NUM_LINK_SPEEDS - 1;
+static uint16_t link_speed = TWI_FREQ / 1000;
+static uint16_t link_errors = 0;
+static uint8_t garbled_count = 0;
+static uint16_t garbled_time = 0;
+// Addresses with no module still to be tried this SPLIT_REPROBE_INTERVAL, a bit each
+static uint8_t reprobe_modules = 0;
+static uint16_t last_reprobe_time = 0;
+
+static_assert(SPLIT_CHECKPOINT_SIZE(SPLIT_NUM_KEYS) <= sizeof(link_packet), "a checkpoint doesn't fit in the packet");
+static_assert(SPLIT_DESCRIPTOR_SIZE <= sizeof(link_packet), "a descriptor doesn't fit in the packet");
+static_assert(1 + SPLIT_PROBE_SIZE <= sizeof(link_packet), "a probe answer doesn't fit in the packet");
+static_assert(SPLIT_HEADER_SIZE <= sizeof(link_command), "a header doesn't fit in the command");
+
+static bool is_pressed(const uint8_t * keys, uint8_t key) {
+
+	return keys[key >> 3] & (1 << (key & 7));
+}
+
+static void set_pressed(uint8_t * keys, uint8_t key, bool pressed) {
+
+	if(pressed)
+		keys[key >> 3] |= 1 << (key & 7);
+	else
+		keys[key >> 3] &= ~(1 << (key & 7));
+}
+
+static void slave_receive(uint8_t * buffer, int num_bytes) {
+
+	if(num_bytes < 1)
+		return;
+
+	if(buffer[0] == SPLIT_COMMAND_SLAVE)
+		slave_selected = true;
+
+	if(buffer[0] == SPLIT_REQUEST_DESCRIPTOR && num_bytes == SPLIT_HEADER_SIZE) {
+
+		slave_selected = true;
+		request = SPLIT_REQUEST_DESCRIPTOR;
+	}
+
+	if((buffer[0] == SPLIT_REQUEST_EVENTS || buffer[0] == SPLIT_REQUEST_CHECKPOINT) && num_bytes == SPLIT_HEADER_SIZE) {
+
+		slave_selected = true;
+		request = buffer[0];
+		host_leds = buffer[1];
+		host_layers = buffer[2];
+
+		if(buffer[0] == SPLIT_REQUEST_EVENTS) {
+
+			// Only a sequence number still in the queue counts as an ack, anything else is the master being lost
+			request_sequence = buffer[3];
+			if((uint8_t)(next_sequence - buffer[3]) <= SPLIT_EVENT_QUEUE_SIZE)
+				acked_sequence = buffer[3];
+		} else {
+
+			notify_enabled = true;
+		}
+	}
+
+	if(buffer[0] == SPLIT_REQUEST_PROBE && num_bytes == 1 + SPLIT_PROBE_SIZE) {
+
+		request = SPLIT_REQUEST_PROBE;
+		for(uint8_t i = 0; i < SPLIT_PROBE_SIZE; ++i)
+			probe_answer[1 + i] = ~buffer[1 + i];
+	}
+
+	// Only the master is written this
+	if(buffer[0] == SPLIT_NOTIFY && num_bytes == sizeof(notify_message) && buffer[1] < SPLIT_MAX_MODULES) {
+
+		notify_sequences[buffer[1]] = buffer[2];
+		notified_modules |= 1 << buffer[1];
+	}
+}
+
+// Called from the twi interrupt when the master reads, the master stops reading once it has what it wants
+static void slave_transmit(void) {
+
+	if(back_answer_ready) {
+
+		front_answer ^= 1;
+		back_answer_ready = false;
+	}
+
+	struct answer * answer = &answers[front_answer];
+	uint8_t sequence = answer->checkpoint[0];
+
+	if(request == SPLIT_REQUEST_EVENTS) {
+
+		// Events already overwritten can't be sent, the count says so and the master asks for a checkpoint
+		uint8_t count = sequence - request_sequence;
+		if(count <= SPLIT_EVENT_QUEUE_SIZE) {
+
+			uint8_t * packet = &answer->events[SPLIT_EVENT_QUEUE_SIZE - count];
+			packet[0] = sequence;
+			packet[1] = count;
+			twi_transmitFrom(packet, SPLIT_EVENTS_SIZE(count));
+		} else {
+
+			uint8_t * packet = answer->events;
+			packet[0] = sequence;
+			packet[1] = SPLIT_EVENTS_LOST;
+			twi_transmitFrom(packet, SPLIT_EVENTS_SIZE(0));
+		}
+	} else if(request == SPLIT_REQUEST_CHECKPOINT) {
+
+		twi_transmitFrom(answer->checkpoint, sizeof(answer->checkpoint));
+	} else if(request == SPLIT_REQUEST_DESCRIPTOR) {
+
+		descriptor_answer[0] = sequence;
+		twi_transmitFrom(descriptor_answer, sizeof(descriptor_answer));
+	} else if(request == SPLIT_REQUEST_PROBE) {
+
+		probe_answer[0] = sequence;
+		twi_transmitFrom(probe_answer, sizeof(probe_answer));
+	} else {
+
+		twi_transmitFrom(answer->checkpoint, 1);
+	}
+
+	request = SPLIT_REQUEST_NONE;
+}
+
+// Builds an answer from the events and matrix as they are now in the buffer the interrupt isn't sending from
+static void publish_answer(void) {
+
+	// Taken back first, so the interrupt can't swap it in half built. If it swapped just before, the other buffer is
+	// now the free one
+	back_answer_ready = false;
+	struct answer * answer = &answers[front_answer ^ 1];
+
+	answer->checkpoint[0] = next_sequence;
+	answer->checkpoint[1] = SPLIT_VERSION;
+	answer->checkpoint[2] = SPLIT_MODULE_NUM_KEYS;
+	for(uint8_t i = 3; i < sizeof(answer->checkpoint); ++i)
+		answer->checkpoint[i] = matrix[i - 3];
+
+	for(uint8_t i = 0; i < SPLIT_EVENT_QUEUE_SIZE; ++i)
+		answer->events[2 + i] = events[(uint8_t)(next_sequence + i) & (SPLIT_EVENT_QUEUE_SIZE - 1)];
+
+	back_answer_ready = true;
+}
+
+// Side is where our keys go on the master if we turn out to be a slave
+void split_init(uint8_t side) {
+
+	descriptor_answer[1] = SPLIT_VERSION;
+	descriptor_answer[2] = SPLIT_FORMAT_EVENTS;
+	descriptor_answer[3] = side;
+	descriptor_answer[4] = SPLIT_MODULE_FIRST_KEY;
+	descriptor_answer[5] = SPLIT_MODULE_NUM_KEYS;
+	publish_answer();
+
+	twi_setAddress(SPLIT_SLAVE_ADDRESS + SPLIT_MODULE);
+	twi_attachSlaveTxEvent(slave_transmit);
+	twi_attachSlaveRxEvent(slave_receive);
+	twi_init();
+}
+
+// True once the master has told us we are a slave, or asked us for anything
+bool split_slave_selected(void) {
+
+	return slave_selected;
+}
+
+// The host's keyboard leds, as of the master's last request
+uint8_t split_slave_leds(void) {
+
+	return host_leds;
+}
+
+// The layers active on the master, as of its last request
+uint8_t split_slave_layers(void) {
+
+	return host_layers;
+}
+
+// Queues an event for each of our keys that has changed since the last call
+void split_slave_update(const uint8_t * status) {
+
+	bool changed = false;
+
+	for(uint8_t key = 0; key < SPLIT_MODULE_NUM_KEYS; ++key) {
+
+		bool pressed = status[key] != 0;
+		if(pressed == is_pressed(matrix, key))
+			continue;
+
+		events[next_sequence & (SPLIT_EVENT_QUEUE_SIZE - 1)] = key | (pressed ? SPLIT_EVENT_PRESSED : 0);
+		set_pressed(matrix, key, pressed);
+		next_sequence++;
+		changed = true;
+	}
+
+	// The matrix and the next sequence go out together, so a checkpoint always matches its sequence
+	if(changed)
+		publish_answer();
+
+	// Tells the master about new events, a notification that didn't get through is sent again next time
+	if(notifying) {
+
+		uint8_t result = twi_result();
+		if(result == TWI_PENDING)
+			return;
+
+		notifying = false;
+		if(result == 0)
+			notified_sequence = notify_message[2];
+	}
+
+	uint8_t sequence = next_sequence;
+	if(notify_enabled && sequence != acked_sequence && sequence != notified_sequence) {
+
+		notify_message[2] = sequence;
+		notifying = twi_writeToAsync(SPLIT_MASTER_ADDRESS, notify_message, sizeof(notify_message), true) == 0;
+	}
+}
+
+static void count_error(void) {
+
+	if(link_errors < 0xFFFF)
+		link_errors++;
+}
+
+static void clear_module(struct module * module) {
+
+	module->probe_rounds = 0;
+	module->synced = false;
+	module->failures = 0;
+	for(uint8_t i = 0; i < SPLIT_MATRIX_SIZE; ++i)
+		module->matrix[i] = 0;
+}
+
+// Left alone if it speaks another version, or its keys are somewhere the keymap doesn't have
+static bool apply_descriptor(struct module * module, const uint8_t * packet) {
+
+	if(packet[1] != SPLIT_VERSION || packet[2] != SPLIT_FORMAT_EVENTS || packet[3] >= NUM_KEYBOARD_SIDES ||
+		packet[5] > SPLIT_NUM_KEYS || packet[4] > SPLIT_NUM_KEYS - packet[5]) {
+
+		count_error();
+		return false;
+	}
+
+	module->side = packet[3];
+	module->first_key = packet[4];
+	module->num_keys = packet[5];
+	clear_module(module);
+
+	module->present = true;
+	return true;
+}
+
+// A module that stops answering has most likely been unplugged, with its keys as they were they would stay down. If
+// it was only a glitch the checkpoint it is asked for next brings back the ones still held
+static void module_failed(struct module * module) {
+
+	count_error();
+	module->synced = false;
+	for(uint8_t i = 0; i < SPLIT_MATRIX_SIZE; ++i)
+		module->matrix[i] = 0;
+
+	if(++module->failures >= SPLIT_MAX_FAILURES) {
+
+		clear_module(module);
+		module->present = false;
+	}
+}
+
+// Tells the module at number it is a slave and reads what it is, returns whether it is one we can use
+static bool enumerate(uint8_t number) {
+
+	struct module * module = &modules[number];
+	uint8_t address = SPLIT_SLAVE_ADDRESS + number;
+
+	module->present = false;
+	module->synced = false;
+
+	uint8_t command[] = {SPLIT_COMMAND_SLAVE};
+	if(twi_writeTo(address, command, sizeof(command), true, true) != 0)
+		return false;
+
+	uint8_t header[SPLIT_HEADER_SIZE] = {SPLIT_REQUEST_DESCRIPTOR};
+	uint8_t packet[SPLIT_DESCRIPTOR_SIZE];
+
+	if(twi_writeTo(address, header, sizeof(header), true, false) != 0 ||
+		twi_readFrom(address, packet, sizeof(packet), true) != sizeof(packet)) {
+
+		count_error();
+		return false;
+	}
+
+	return apply_descriptor(module, packet);
+}
+
+// Runs of ones and zeros, single bits both ways and the round number, so no two rounds are the same
+static void probe_pattern(uint8_t * command, uint8_t round) {
+
+	static const uint8_t PROGMEM pattern[SPLIT_PROBE_SIZE - 2] = {0x00, 0xFF, 0x55, 0xAA, 0x0F, 0xF0};
+
+	command[0] = SPLIT_REQUEST_PROBE;
+	for(uint8_t i = 0; i < sizeof(pattern); ++i)
+		command[1 + i] = pgm_read_byte(&pattern[i]);
+	command[SPLIT_PROBE_SIZE - 1] = round;
+	command[SPLIT_PROBE_SIZE] = ~round;
+}
+
+static bool probe_echoed(const uint8_t * command, const uint8_t * packet) {
+
+	for(uint8_t i = 0; i < SPLIT_PROBE_SIZE; ++i)
+		if(packet[1 + i] != (uint8_t)~command[1 + i])
+			return false;
+
+	return true;
+}
+
+static bool probe(uint8_t address, uint8_t round) {
+
+	uint8_t command[1 + SPLIT_PROBE_SIZE];
+	uint8_t packet[1 + SPLIT_PROBE_SIZE];
+
+	probe_pattern(command, round);
+
+	if(twi_writeTo(address, command, sizeof(command), true, true) != 0 ||
+		twi_readFrom(address, packet, sizeof(packet), true) != sizeof(packet))
+		return false;
+
+	return probe_echoed(command, packet);
+}
+
+static bool probe_modules(void) {
+
+	for(uint8_t number = 0; number < SPLIT_MAX_MODULES; ++number) {
+
+		if(!modules[number].present)
+			continue;
+
+		for(uint8_t round = 0; round < SPLIT_PROBE_ROUNDS; ++round)
+			if(!probe(SPLIT_SLAVE_ADDRESS + number, round))
+				return false;
+	}
+
+	return true;
+}
+
+static void set_link_speed(uint8_t index) {
+
+	link_speed_index = index;
+	link_speed = pgm_read_word(&link_speeds[index]);
+	twi_setFrequency(link_speed * 1000UL);
+}
+
+// Finds the modules on the bus and picks the fastest speed that works for all of them. Modules found later by
+// split_master_task are checked at the link's speed then, see check_speed
+void split_master_connect(void) {
+
+	twi_setAddress(SPLIT_MASTER_ADDRESS);
+	set_link_speed(NUM_LINK_SPEEDS - 1);
+	link_state = LINK_IDLE;
+	notified_modules = 0;
+	reprobe_modules = 0;
+	last_reprobe_time = timer_read();
+
+	bool found = false;
+	for(uint8_t number = 0; number < SPLIT_MAX_MODULES; ++number)
+		if(enumerate(number))
+			found = true;
+
+	if(!found)
+		return;
+
+	for(uint8_t i = 0; i < NUM_LINK_SPEEDS; ++i) {
+
+		set_link_speed(i);
+		if(probe_modules())
+			return;
+
+		count_error();
+	}
+
+	// Even the slowest speed garbles something, it is still better than nothing
+}
+
+// A module found while the link runs has to pass the probe at its speed first. With no other module to hold back, the
+// fastest speed is tried again, the link may still be at TWI_FREQ from a startup with nothing plugged in
+static void check_speed(uint8_t number) {
+
+	bool alone = true;
+	for(uint8_t other = 0; other < SPLIT_MAX_MODULES; ++other)
+		if(other != number && modules[other].present)
+			alone = false;
+
+	if(alone)
+		set_link_speed(0);
+
+	modules[number].probe_rounds = SPLIT_RECHECK_ROUNDS;
+}
+
+// Slows the link a step and has every module pass the probe again. Already at the slowest there is nothing left to
+// try, they carry on as they are
+static void step_down_speed(void) {
+
+	garbled_count = 0;
+
+	bool slower = link_speed_index + 1 < NUM_LINK_SPEEDS;
+	if(slower)
+		set_link_speed(link_speed_index + 1);
+
+	for(uint8_t number = 0; number < SPLIT_MAX_MODULES; ++number)
+		if(modules[number].present)
+			modules[number].probe_rounds = slower ? SPLIT_RECHECK_ROUNDS : 0;
+}
+
+// An answer that came back but doesn't add up, too many close together and the link is too fast for the wiring
+static void garbled(void) {
+
+	count_error();
+
+	if(timer_elapsed(garbled_time) >= SPLIT_GARBLED_INTERVAL) {
+
+		garbled_count = 0;
+		garbled_time = timer_read();
+	}
+
+	if(++garbled_count >= SPLIT_MAX_GARBLED)
+		step_down_speed();
+}
+
+// The link's speed in kHz, as picked by split_master_connect and slowed since
+uint16_t split_link_speed(void) {
+
+	return link_speed;
+}
+
+// Failed or garbled transfers since startup, including speeds given up on while probing
+uint16_t split_link_errors(void) {
+
+	return link_errors;
+}
+
+// Writes the header without a stop, the read that answers it follows with a repeated start
+static void start_request(uint8_t state, uint8_t command, uint8_t leds, uint8_t layers) {
+
+	struct module * module = &modules[link_module];
+
+	link_command[0] = command;
+	link_command[1] = leds;
+	link_command[2] = layers;
+	link_command[3] = module->expected_sequence;
+	link_state = twi_writeToAsync(SPLIT_SLAVE_ADDRESS + link_module, link_command, SPLIT_HEADER_SIZE, false) == 0 ?
+		state : LINK_IDLE;
+}
+
+// The same steps as enumerate, one per call
+static void start_select(void) {
+
+	link_command[0] = SPLIT_COMMAND_SLAVE;
+	link_state = twi_writeToAsync(SPLIT_SLAVE_ADDRESS + link_module, link_command, 1, true) == 0 ?
+		LINK_SELECTING : LINK_IDLE;
+}
+
+// One round of the probe, the module's probe_rounds counts them down
+static void start_probe(void) {
+
+	probe_pattern(link_command, modules[link_module].probe_rounds);
+	link_state = twi_writeToAsync(SPLIT_SLAVE_ADDRESS + link_module, link_command, 1 + SPLIT_PROBE_SIZE, true) == 0 ?
+		LINK_WRITING_PROBE : LINK_IDLE;
+}
+
+static void start_read(uint8_t state, uint8_t length) {
+
+	link_state = twi_readFromAsync(SPLIT_SLAVE_ADDRESS + link_module, link_packet, length, true) == 0 ?
+		state : LINK_IDLE;
+}
+
+// Notifications and answers can come in any order, only the newest sequence a module has given counts
+static void heard_sequence(struct module * module, uint8_t sequence) {
+
+	if((int8_t)(sequence - module->slave_sequence) > 0)
+		module->slave_sequence = sequence;
+}
+
+static void apply_checkpoint(uint8_t length) {
+
+	struct module * module = &modules[link_module];
+
+	// A module that stopped answering part way leaves 0xFF in the version, or in the key count if it ran short
+	if(length != SPLIT_CHECKPOINT_SIZE(module->num_keys) || link_packet[1] != SPLIT_VERSION ||
+		link_packet[2] != module->num_keys) {
+
+		garbled();
+		return;
+	}
+
+	module->expected_sequence = link_packet[0];
+	module->slave_sequence = link_packet[0];
+	for(uint8_t i = 3; i < length; ++i)
+		module->matrix[i - 3] = link_packet[i];
+
+	module->synced = true;
+	module->last_checkpoint_time = timer_read();
+}
+
+static void apply_events(uint8_t length) {
+
+	struct module * module = &modules[link_module];
+
+	// More may have come since the count was decided, they are read next time. The answer can also be one the module
+	// built before the notification we are acting on, then only the events up to its sequence number are in it. The
+	// count the module sent has to agree, anything past what it sent is padding
+	uint8_t count = link_packet[0] - module->expected_sequence;
+	if(length != SPLIT_EVENTS_SIZE(link_count) || link_packet[1] != count || count > SPLIT_EVENT_QUEUE_SIZE) {
+
+		garbled();
+		module->synced = false;
+		return;
+	}
+
+	if(count > link_count)
+		count = link_count;
+
+	heard_sequence(module, link_packet[0]);
+
+	// A key that changes twice is left for the next read, so the keymap sees a tap that came between two reads
+	uint8_t changed[SPLIT_MATRIX_SIZE] = {0};
+
+	for(uint8_t i = 0; i < count; ++i) {
+
+		uint8_t key = link_packet[2 + i] & SPLIT_EVENT_KEY;
+
+		if(key >= module->num_keys) {
+
+			garbled();
+			module->synced = false;
+			return;
+		}
+
+		if(is_pressed(changed, key))
+			break;
+
+		set_pressed(changed, key, true);
+		set_pressed(module->matrix, key, link_packet[2 + i] & SPLIT_EVENT_PRESSED);
+		module->expected_sequence++;
+	}
+}
+
+// Takes the last transfer one step on, starting the read once its header is through. A read that gets nothing at
+// all counts as no answer, one that gets something wrong is only a garbled one
+static void finish_transfer(uint8_t result) {
+
+	struct module * module = &modules[link_module];
+	uint8_t state = link_state;
+	link_state = LINK_IDLE;
+
+	// Another master had the bus, most likely a module notifying us just as we started. The module never saw the
+	// transfer, so it hasn't missed an exchange and stays synced, whatever it needs is asked for again next time
+	if(result == TWI_ABANDONED)
+		return;
+
+	switch(state) {
+
+	case LINK_REQUESTING_EVENTS:
+
+		if(result == 0)
+			start_read(LINK_READING_EVENTS, SPLIT_EVENTS_SIZE(link_count));
+		else
+			module_failed(module);
+		break;
+
+	case LINK_READING_EVENTS:
+
+		if(result == 0) {
+
+			module_failed(module);
+		} else {
+
+			module->failures = 0;
+			apply_events(result);
+		}
+		break;
+
+	case LINK_REQUESTING_CHECKPOINT:
+
+		if(result == 0)
+			start_read(LINK_READING_CHECKPOINT, SPLIT_CHECKPOINT_SIZE(module->num_keys));
+		else
+			module_failed(module);
+		break;
+
+	case LINK_READING_CHECKPOINT:
+
+		if(result == 0) {
+
+			module_failed(module);
+		} else {
+
+			module->failures = 0;
+			apply_checkpoint(result);
+		}
+		break;
+
+	// Nothing at the address is the usual outcome, not an error
+	case LINK_SELECTING:
+
+		if(result == 0)
+			start_request(LINK_REQUESTING_DESCRIPTOR, SPLIT_REQUEST_DESCRIPTOR, 0, 0);
+		break;
+
+	case LINK_REQUESTING_DESCRIPTOR:
+
+		if(result == 0)
+			start_read(LINK_READING_DESCRIPTOR, SPLIT_DESCRIPTOR_SIZE);
+		else
+			count_error();
+		break;
+
+	case LINK_READING_DESCRIPTOR:
+
+		if(result != SPLIT_DESCRIPTOR_SIZE)
+			count_error();
+		else if(apply_descriptor(module, link_packet))
+			check_speed(link_module);
+		break;
+
+	case LINK_WRITING_PROBE:
+
+		if(result == 0)
+			start_read(LINK_READING_PROBE, 1 + SPLIT_PROBE_SIZE);
+		else
+			module_failed(module);
+		break;
+
+	// Wrong is the link's fault rather than the module's, it is slowed straight away
+	case LINK_READING_PROBE:
+
+		if(result == 0) {
+
+			module_failed(module);
+		} else if(!probe_echoed(link_command, link_packet)) {
+
+			count_error();
+			step_down_speed();
+		} else {
+
+			module->failures = 0;
+			module->probe_rounds--;
+		}
+		break;
+	}
+}
+
+static bool any_key_down(const struct module * module) {
+
+	for(uint8_t i = 0; i < SPLIT_MATRIX_SIZE; ++i)
+		if(module->matrix[i])
+			return true;
+
+	return false;
+}
+
+// Events waiting, being probed, out of sync or owed new leds or layers
+static bool needs_service(const struct module * module, uint8_t leds, uint8_t layers) {
+
+	return module->probe_rounds || !module->synced || module->slave_sequence != module->expected_sequence ||
+		module->leds != leds || module->layers != layers;
+}
+
+// The module to talk to next, SPLIT_MAX_MODULES for none. Ones that need service come first, each in turn after the
+// last one served so a busy module can't hold up the rest. Then the first one due a check in
+static uint8_t next_module(uint8_t leds, uint8_t layers) {
+
+	uint8_t due = SPLIT_MAX_MODULES;
+
+	for(uint8_t i = 1; i <= SPLIT_MAX_MODULES; ++i) {
+
+		uint8_t number = (link_module + i) % SPLIT_MAX_MODULES;
+		struct module * module = &modules[number];
+
+		if(!module->present)
+			continue;
+
+		if(needs_service(module, leds, layers))
+			return number;
+
+		uint16_t interval = any_key_down(module) ? SPLIT_POLL_INTERVAL : SPLIT_IDLE_POLL_INTERVAL;
+		if(due == SPLIT_MAX_MODULES && timer_elapsed(module->last_poll_time) >= interval)
+			due = number;
+	}
+
+	return due;
+}
+
+// Brings the modules' keys up to date and the modules up to date with the host's leds and our layers, see
+// split_master_keys. Never waits for the bus: each call finishes the transfer started by the last one and starts the
+// next, so the scan carries on while it is in flight. A module's keys are let go as soon as it misses an exchange
+void split_master_task(uint8_t leds, uint8_t layers) {
+
+	uint8_t result = twi_result();
+
+	if(link_state != LINK_IDLE && result != TWI_PENDING)
+		finish_transfer(result);
+
+	cli();
+	uint8_t notified = notified_modules;
+	notified_modules = 0;
+
+	for(uint8_t number = 0; number < SPLIT_MAX_MODULES; ++number)
+		if(notified & (1 << number))
+			heard_sequence(&modules[number], notify_sequences[number]);
+	sei();
+
+	for(uint8_t number = 0; number < SPLIT_MAX_MODULES; ++number) {
+
+		struct module * module = &modules[number];
+
+		if(module->synced && (timer_elapsed(module->last_checkpoint_time) >= SPLIT_CHECKPOINT_INTERVAL ||
+			(uint8_t)(module->slave_sequence - module->expected_sequence) > SPLIT_EVENT_QUEUE_SIZE))
+			module->synced = false;
+	}
+
+	if(link_state != LINK_IDLE)
+		return;
+
+	// Costs an address byte nobody answers for each missing module, unless something has been plugged in
+	if(timer_elapsed(last_reprobe_time) >= SPLIT_REPROBE_INTERVAL) {
+
+		last_reprobe_time = timer_read();
+		for(uint8_t number = 0; number < SPLIT_MAX_MODULES; ++number)
+			if(!modules[number].present)
+				reprobe_modules |= 1 << number;
+	}
+
+	uint8_t number = next_module(leds, layers);
+
+	// One address a call, after modules with something to do and ahead of check ins
+	for(uint8_t missing = 0; reprobe_modules && (number == SPLIT_MAX_MODULES ||
+		!needs_service(&modules[number], leds, layers)); ++missing) {
+
+		if(!(reprobe_modules & (1 << missing)))
+			continue;
+
+		reprobe_modules &= ~(1 << missing);
+		if(modules[missing].present)
+			continue;
+
+		link_module = missing;
+		start_select();
+		if(link_state != LINK_IDLE)
+			return;
+	}
+
+	if(number == SPLIT_MAX_MODULES)
+		return;
+
+	struct module * module = &modules[number];
+	link_module = number;
+
+	if(module->probe_rounds) {
+
+		start_probe();
+		return;
+	}
+
+	if(!module->synced) {
+
+		start_request(LINK_REQUESTING_CHECKPOINT, SPLIT_REQUEST_CHECKPOINT, leds, layers);
+	} else {
+
+		link_count = module->slave_sequence - module->expected_sequence;
+		start_request(LINK_REQUESTING_EVENTS, SPLIT_REQUEST_EVENTS, leds, layers);
+	}
+
+	if(link_state != LINK_IDLE) {
+
+		module->leds = leds;
+		module->layers = layers;
+		module->last_poll_time = timer_read();
+	}
+}
+
+// Fills status with the keys of every module on side, keys no module stands for stay released. Returns how many are
+// down
+uint8_t split_master_keys(uint8_t side, uint8_t * status) {
+
+	uint8_t num_keys_down = 0;
+
+	for(uint8_t key = 0; key < SPLIT_NUM_KEYS; ++key)
+		status[key] = 0;
+
+	for(uint8_t number = 0; number < SPLIT_MAX_MODULES; ++number) {
+
+		const struct module * module = &modules[number];
+
+		if(!module->present || module->side != side)
+			continue;
+
+		for(uint8_t key = 0; key < module->num_keys; ++key) {
+
+			if(is_pressed(module->matrix, key)) {
+
+				status[module->first_key + key] = 1;
+				num_keys_down++;
+			}
+		}
+	}
+
+	return num_keys_down;
+}
+
+// True while an exchange is under way or a module has news, either has to be seen to before the master sleeps
+bool split_master_busy(void) {
+
+	return notified_modules || link_state != LINK_IDLE;
+}
@@ -0,0 +1,65 @@
+
+#if !defined(SPLIT_H)
+#define SPLIT_H
+
+#include <inttypes.h>
+#include <stdbool.h>
+
+#include "keymap.h"
+
+// The link between the two halves and any other modules, see split.c. The half on usb is the master and reads the
+// keys of every module on the bus over twi, the other half is just the first of them. Key status arrays hold one
+// byte per key, nonzero while it is down, the physical keys then the function keys
+#define SPLIT_SLAVE_ADDRESS 1
+#define SPLIT_MASTER_ADDRESS 8
+#define SPLIT_NUM_KEYS (NUM_PHYSICAL_KEYS + 3)
+
+// Module n answers at SPLIT_SLAVE_ADDRESS + n, the other half is module 0. An extra module, a thumb cluster say, is
+// built with its own number and the keys of its side it stands for, usually ones missing from that side's matrix,
+// e.g. -DSPLIT_MODULE=1 -DSPLIT_MODULE_FIRST_KEY=30 -DSPLIT_MODULE_NUM_KEYS=5
+#define SPLIT_MAX_MODULES 4
+#if !defined(SPLIT_MODULE)
+#define SPLIT_MODULE 0
+#define SPLIT_MODULE_FIRST_KEY 0
+#define SPLIT_MODULE_NUM_KEYS SPLIT_NUM_KEYS
+#endif
+
+// Press and release events each module keeps for the master, more than this behind and the master reads its whole
+// matrix instead
+#define SPLIT_EVENT_QUEUE_SIZE 16
+
+// The master reads a module's whole matrix this often in ms anyway, in case it has missed something
+#define SPLIT_CHECKPOINT_INTERVAL 1000
+
+// Modules tell the master when they have new events, otherwise the master only checks in this often in ms, or this
+// often with no keys down on the module
+#define SPLIT_POLL_INTERVAL 20
+#define SPLIT_IDLE_POLL_INTERVAL 100
+
+// A module's keys are let go as soon as it misses an exchange, one that misses this many in a row is taken as
+// unplugged. The master tries every address with no module on it this often in ms, so a half plugged back in is
+// found within that and synced a few exchanges later
+#define SPLIT_MAX_FAILURES 3
+#define SPLIT_REPROBE_INTERVAL 5
+
+// This many garbled answers within this many ms and the link is slowed a step, the wiring can't keep up with it
+#define SPLIT_MAX_GARBLED 8
+#define SPLIT_GARBLED_INTERVAL 1000
+
+void split_init(uint8_t side);
+
+// Slave
+bool split_slave_selected(void);
+uint8_t split_slave_leds(void);
+uint8_t split_slave_layers(void);
+void split_slave_update(const uint8_t * status);
+
+// Master
+void split_master_connect(void);
+void split_master_task(uint8_t leds, uint8_t layers);
+uint8_t split_master_keys(uint8_t side, uint8_t * status);
+bool split_master_busy(void);
+uint16_t split_link_speed(void);
+uint16_t split_link_errors(void);
+
+#endif
@@ -0,0 +1,166 @@
+
+#include <inttypes.h>
+#include <stdbool.h>
+
+#include <avr/pgmspace.h>
+
+#include "keymap.h"
+#include "tap_hold.h"
+#include "timer.h"
+
+// A tap-hold key sends its tap when it is pressed and released within its tapping term and acts as its hold entry
+// otherwise. Waiting for the term on every tap would make it lag behind the other keys, so it is decided as soon as
+// the keys that follow make it clear:
+//
+// - released: a tap, straight away
+// - TAP_HOLD_HOLD_ON_OTHER_PRESS: held as soon as another key goes down
+// - TAP_HOLD_PERMISSIVE: held as soon as another key goes down and up while it is held, so fast rolls stay taps
+// - the term runs out: held
+// - TAP_HOLD_RETRO: held past the term and released without using it, still a tap
+//
+// Only one key is undecided at a time. The keys that come after it wait in the buffer and are replayed in order
+// once it is decided. Keys that aren't tap-hold keys go straight through when nothing is undecided. The keymap keeps
+// the report in the order keys went down and holds back a release until the press has been sent, so a tap and the
+// keys rolled after it reach the host in the right order
+
+struct key_event {
+	uint8_t side;
+	uint8_t key;
+	bool pressed;
+};
+
+static bool pending = false;
+static uint8_t pending_side;
+static uint8_t pending_key;
+static uint8_t pending_index;
+static uint16_t pending_time;
+
+static struct key_event buffer[TAP_HOLD_BUFFER_SIZE];
+static uint8_t buffer_count = 0;
+
+// A key held past its term with TAP_HOLD_RETRO, until something else is pressed
+static bool retro_armed = false;
+static uint8_t retro_side;
+static uint8_t retro_key;
+static uint16_t retro_tap;
+
+static bool is_tap_hold_entry(uint16_t entry) {
+
+	return entry >= TAP_HOLD(0) && entry < TAP_HOLD(NUM_TAP_HOLDS);
+}
+
+static uint8_t tap_hold_options(void) {
+
+	return pgm_read_byte(&keymap_tap_holds[pending_index].options);
+}
+
+// Whether the key went down after the undecided key, i.e. its press is in the buffer
+static bool pressed_while_pending(uint8_t side, uint8_t key) {
+
+	for(uint8_t i = 0; i < buffer_count; ++i)
+		if(buffer[i].pressed && buffer[i].side == side && buffer[i].key == key)
+			return true;
+
+	return false;
+}
+
+static void replay(void) {
+
+	struct key_event events[TAP_HOLD_BUFFER_SIZE];
+	uint8_t num_events = buffer_count;
+	for(uint8_t i = 0; i < num_events; ++i)
+		events[i] = buffer[i];
+
+	buffer_count = 0;
+
+	// These can start another tap-hold key, in which case the rest are buffered again
+	for(uint8_t i = 0; i < num_events; ++i)
+		tap_hold_key_event(events[i].side, events[i].key, events[i].pressed);
+}
+
+static void resolve(bool hold, bool timed_out) {
+
+	const struct keymap_tap_hold * tap_hold = &keymap_tap_holds[pending_index];
+	uint16_t tap = pgm_read_word(&tap_hold->tap);
+	uint8_t options = pgm_read_byte(&tap_hold->options);
+
+	pending = false;
+
+	keymap_press(pending_side, pending_key, hold ? pgm_read_word(&tap_hold->hold) : tap);
+
+	if(hold && timed_out && (options & TAP_HOLD_RETRO)) {
+
+		retro_armed = true;
+		retro_side = pending_side;
+		retro_key = pending_key;
+		retro_tap = tap;
+	}
+
+	replay();
+}
+
+void tap_hold_init(void) {
+
+	pending = false;
+	buffer_count = 0;
+	retro_armed = false;
+}
+
+void tap_hold_key_event(uint8_t side, uint8_t key, bool pressed) {
+
+	if(pressed)
+		retro_armed = false;
+
+	while(pending && buffer_count == TAP_HOLD_BUFFER_SIZE)
+		resolve(true, false);
+
+	if(pending) {
+
+		bool pressed_before = !pressed && pressed_while_pending(side, key);
+
+		buffer[buffer_count++] = (struct key_event){side, key, pressed};
+
+		if(!pressed && side == pending_side && key == pending_key)
+			resolve(false, false);
+		else if(pressed && (tap_hold_options() & TAP_HOLD_HOLD_ON_OTHER_PRESS))
+			resolve(true, false);
+		else if(pressed_before && (tap_hold_options() & TAP_HOLD_PERMISSIVE))
+			resolve(true, false);
+
+		return;
+	}
+
+	if(!pressed) {
+
+		// Nothing was pressed while it was held, so it was a tap after all
+		if(retro_armed && side == retro_side && key == retro_key) {
+
+			retro_armed = false;
+			keymap_release(side, key);
+			keymap_press(side, key, retro_tap);
+		}
+
+		keymap_release(side, key);
+		return;
+	}
+
+	uint16_t entry = keymap_lookup(side, key);
+
+	if(!is_tap_hold_entry(entry)) {
+
+		keymap_press(side, key, entry);
+		return;
+	}
+
+	pending = true;
+	pending_side = side;
+	pending_key = key;
+	pending_index = entry - TAP_HOLD(0);
+	pending_time = timer_read();
+}
+
+void tap_hold_task(void) {
+
+	if(pending && timer_elapsed(pending_time) >= pgm_read_word(&keymap_tap_holds[pending_index].term))
+		resolve(true, true);
+}
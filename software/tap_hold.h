@@ -0,0 +1,15 @@
+
+#if !defined(TAP_HOLD_H)
+#define TAP_HOLD_H
+
+#include <inttypes.h>
+#include <stdbool.h>
+
+// Events that come in while a tap-hold key is undecided wait here, past this it is taken as held
+#define TAP_HOLD_BUFFER_SIZE 8
+
+void tap_hold_init(void);
+void tap_hold_key_event(uint8_t side, uint8_t key, bool pressed);
+void tap_hold_task(void);
+
+#endif
@@ -0,0 +1,45 @@
+
+#include <inttypes.h>
+
+#include <avr/io.h>
+#include <avr/interrupt.h>
+#include <util/atomic.h>
+
+#include "timer.h"
+
+// 1ms at 16MHz with a prescaler of 64
+#define TIMER_PRESCALE 64
+#define TIMER_COMPARE (F_CPU / TIMER_PRESCALE / 1000 - 1)
+
+static volatile uint16_t timer_count = 0;
+
+ISR(TIMER0_COMPA_vect) {
+
+	timer_count++;
+}
+
+void timer_init(void) {
+
+	// Clear on compare match with OCR0A
+	TCCR0A = 1 << WGM01;
+	TCCR0B = (1 << CS01) | (1 << CS00);
+	OCR0A = TIMER_COMPARE;
+	TIMSK0 = 1 << OCIE0A;
+}
+
+uint16_t timer_read(void) {
+
+	uint16_t count;
+
+	ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+
+		count = timer_count;
+	}
+
+	return count;
+}
+
+uint16_t timer_elapsed(uint16_t since) {
+
+	return timer_read() - since;
+}
@@ -0,0 +1,13 @@
+
+#if !defined(TIMER_H)
+#define TIMER_H
+
+#include <inttypes.h>
+
+// A millisecond count from timer 0. It wraps every 65 seconds, so only ever compare the difference between two
+// readings, e.g. timer_elapsed
+void timer_init(void);
+uint16_t timer_read(void);
+uint16_t timer_elapsed(uint16_t since);
+
+#endif
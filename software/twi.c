@@ -47,10 +47,14 @@ static void (*twi_onSlaveTransmit)(void);
 static void (*twi_onSlaveReceive)(uint8_t*, int);
 
 static uint8_t twi_masterBuffer[TWI_BUFFER_LENGTH];
+static uint8_t* twi_masterData;			// where a master read lands or a master write comes from
 static volatile uint8_t twi_masterBufferIndex;
 static volatile uint8_t twi_masterBufferLength;
+static uint8_t twi_masterLength;		// length asked for by the last master operation
+static uint8_t twi_masterOp = TWI_READY;	// TWI_MRX or TWI_MTX, for twi_result
 
 static uint8_t twi_txBuffer[TWI_BUFFER_LENGTH];
+static const uint8_t* twi_txData;		// what a slave transmit sends, twi_txBuffer or the caller's own
 static volatile uint8_t twi_txBufferIndex;
 static volatile uint8_t twi_txBufferLength;
 
@@ -103,34 +107,75 @@ void twi_setAddress(uint8_t address)
 }
 
 /* 
- * Function twi_readFrom
- * Desc     attempts to become twi bus master and read a
- *          series of bytes from a device on the bus
+ * Function twi_setFrequency
+ * Desc     sets twi bitrate, only change it while the bus is idle
+ * Input    frequency: scl frequency in Hz, at most F_CPU / 16
+ * Output   none
+ */
+void twi_setFrequency(uint32_t frequency)
+{
+  TWBR = ((F_CPU / frequency) - 16) / 2;
+}
+
+/* 
+ * Function twi_start
+ * Desc     sends the start condition, or the address if a repeated start
+ *          has already been sent, for the master operation set up by the
+ *          caller
  * Input    address: 7bit i2c device address
- *          data: pointer to byte array
- *          length: number of bytes to read into array
- *          sendStop: Boolean indicating whether to send a stop at the end
- * Output   number of bytes read
+ *          rw: TW_READ or TW_WRITE
+ * Output   none
  */
-uint8_t twi_readFrom(uint8_t address, uint8_t* data, uint8_t length, uint8_t sendStop)
+static void twi_start(uint8_t address, uint8_t rw)
 {
-  uint8_t i;
+  // build sla+rw, slave device address + rw bit
+  twi_slarw = rw;
+  twi_slarw |= address << 1;
 
-  // ensure data will fit into buffer
-  if(TWI_BUFFER_LENGTH < length){
-    return 0;
+  if (true == twi_inRepStart) {
+    // if we're in the repeated start state, then we've already sent the start,
+    // (@@@ we hope), and the TWI statemachine is just waiting for the address byte.
+    // We need to remove ourselves from the repeated start state before we enable interrupts,
+    // since the ISR is ASYNC, and we could get confused if we hit the ISR before cleaning
+    // up. Also, don't enable the START interrupt. There may be one pending from the 
+    // repeated start that we sent outselves, and that would really confuse things.
+    twi_inRepStart = false;			// remember, we're dealing with an ASYNC ISR
+    TWDR = twi_slarw;
+    TWCR = _BV(TWINT) | _BV(TWEA) | _BV(TWEN) | _BV(TWIE);	// enable INTs, but not START
   }
+  else
+    // send start condition
+    TWCR = _BV(TWEN) | _BV(TWIE) | _BV(TWEA) | _BV(TWINT) | _BV(TWSTA);
+}
 
-  // wait until twi is ready, become master receiver
-  while(TWI_READY != twi_state){
-    continue;
+/* 
+ * Function twi_readFromAsync
+ * Desc     starts reading a series of bytes from a device on the bus as
+ *          bus master and returns straight away, see twi_result
+ * Input    address: 7bit i2c device address
+ *          data: pointer to byte array, the bytes land here as they come
+ *                in, so it has to stay valid until the read is over
+ *          length: number of bytes to read into array, at least 1
+ *          sendStop: Boolean indicating whether to send a stop at the end
+ * Output   0 .. started
+ *          1 .. twi busy, or nothing to read
+ */
+uint8_t twi_readFromAsync(uint8_t address, uint8_t* data, uint8_t length, uint8_t sendStop)
+{
+  if(0 == length || TWI_READY != twi_state){
+    return 1;
   }
+
+  // become master receiver
   twi_state = TWI_MRX;
+  twi_masterOp = TWI_MRX;
   twi_sendStop = sendStop;
   // reset error state (0xFF.. no error occured)
   twi_error = 0xFF;
 
   // initialize buffer iteration vars
+  twi_masterData = data;
+  twi_masterLength = length;
   twi_masterBufferIndex = 0;
   twi_masterBufferLength = length-1;  // This is not intuitive, read on...
   // On receive, the previously configured ACK/NACK setting is transmitted in
@@ -139,39 +184,107 @@ uint8_t twi_readFrom(uint8_t address, uint8_t* data, uint8_t length, uint8_t sen
   // received, causing that NACK to be sent in response to receiving the last
   // expected byte of data.
 
-  // build sla+w, slave device address + w bit
-  twi_slarw = TW_READ;
-  twi_slarw |= address << 1;
+  twi_start(address, TW_READ);
+  return 0;
+}
 
-  if (true == twi_inRepStart) {
-    // if we're in the repeated start state, then we've already sent the start,
-    // (@@@ we hope), and the TWI statemachine is just waiting for the address byte.
-    // We need to remove ourselves from the repeated start state before we enable interrupts,
-    // since the ISR is ASYNC, and we could get confused if we hit the ISR before cleaning
-    // up. Also, don't enable the START interrupt. There may be one pending from the 
-    // repeated start that we sent outselves, and that would really confuse things.
-    twi_inRepStart = false;			// remember, we're dealing with an ASYNC ISR
-    TWDR = twi_slarw;
-    TWCR = _BV(TWINT) | _BV(TWEA) | _BV(TWEN) | _BV(TWIE);	// enable INTs, but not START
+/* 
+ * Function twi_writeToAsync
+ * Desc     starts writing a series of bytes to a device on the bus as bus
+ *          master and returns straight away, see twi_result
+ * Input    address: 7bit i2c device address
+ *          data: pointer to byte array, sent straight from here, so it has
+ *                to stay valid until the write is over
+ *          length: number of bytes in array
+ *          sendStop: boolean indicating whether or not to send a stop at the end
+ * Output   0 .. started
+ *          1 .. twi busy
+ */
+uint8_t twi_writeToAsync(uint8_t address, const uint8_t* data, uint8_t length, uint8_t sendStop)
+{
+  if(TWI_READY != twi_state){
+    return 1;
   }
+
+  // become master transmitter
+  twi_state = TWI_MTX;
+  twi_masterOp = TWI_MTX;
+  twi_sendStop = sendStop;
+  // reset error state (0xFF.. no error occured)
+  twi_error = 0xFF;
+
+  // initialize buffer iteration vars, the isr only reads a write's data
+  twi_masterData = (uint8_t*)data;
+  twi_masterLength = length;
+  twi_masterBufferIndex = 0;
+  twi_masterBufferLength = length;
+
+  twi_start(address, TW_WRITE);
+  return 0;
+}
+
+/* 
+ * Function twi_result
+ * Desc     how the last master operation went
+ * Input    none
+ * Output   TWI_PENDING .. still going
+ *          TWI_ABANDONED .. another master took the bus first, or
+ *                           addressed us before we got it, the
+ *                           device never saw the operation
+ *          after a read, the number of bytes read
+ *          after a write, as twi_writeTo
+ */
+uint8_t twi_result(void)
+{
+  if(TWI_READY != twi_masterOp && twi_masterOp == twi_state){
+    return TWI_PENDING;
+  }
+
+  if(TW_MT_ARB_LOST == twi_error){
+    return TWI_ABANDONED;
+  }
+
+  if(TWI_MRX == twi_masterOp){
+    return twi_masterBufferIndex < twi_masterLength ? twi_masterBufferIndex : twi_masterLength;
+  }
+
+  if (twi_error == 0xFF)
+    return 0;	// success
+  else if (twi_error == TW_MT_SLA_NACK)
+    return 2;	// error: address send, nack received
+  else if (twi_error == TW_MT_DATA_NACK)
+    return 3;	// error: data send, nack received
   else
-    // send start condition
-    TWCR = _BV(TWEN) | _BV(TWIE) | _BV(TWEA) | _BV(TWINT) | _BV(TWSTA);
+    return 4;	// other twi error
+}
+
+/* 
+ * Function twi_readFrom
+ * Desc     attempts to become twi bus master and read a
+ *          series of bytes from a device on the bus
+ * Input    address: 7bit i2c device address
+ *          data: pointer to byte array
+ *          length: number of bytes to read into array
+ *          sendStop: Boolean indicating whether to send a stop at the end
+ * Output   number of bytes read, or TWI_ABANDONED
+ */
+uint8_t twi_readFrom(uint8_t address, uint8_t* data, uint8_t length, uint8_t sendStop)
+{
+  if(0 == length){
+    return 0;
+  }
+
+  // wait until twi is ready, become master receiver
+  while(0 != twi_readFromAsync(address, data, length, sendStop)){
+    continue;
+  }
 
   // wait for read operation to complete
   while(TWI_MRX == twi_state){
     continue;
   }
 
-  if (twi_masterBufferIndex < length)
-    length = twi_masterBufferIndex;
-
-  // copy twi buffer to data
-  for(i = 0; i < length; ++i){
-    data[i] = twi_masterBuffer[i];
-  }
-	
-  return length;
+  return twi_result();
 }
 
 /* 
@@ -187,7 +300,8 @@ uint8_t twi_readFrom(uint8_t address, uint8_t* data, uint8_t length, uint8_t sen
  *          1 .. length to long for buffer
  *          2 .. address send, NACK received
  *          3 .. data send, NACK received
- *          4 .. other twi error (lost bus arbitration, bus error, ..)
+ *          4 .. other twi error (bus error, ..)
+ *          TWI_ABANDONED .. lost bus arbitration
  */
 uint8_t twi_writeTo(uint8_t address, const uint8_t* data, uint8_t length, uint8_t wait, uint8_t sendStop)
 {
@@ -198,59 +312,27 @@ uint8_t twi_writeTo(uint8_t address, const uint8_t* data, uint8_t length, uint8_
     return 1;
   }
 
-  // wait until twi is ready, become master transmitter
+  // wait until twi is ready, a write that wasn't waited for may still be sending the buffer
   while(TWI_READY != twi_state){
     continue;
   }
-  twi_state = TWI_MTX;
-  twi_sendStop = sendStop;
-  // reset error state (0xFF.. no error occured)
-  twi_error = 0xFF;
 
-  // initialize buffer iteration vars
-  twi_masterBufferIndex = 0;
-  twi_masterBufferLength = length;
-  
-  // copy data to twi buffer
+  // copy data to twi buffer, the caller's may be gone before the write is over
   for(i = 0; i < length; ++i){
     twi_masterBuffer[i] = data[i];
   }
-  
-  // build sla+w, slave device address + w bit
-  twi_slarw = TW_WRITE;
-  twi_slarw |= address << 1;
-  
-  // if we're in a repeated start, then we've already sent the START
-  // in the ISR. Don't do it again.
-  //
-  if (true == twi_inRepStart) {
-    // if we're in the repeated start state, then we've already sent the start,
-    // (@@@ we hope), and the TWI statemachine is just waiting for the address byte.
-    // We need to remove ourselves from the repeated start state before we enable interrupts,
-    // since the ISR is ASYNC, and we could get confused if we hit the ISR before cleaning
-    // up. Also, don't enable the START interrupt. There may be one pending from the 
-    // repeated start that we sent outselves, and that would really confuse things.
-    twi_inRepStart = false;			// remember, we're dealing with an ASYNC ISR
-    TWDR = twi_slarw;				
-    TWCR = _BV(TWINT) | _BV(TWEA) | _BV(TWEN) | _BV(TWIE);	// enable INTs, but not START
+
+  // become master transmitter
+  while(0 != twi_writeToAsync(address, twi_masterBuffer, length, sendStop)){
+    continue;
   }
-  else
-    // send start condition
-    TWCR = _BV(TWINT) | _BV(TWEA) | _BV(TWEN) | _BV(TWIE) | _BV(TWSTA);	// enable INTs
 
   // wait for write operation to complete
   while(wait && (TWI_MTX == twi_state)){
     continue;
   }
-  
-  if (twi_error == 0xFF)
-    return 0;	// success
-  else if (twi_error == TW_MT_SLA_NACK)
-    return 2;	// error: address send, nack received
-  else if (twi_error == TW_MT_DATA_NACK)
-    return 3;	// error: data send, nack received
-  else
-    return 4;	// other twi error
+
+  return wait ? twi_result() : 0;
 }
 
 /* 
@@ -278,6 +360,7 @@ uint8_t twi_transmit(const uint8_t* data, uint8_t length)
   }
   
   // set length and copy data into tx buffer
+  twi_txData = twi_txBuffer;
   twi_txBufferLength = length;
   for(i = 0; i < length; ++i){
     twi_txBuffer[i] = data[i];
@@ -286,6 +369,30 @@ uint8_t twi_transmit(const uint8_t* data, uint8_t length)
   return 0;
 }
 
+/* 
+ * Function twi_transmitFrom
+ * Desc     has the slave tx send straight from the caller's buffer
+ *          instead of copying it, must be called in slave tx event
+ *          callback
+ * Input    data: pointer to byte array, it is read as the bytes go out
+ *                so it has to stay as it is until the master is done
+ *          length: number of bytes in array
+ * Output   2 not slave transmitter
+ *          0 ok
+ */
+uint8_t twi_transmitFrom(const uint8_t* data, uint8_t length)
+{
+  // ensure we are currently a slave transmitter
+  if(TWI_STX != twi_state){
+    return 2;
+  }
+
+  twi_txData = data;
+  twi_txBufferLength = length;
+
+  return 0;
+}
+
 /* 
  * Function twi_attachSlaveRxEvent
  * Desc     sets function called before a slave read operation
@@ -360,6 +467,20 @@ void twi_releaseBus(void)
   twi_state = TWI_READY;
 }
 
+/* 
+ * Function twi_abandonMaster
+ * Desc     fails a master operation of ours when another master addresses
+ *          us instead, having won arbitration or started before we could
+ * Input    none
+ * Output   none
+ */
+static void twi_abandonMaster(void)
+{
+  if(TWI_READY != twi_masterOp && twi_masterOp == twi_state){
+    twi_error = TW_MT_ARB_LOST;
+  }
+}
+
 SIGNAL(TWI_vect)
 {
   switch(TW_STATUS){
@@ -377,7 +498,7 @@ SIGNAL(TWI_vect)
       // if there is data to send, send it, otherwise stop 
       if(twi_masterBufferIndex < twi_masterBufferLength){
         // copy data to output register and ack
-        TWDR = twi_masterBuffer[twi_masterBufferIndex++];
+        TWDR = twi_masterData[twi_masterBufferIndex++];
         twi_reply(1);
       }else{
 	if (twi_sendStop)
@@ -408,7 +529,7 @@ SIGNAL(TWI_vect)
     // Master Receiver
     case TW_MR_DATA_ACK: // data received, ack sent
       // put byte into buffer
-      twi_masterBuffer[twi_masterBufferIndex++] = TWDR;
+      twi_masterData[twi_masterBufferIndex++] = TWDR;
     case TW_MR_SLA_ACK:  // address sent, ack received
       // ack if more bytes are expected, otherwise nack
       if(twi_masterBufferIndex < twi_masterBufferLength){
@@ -419,7 +540,7 @@ SIGNAL(TWI_vect)
       break;
     case TW_MR_DATA_NACK: // data received, nack sent
       // put final byte into buffer
-      twi_masterBuffer[twi_masterBufferIndex++] = TWDR;
+      twi_masterData[twi_masterBufferIndex++] = TWDR;
 	if (twi_sendStop)
           twi_stop();
 	else {
@@ -441,6 +562,7 @@ SIGNAL(TWI_vect)
     case TW_SR_GCALL_ACK: // addressed generally, returned ack
     case TW_SR_ARB_LOST_SLA_ACK:   // lost arbitration, returned ack
     case TW_SR_ARB_LOST_GCALL_ACK: // lost arbitration, returned ack
+      twi_abandonMaster();
       // enter slave receiver mode
       twi_state = TWI_SRX;
       // indicate that rx buffer can be overwritten and ack
@@ -482,9 +604,11 @@ SIGNAL(TWI_vect)
     // Slave Transmitter
     case TW_ST_SLA_ACK:          // addressed, returned ack
     case TW_ST_ARB_LOST_SLA_ACK: // arbitration lost, returned ack
+      twi_abandonMaster();
       // enter slave transmitter mode
       twi_state = TWI_STX;
       // ready the tx buffer index for iteration
+      twi_txData = twi_txBuffer;
       twi_txBufferIndex = 0;
       // set tx buffer length to be zero, to verify if user changes it
       twi_txBufferLength = 0;
@@ -493,13 +617,14 @@ SIGNAL(TWI_vect)
       twi_onSlaveTransmit();
       // if they didn't change buffer & length, initialize it
       if(0 == twi_txBufferLength){
+        twi_txData = twi_txBuffer;
         twi_txBufferLength = 1;
         twi_txBuffer[0] = 0x00;
       }
       // transmit first byte from buffer, fall
     case TW_ST_DATA_ACK: // byte sent, ack returned
       // copy data to output register
-      TWDR = twi_txBuffer[twi_txBufferIndex++];
+      TWDR = twi_txData[twi_txBufferIndex++];
       // if there is more to send, ack, otherwise nack
       if(twi_txBufferIndex < twi_txBufferLength){
         twi_reply(1);
@@ -24,8 +24,6 @@
 
   //#define ATMEGA8
 
-#define SLAVE_KEYBOARD_ADDR 2
-
   #ifndef TWI_FREQ
   #define TWI_FREQ 100000L
   #endif
@@ -39,12 +37,20 @@
   #define TWI_MTX   2
   #define TWI_SRX   3
   #define TWI_STX   4
+
+  #define TWI_PENDING 0xFF
+  #define TWI_ABANDONED 0xFE
   
   void twi_init(void);
   void twi_setAddress(uint8_t);
+  void twi_setFrequency(uint32_t);
   uint8_t twi_readFrom(uint8_t, uint8_t*, uint8_t, uint8_t);
   uint8_t twi_writeTo(uint8_t, const uint8_t*, uint8_t, uint8_t, uint8_t);
+  uint8_t twi_readFromAsync(uint8_t, uint8_t*, uint8_t, uint8_t);
+  uint8_t twi_writeToAsync(uint8_t, const uint8_t*, uint8_t, uint8_t);
+  uint8_t twi_result(void);
   uint8_t twi_transmit(const uint8_t*, uint8_t);
+  uint8_t twi_transmitFrom(const uint8_t*, uint8_t);
   void twi_attachSlaveRxEvent( void (*)(uint8_t*, int) );
   void twi_attachSlaveTxEvent( void (*)(void) );
   void twi_reply(uint8_t);
@@ -0,0 +1,144 @@
+
+// HID report descriptors shared by the Teensy firmware (usb_keyboard.c)
+// and the V-USB port (digisparkver). Each descriptor is a list of items
+// so that both the bytes and the length come from the same place. This
+// header only contains defines, since V-USB pulls it into assembly via
+// usbconfig.h.
+
+#if !defined(USB_HID_DESC_H)
+#define USB_HID_DESC_H
+
+// Expand an item list into initialiser bytes
+#define HID_ITEM_BYTES(tag, data) tag, data,
+#define HID_ITEM16_BYTES(tag, data) tag, (data) & 0xFF, (data) >> 8,
+#define HID_END_BYTES(tag) tag,
+
+// Expand an item list into its length, usable in #if as well as C
+#define HID_ITEM_SIZE(tag, data) + 2
+#define HID_ITEM16_SIZE(tag, data) + 3
+#define HID_END_SIZE(tag) + 1
+
+// Keyboard Protocol 1, HID 1.11 spec, Appendix B, page 59-60
+#define HID_KEYBOARD_REPORT_ITEMS(ITEM, END) \
+	ITEM(0x05, 0x01)	/* Usage Page (Generic Desktop), */ \
+	ITEM(0x09, 0x06)	/* Usage (Keyboard), */ \
+	ITEM(0xA1, 0x01)	/* Collection (Application), */ \
+	ITEM(0x75, 0x01)	/*   Report Size (1), */ \
+	ITEM(0x95, 0x08)	/*   Report Count (8), */ \
+	ITEM(0x05, 0x07)	/*   Usage Page (Key Codes), */ \
+	ITEM(0x19, 0xE0)	/*   Usage Minimum (224), */ \
+	ITEM(0x29, 0xE7)	/*   Usage Maximum (231), */ \
+	ITEM(0x15, 0x00)	/*   Logical Minimum (0), */ \
+	ITEM(0x25, 0x01)	/*   Logical Maximum (1), */ \
+	ITEM(0x81, 0x02)	/*   Input (Data, Variable, Absolute), ;Modifier byte */ \
+	ITEM(0x95, 0x01)	/*   Report Count (1), */ \
+	ITEM(0x75, 0x08)	/*   Report Size (8), */ \
+	ITEM(0x81, 0x03)	/*   Input (Constant),                 ;Reserved byte */ \
+	ITEM(0x95, 0x05)	/*   Report Count (5), */ \
+	ITEM(0x75, 0x01)	/*   Report Size (1), */ \
+	ITEM(0x05, 0x08)	/*   Usage Page (LEDs), */ \
+	ITEM(0x19, 0x01)	/*   Usage Minimum (1), */ \
+	ITEM(0x29, 0x05)	/*   Usage Maximum (5), */ \
+	ITEM(0x91, 0x02)	/*   Output (Data, Variable, Absolute), ;LED report */ \
+	ITEM(0x95, 0x01)	/*   Report Count (1), */ \
+	ITEM(0x75, 0x03)	/*   Report Size (3), */ \
+	ITEM(0x91, 0x03)	/*   Output (Constant),                 ;LED report padding */ \
+	ITEM(0x95, 0x06)	/*   Report Count (6), */ \
+	ITEM(0x75, 0x08)	/*   Report Size (8), */ \
+	ITEM(0x15, 0x00)	/*   Logical Minimum (0), */ \
+	ITEM(0x25, 0x68)	/*   Logical Maximum(104), */ \
+	ITEM(0x05, 0x07)	/*   Usage Page (Key Codes), */ \
+	ITEM(0x19, 0x00)	/*   Usage Minimum (0), */ \
+	ITEM(0x29, 0x68)	/*   Usage Maximum (104), */ \
+	ITEM(0x81, 0x00)	/*   Input (Data, Array), */ \
+	END(0xC0)		/* End Collection */
+
+#define HID_KEYBOARD_REPORT_DESC_BYTES HID_KEYBOARD_REPORT_ITEMS(HID_ITEM_BYTES, HID_END_BYTES)
+#define HID_KEYBOARD_REPORT_DESC_SIZE (0 HID_KEYBOARD_REPORT_ITEMS(HID_ITEM_SIZE, HID_END_SIZE))
+
+// Mouse, HID 1.11 spec, Appendix B, page 61 plus a wheel. Buttons,
+// then X, Y and wheel as signed deltas, padded out to the 8 byte
+// endpoint
+#define HID_MOUSE_REPORT_ITEMS(ITEM, END) \
+	ITEM(0x05, 0x01)	/* Usage Page (Generic Desktop), */ \
+	ITEM(0x09, 0x02)	/* Usage (Mouse), */ \
+	ITEM(0xA1, 0x01)	/* Collection (Application), */ \
+	ITEM(0x09, 0x01)	/*   Usage (Pointer), */ \
+	ITEM(0xA1, 0x00)	/*   Collection (Physical), */ \
+	ITEM(0x05, 0x09)	/*     Usage Page (Buttons), */ \
+	ITEM(0x19, 0x01)	/*     Usage Minimum (1), */ \
+	ITEM(0x29, 0x05)	/*     Usage Maximum (5), */ \
+	ITEM(0x15, 0x00)	/*     Logical Minimum (0), */ \
+	ITEM(0x25, 0x01)	/*     Logical Maximum (1), */ \
+	ITEM(0x95, 0x05)	/*     Report Count (5), */ \
+	ITEM(0x75, 0x01)	/*     Report Size (1), */ \
+	ITEM(0x81, 0x02)	/*     Input (Data, Variable, Absolute), ;Buttons */ \
+	ITEM(0x95, 0x01)	/*     Report Count (1), */ \
+	ITEM(0x75, 0x03)	/*     Report Size (3), */ \
+	ITEM(0x81, 0x03)	/*     Input (Constant),                 ;Button padding */ \
+	ITEM(0x05, 0x01)	/*     Usage Page (Generic Desktop), */ \
+	ITEM(0x09, 0x30)	/*     Usage (X), */ \
+	ITEM(0x09, 0x31)	/*     Usage (Y), */ \
+	ITEM(0x09, 0x38)	/*     Usage (Wheel), */ \
+	ITEM(0x15, 0x81)	/*     Logical Minimum (-127), */ \
+	ITEM(0x25, 0x7F)	/*     Logical Maximum (127), */ \
+	ITEM(0x95, 0x03)	/*     Report Count (3), */ \
+	ITEM(0x75, 0x08)	/*     Report Size (8), */ \
+	ITEM(0x81, 0x06)	/*     Input (Data, Variable, Relative), ;X, Y, wheel */ \
+	ITEM(0x95, 0x04)	/*     Report Count (4), */ \
+	ITEM(0x81, 0x03)	/*     Input (Constant),                 ;Padding */ \
+	END(0xC0)		/*   End Collection */ \
+	END(0xC0)		/* End Collection */
+
+#define HID_MOUSE_REPORT_DESC_BYTES HID_MOUSE_REPORT_ITEMS(HID_ITEM_BYTES, HID_END_BYTES)
+#define HID_MOUSE_REPORT_DESC_SIZE (0 HID_MOUSE_REPORT_ITEMS(HID_ITEM_SIZE, HID_END_SIZE))
+
+// Consumer control, one bit for each media key in the order of the
+// MEDIA_* keymap entries, padded out to the 8 byte endpoint
+#define HID_CONSUMER_REPORT_ITEMS(ITEM, END) \
+	ITEM(0x05, 0x0C)	/* Usage Page (Consumer), */ \
+	ITEM(0x09, 0x01)	/* Usage (Consumer Control), */ \
+	ITEM(0xA1, 0x01)	/* Collection (Application), */ \
+	ITEM(0x15, 0x00)	/*   Logical Minimum (0), */ \
+	ITEM(0x25, 0x01)	/*   Logical Maximum (1), */ \
+	ITEM(0x75, 0x01)	/*   Report Size (1), */ \
+	ITEM(0x95, 0x07)	/*   Report Count (7), */ \
+	ITEM(0x09, 0xE2)	/*   Usage (Mute), */ \
+	ITEM(0x09, 0xE9)	/*   Usage (Volume Increment), */ \
+	ITEM(0x09, 0xEA)	/*   Usage (Volume Decrement), */ \
+	ITEM(0x09, 0xCD)	/*   Usage (Play/Pause), */ \
+	ITEM(0x09, 0xB5)	/*   Usage (Scan Next Track), */ \
+	ITEM(0x09, 0xB6)	/*   Usage (Scan Previous Track), */ \
+	ITEM(0x09, 0xB7)	/*   Usage (Stop), */ \
+	ITEM(0x81, 0x02)	/*   Input (Data, Variable, Absolute), ;Media keys */ \
+	ITEM(0x95, 0x01)	/*   Report Count (1), */ \
+	ITEM(0x81, 0x03)	/*   Input (Constant),                 ;Key padding */ \
+	ITEM(0x75, 0x08)	/*   Report Size (8), */ \
+	ITEM(0x95, 0x07)	/*   Report Count (7), */ \
+	ITEM(0x81, 0x03)	/*   Input (Constant),                 ;Padding */ \
+	END(0xC0)		/* End Collection */
+
+#define HID_CONSUMER_REPORT_DESC_BYTES HID_CONSUMER_REPORT_ITEMS(HID_ITEM_BYTES, HID_END_BYTES)
+#define HID_CONSUMER_REPORT_DESC_SIZE (0 HID_CONSUMER_REPORT_ITEMS(HID_ITEM_SIZE, HID_END_SIZE))
+
+// Raw reports for a host tool, 8 bytes each way. The host writes with
+// SET_REPORT and reads the answer from the interrupt endpoint. The
+// vendor usage page keeps the host's own drivers away from it
+#define HID_RAW_REPORT_ITEMS(ITEM, ITEM16, END) \
+	ITEM16(0x06, 0xFF60)	/* Usage Page (Vendor Defined), */ \
+	ITEM(0x09, 0x61)	/* Usage (0x61), */ \
+	ITEM(0xA1, 0x01)	/* Collection (Application), */ \
+	ITEM(0x15, 0x00)	/*   Logical Minimum (0), */ \
+	ITEM16(0x26, 0x00FF)	/*   Logical Maximum (255), */ \
+	ITEM(0x75, 0x08)	/*   Report Size (8), */ \
+	ITEM(0x95, 0x08)	/*   Report Count (8), */ \
+	ITEM(0x09, 0x62)	/*   Usage (0x62), */ \
+	ITEM(0x81, 0x02)	/*   Input (Data, Variable, Absolute),  ;Answer */ \
+	ITEM(0x09, 0x63)	/*   Usage (0x63), */ \
+	ITEM(0x91, 0x02)	/*   Output (Data, Variable, Absolute), ;Command */ \
+	END(0xC0)		/* End Collection */
+
+#define HID_RAW_REPORT_DESC_BYTES HID_RAW_REPORT_ITEMS(HID_ITEM_BYTES, HID_ITEM16_BYTES, HID_END_BYTES)
+#define HID_RAW_REPORT_DESC_SIZE (0 HID_RAW_REPORT_ITEMS(HID_ITEM_SIZE, HID_ITEM16_SIZE, HID_END_SIZE))
+
+#endif
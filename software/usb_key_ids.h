@@ -11,6 +11,16 @@
 #define KEY_RIGHT_ALT	0x40
 #define KEY_RIGHT_GUI	0x80
 
+// Hid usages of the modifier keys, these are reported as bits in the modifier byte rather than in the key list
+#define KEY_MOD_LEFT_CTRL	0xE0
+#define KEY_MOD_LEFT_SHIFT	0xE1
+#define KEY_MOD_LEFT_ALT	0xE2
+#define KEY_MOD_LEFT_GUI	0xE3
+#define KEY_MOD_RIGHT_CTRL	0xE4
+#define KEY_MOD_RIGHT_SHIFT	0xE5
+#define KEY_MOD_RIGHT_ALT	0xE6
+#define KEY_MOD_RIGHT_GUI	0xE7
+
 #define LED_NUM_LOCK 1
 #define LED_CAPS_LOCK 2
 #define LED_SCROLL_LOCK 4
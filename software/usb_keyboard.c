@@ -25,6 +25,11 @@
 // Version 1.1: Add support for Teensy 2.0
 
 #include "usb_keyboard.h"
+#include "usb_hid_desc.h"
+#include "timer.h"
+
+#include <assert.h>
+#define static_assert _Static_assert
 
 #include <avr/io.h>
 #include <avr/pgmspace.h>
@@ -73,6 +78,16 @@
 #define USB_FREEZE() (USBCON = ((1<<USBE)|(1<<FRZCLK)))
 #endif
 
+#ifdef USB_ISR_TIMING
+#define USB_ISR_TIMING_INIT()	(DDRD |= (1<<6))
+#define USB_ISR_TIMING_BEGIN()	(PORTD |= (1<<6))
+#define USB_ISR_TIMING_END()	(PORTD &= ~(1<<6))
+#else
+#define USB_ISR_TIMING_INIT()
+#define USB_ISR_TIMING_BEGIN()
+#define USB_ISR_TIMING_END()
+#endif
+
 // standard control endpoint request types
 #define GET_STATUS			0
 #define CLEAR_FEATURE			1
@@ -83,6 +98,8 @@
 #define SET_CONFIGURATION		9
 #define GET_INTERFACE			10
 #define SET_INTERFACE			11
+// standard feature selectors
+#define DEVICE_REMOTE_WAKEUP		1
 // HID (human interface device)
 #define HID_GET_REPORT			1
 #define HID_GET_IDLE			2
@@ -122,6 +139,13 @@
 #define SUPPORT_ENDPOINT_HALT
 
 
+// Define this to drive a spare pin high for the whole of each USB
+// interrupt, so the worst case execution time can be read straight
+// off a scope or logic analyser.  PD6 is the Teensy 2.0 LED.  See
+// the comment above ISR(USB_GEN_vect) for what bounds each one.
+//#define USB_ISR_TIMING
+
+
 
 /**************************************************************************
  *
@@ -131,16 +155,53 @@
 
 #define ENDPOINT0_SIZE		32
 
-#define KEYBOARD_INTERFACE	0
 #define KEYBOARD_ENDPOINT	3
 #define KEYBOARD_SIZE		8
 #define KEYBOARD_BUFFER		EP_DOUBLE_BUFFER
+#define KEYBOARD_INTERVAL	1
+
+#define MOUSE_ENDPOINT		2
+#define MOUSE_SIZE		MOUSE_REPORT_SIZE
+#define MOUSE_BUFFER		EP_DOUBLE_BUFFER
+#define MOUSE_INTERVAL		1
+
+#define CONSUMER_ENDPOINT	1
+#define CONSUMER_SIZE		CONSUMER_REPORT_SIZE
+#define CONSUMER_BUFFER		EP_SINGLE_BUFFER
+#define CONSUMER_INTERVAL	1
+
+#define RAW_ENDPOINT		4
+#define RAW_SIZE		RAW_REPORT_SIZE
+#define RAW_BUFFER		EP_SINGLE_BUFFER
+#define RAW_INTERVAL		10
+
+// The interfaces themselves are listed in USB_INTERFACE_LIST in
+// usb_keyboard.h.  The configuration descriptor, descriptor list,
+// endpoint table and report scheduler below are all generated from
+// that list, and the checks here fail the build if it is inconsistent.
+
+#define USB_INTERFACE_CHECKS(name, subclass, protocol, report, ep, size, buffer, interval, policy, limit) \
+	static_assert((ep) >= 1 && (ep) <= MAX_ENDPOINT, #name " endpoint out of range"); \
+	static_assert((size) == 8 || (size) == 16 || (size) == 32 || (size) == 64, #name " endpoint size invalid"); \
+	static_assert((policy) == USB_REPORT_LIMITED || (limit) == 0, #name " only rate limited interfaces have a limit");
+USB_INTERFACE_LIST(USB_INTERFACE_CHECKS)
+
+// each endpoint can only be claimed once: the sum and the OR of the
+// endpoint bits only agree if no bit was added twice
+#define USB_INTERFACE_ENDPOINT_SUM(name, subclass, protocol, report, ep, size, buffer, interval, policy, limit) + (1 << (ep))
+#define USB_INTERFACE_ENDPOINT_OR(name, subclass, protocol, report, ep, size, buffer, interval, policy, limit) | (1 << (ep))
+static_assert((0 USB_INTERFACE_LIST(USB_INTERFACE_ENDPOINT_SUM)) == (0 USB_INTERFACE_LIST(USB_INTERFACE_ENDPOINT_OR)),
+	"two interfaces share an endpoint");
 
-static const uint8_t PROGMEM endpoint_config_table[] = {
-	0,
-	0,
-	1, EP_TYPE_INTERRUPT_IN,  EP_SIZE(KEYBOARD_SIZE) | KEYBOARD_BUFFER,
-	0
+// UECONX, UECFG0X and UECFG1X for endpoints 1 to MAX_ENDPOINT
+static const struct endpoint_config_struct {
+	uint8_t	ueconx;
+	uint8_t	uecfg0x;
+	uint8_t	uecfg1x;
+} PROGMEM endpoint_config_table[MAX_ENDPOINT] = {
+#define USB_INTERFACE_ENDPOINT_CONFIG(name, subclass, protocol, report, ep, size, buffer, interval, policy, limit) \
+	[(ep) - 1] = {1, EP_TYPE_INTERRUPT_IN, EP_SIZE(size) | (buffer)},
+	USB_INTERFACE_LIST(USB_INTERFACE_ENDPOINT_CONFIG)
 };
 
 
@@ -175,81 +236,81 @@ static const uint8_t PROGMEM device_descriptor[] = {
 };
 
 // Keyboard Protocol 1, HID 1.11 spec, Appendix B, page 59-60
+// The items themselves live in usb_hid_desc.h, shared with the V-USB port
 static const uint8_t PROGMEM keyboard_hid_report_desc[] = {
-        0x05, 0x01,          // Usage Page (Generic Desktop),
-        0x09, 0x06,          // Usage (Keyboard),
-        0xA1, 0x01,          // Collection (Application),
-        0x75, 0x01,          //   Report Size (1),
-        0x95, 0x08,          //   Report Count (8),
-        0x05, 0x07,          //   Usage Page (Key Codes),
-        0x19, 0xE0,          //   Usage Minimum (224),
-        0x29, 0xE7,          //   Usage Maximum (231),
-        0x15, 0x00,          //   Logical Minimum (0),
-        0x25, 0x01,          //   Logical Maximum (1),
-        0x81, 0x02,          //   Input (Data, Variable, Absolute), ;Modifier byte
-        0x95, 0x01,          //   Report Count (1),
-        0x75, 0x08,          //   Report Size (8),
-        0x81, 0x03,          //   Input (Constant),                 ;Reserved byte
-        0x95, 0x05,          //   Report Count (5),
-        0x75, 0x01,          //   Report Size (1),
-        0x05, 0x08,          //   Usage Page (LEDs),
-        0x19, 0x01,          //   Usage Minimum (1),
-        0x29, 0x05,          //   Usage Maximum (5),
-        0x91, 0x02,          //   Output (Data, Variable, Absolute), ;LED report
-        0x95, 0x01,          //   Report Count (1),
-        0x75, 0x03,          //   Report Size (3),
-        0x91, 0x03,          //   Output (Constant),                 ;LED report padding
-        0x95, 0x06,          //   Report Count (6),
-        0x75, 0x08,          //   Report Size (8),
-        0x15, 0x00,          //   Logical Minimum (0),
-        0x25, 0x68,          //   Logical Maximum(104),
-        0x05, 0x07,          //   Usage Page (Key Codes),
-        0x19, 0x00,          //   Usage Minimum (0),
-        0x29, 0x68,          //   Usage Maximum (104),
-        0x81, 0x00,          //   Input (Data, Array),
-        0xc0                 // End Collection
+	HID_KEYBOARD_REPORT_DESC_BYTES
 };
+static_assert(sizeof(keyboard_hid_report_desc) == HID_KEYBOARD_REPORT_DESC_SIZE, "keyboard report descriptor length");
 
-#define CONFIG1_DESC_SIZE        (9+9+9+7)
-#define KEYBOARD_HID_DESC_OFFSET (9+9)
-static const uint8_t PROGMEM config1_descriptor[CONFIG1_DESC_SIZE] = {
+// Mouse with a wheel, not a boot device
+static const uint8_t PROGMEM mouse_hid_report_desc[] = {
+	HID_MOUSE_REPORT_DESC_BYTES
+};
+static_assert(sizeof(mouse_hid_report_desc) == HID_MOUSE_REPORT_DESC_SIZE, "mouse report descriptor length");
+
+// Media keys
+static const uint8_t PROGMEM consumer_hid_report_desc[] = {
+	HID_CONSUMER_REPORT_DESC_BYTES
+};
+static_assert(sizeof(consumer_hid_report_desc) == HID_CONSUMER_REPORT_DESC_SIZE, "consumer report descriptor length");
+
+// Commands from a host tool
+static const uint8_t PROGMEM raw_hid_report_desc[] = {
+	HID_RAW_REPORT_DESC_BYTES
+};
+static_assert(sizeof(raw_hid_report_desc) == HID_RAW_REPORT_DESC_SIZE, "raw report descriptor length");
+
+#define INTERFACE_DESC_SIZE      (9+9+7)
+#define CONFIG1_DESC_SIZE        (9+NUM_INTERFACES*INTERFACE_DESC_SIZE)
+#define HID_DESC_OFFSET(n)       (9+(n)*INTERFACE_DESC_SIZE+9)
+static_assert(CONFIG1_DESC_SIZE < 256, "descriptor_list lengths are 8 bit");
+
+#define USB_INTERFACE_DESCRIPTORS(name, subclass, protocol, report, ep, size, buffer, interval, policy, limit) \
+	/* interface descriptor, USB spec 9.6.5, page 267-269, Table 9-12 */ \
+	9,					/* bLength */ \
+	4,					/* bDescriptorType */ \
+	name##_INTERFACE,			/* bInterfaceNumber */ \
+	0,					/* bAlternateSetting */ \
+	1,					/* bNumEndpoints */ \
+	0x03,					/* bInterfaceClass (0x03 = HID) */ \
+	subclass,				/* bInterfaceSubClass (0x01 = Boot) */ \
+	protocol,				/* bInterfaceProtocol (0x01 = Keyboard) */ \
+	0,					/* iInterface */ \
+	/* HID interface descriptor, HID 1.11 spec, section 6.2.1 */ \
+	9,					/* bLength */ \
+	0x21,					/* bDescriptorType */ \
+	0x11, 0x01,				/* bcdHID */ \
+	0,					/* bCountryCode */ \
+	1,					/* bNumDescriptors */ \
+	0x22,					/* bDescriptorType */ \
+	LSB(sizeof(report)),			/* wDescriptorLength */ \
+	MSB(sizeof(report)), \
+	/* endpoint descriptor, USB spec 9.6.6, page 269-271, Table 9-13 */ \
+	7,					/* bLength */ \
+	5,					/* bDescriptorType */ \
+	(ep) | 0x80,				/* bEndpointAddress */ \
+	0x03,					/* bmAttributes (0x03=intr) */ \
+	size, 0,				/* wMaxPacketSize */ \
+	interval,				/* bInterval */
+
+static const uint8_t PROGMEM config1_descriptor[] = {
 	// configuration descriptor, USB spec 9.6.3, page 264-266, Table 9-10
 	9, 					// bLength;
 	2,					// bDescriptorType;
 	LSB(CONFIG1_DESC_SIZE),			// wTotalLength
 	MSB(CONFIG1_DESC_SIZE),
-	1,					// bNumInterfaces
+	NUM_INTERFACES,				// bNumInterfaces
 	1,					// bConfigurationValue
 	0,					// iConfiguration
-	0xC0,					// bmAttributes
+	0xE0,					// bmAttributes (remote wakeup)
 	50,					// bMaxPower
-	// interface descriptor, USB spec 9.6.5, page 267-269, Table 9-12
-	9,					// bLength
-	4,					// bDescriptorType
-	KEYBOARD_INTERFACE,			// bInterfaceNumber
-	0,					// bAlternateSetting
-	1,					// bNumEndpoints
-	0x03,					// bInterfaceClass (0x03 = HID)
-	0x01,					// bInterfaceSubClass (0x01 = Boot)
-	0x01,					// bInterfaceProtocol (0x01 = Keyboard)
-	0,					// iInterface
-	// HID interface descriptor, HID 1.11 spec, section 6.2.1
-	9,					// bLength
-	0x21,					// bDescriptorType
-	0x11, 0x01,				// bcdHID
-	0,					// bCountryCode
-	1,					// bNumDescriptors
-	0x22,					// bDescriptorType
-	sizeof(keyboard_hid_report_desc),	// wDescriptorLength
-	0,
-	// endpoint descriptor, USB spec 9.6.6, page 269-271, Table 9-13
-	7,					// bLength
-	5,					// bDescriptorType
-	KEYBOARD_ENDPOINT | 0x80,		// bEndpointAddress
-	0x03,					// bmAttributes (0x03=intr)
-	KEYBOARD_SIZE, 0,			// wMaxPacketSize
-	1					// bInterval
+	USB_INTERFACE_LIST(USB_INTERFACE_DESCRIPTORS)
 };
+static_assert(sizeof(config1_descriptor) == CONFIG1_DESC_SIZE, "configuration descriptor length");
+
+#define USB_INTERFACE_REPORT_CHECK(name, subclass, protocol, report, ep, size, buffer, interval, policy, limit) \
+	static_assert(sizeof(report) < 256, #name " report descriptor too long for descriptor_list");
+USB_INTERFACE_LIST(USB_INTERFACE_REPORT_CHECK)
 
 // If you're desperate for a little extra code memory, these strings
 // can be completely removed if iManufacturer, iProduct, iSerialNumber
@@ -285,8 +346,10 @@ static const struct descriptor_list_struct {
 } PROGMEM descriptor_list[] = {
 	{0x0100, 0x0000, device_descriptor, sizeof(device_descriptor)},
 	{0x0200, 0x0000, config1_descriptor, sizeof(config1_descriptor)},
-	{0x2200, KEYBOARD_INTERFACE, keyboard_hid_report_desc, sizeof(keyboard_hid_report_desc)},
-	{0x2100, KEYBOARD_INTERFACE, config1_descriptor+KEYBOARD_HID_DESC_OFFSET, 9},
+#define USB_INTERFACE_DESC_LIST(name, subclass, protocol, report, ep, size, buffer, interval, policy, limit) \
+	{0x2200, name##_INTERFACE, report, sizeof(report)}, \
+	{0x2100, name##_INTERFACE, config1_descriptor+HID_DESC_OFFSET(name##_INTERFACE), 9},
+	USB_INTERFACE_LIST(USB_INTERFACE_DESC_LIST)
 	{0x0300, 0x0000, (const uint8_t *)&string0, 4},
 	{0x0301, 0x0409, (const uint8_t *)&string1, sizeof(STR_MANUFACTURER)},
 	{0x0302, 0x0409, (const uint8_t *)&string2, sizeof(STR_PRODUCT)}
@@ -323,9 +386,58 @@ static uint8_t keyboard_idle_config=125;
 // count until idle timeout
 static uint8_t keyboard_idle_count=0;
 
+// the report scheduler keeps one report per interface, copied in by
+// usb_report_queue so the endpoint interrupt never reads the caller's
+// data while the main loop is changing it
+#define USB_INTERFACE_REPORT_BUFFER(name, subclass, protocol, report, ep, size, buffer, interval, policy, limit) \
+	static uint8_t name##_report[size];
+USB_INTERFACE_LIST(USB_INTERFACE_REPORT_BUFFER)
+
+// why each report is waiting for a free IN bank, if it is
+#define USB_REPORT_NONE		0
+#define USB_REPORT_IDLE		1
+#define USB_REPORT_NEW		2
+static volatile uint8_t usb_report_pending[NUM_INTERFACES];
+
+// frames left before a rate limited interface may queue again
+static volatile uint8_t usb_report_holdoff[NUM_INTERFACES];
+
+static struct usb_report_stats usb_report_stats[NUM_INTERFACES];
+
+// the last raw report from the host, kept until usb_raw_receive
+// collects it.  Another one arriving before then is dropped
+static uint8_t raw_command[RAW_REPORT_SIZE];
+static volatile uint8_t raw_command_pending=0;
+
+// endpoint 0 control transfers which need more than one interrupt
+// are stepped through one packet at a time using this state
+#define EP0_IDLE		0
+#define EP0_DESCRIPTOR_IN	1
+#define EP0_SET_ADDRESS		2
+#define EP0_SET_REPORT		3
+#define EP0_RAW_SET_REPORT	4
+static uint8_t ep0_state=EP0_IDLE;
+static const uint8_t *ep0_desc_addr;
+static uint8_t ep0_desc_len;
+
 // 1=num lock, 2=caps lock, 4=scroll lock, 8=compose, 16=kana
 volatile uint8_t keyboard_leds=0;
 
+// non-zero while the bus is suspended and the USB clock is frozen
+static volatile uint8_t usb_suspended_state=0;
+
+// set by the host with SET_FEATURE(DEVICE_REMOTE_WAKEUP)
+static volatile uint8_t usb_remote_wakeup_enabled=0;
+
+// USB 2.0 7.1.7.7 wants the bus idle for 5ms before a remote wakeup.
+// Suspend is detected after 3ms of idle, so we wait more than this
+// many ms after that.  The timer stops while we sleep, which only
+// ever makes the wait longer than it needs to be
+#define USB_REMOTE_WAKEUP_DELAY	2
+static volatile uint16_t usb_suspend_time;
+
+static inline void usb_resume_clock(void);
+
 /**************************************************************************
  *
  *  Public Functions - these are the API intended for the user
@@ -342,7 +454,10 @@ void usb_init(void)
 	USB_CONFIG();				// start USB clock
 	UDCON = 0;				// enable attach resistor
 	usb_configuration = 0;
-	UDIEN = (1<<EORSTE)|(1<<SOFE);
+	USB_ISR_TIMING_INIT();
+	usb_suspended_state = 0;
+	usb_remote_wakeup_enabled = 0;
+	UDIEN = (1<<EORSTE)|(1<<SOFE)|(1<<SUSPE);
 	sei();
 }
 
@@ -353,40 +468,144 @@ uint8_t usb_configured(void)
 	return usb_configuration;
 }
 
-// send the contents of keyboard_keys and keyboard_modifier_keys
-int8_t usb_keyboard_send(void)
+// return non-zero while the host has the bus suspended.  The USB
+// clock is frozen during this time, so the caller can drop into a
+// low power scan mode
+uint8_t usb_suspended(void)
 {
-	uint8_t i, intr_state, timeout;
+	return usb_suspended_state;
+}
 
+// restart the USB clock and signal resume to a suspended host, if it
+// has allowed us to.  Returns -1 if the bus is not suspended or the
+// host did not enable remote wakeup, or if the bus has not been idle
+// long enough yet, in which case call again later.  Reports queued
+// afterwards are sent as soon as the host starts polling again.
+int8_t usb_remote_wakeup(void)
+{
+	uint8_t intr_state;
+
+	if (!usb_suspended_state || !usb_remote_wakeup_enabled) return -1;
+	if (timer_elapsed(usb_suspend_time) <= USB_REMOTE_WAKEUP_DELAY) return -1;
+	intr_state = SREG;
+	cli();
+	usb_resume_clock();
+	UDCON |= (1<<RMWKUP);
+	SREG = intr_state;
+	return 0;
+}
+
+// hand a report to the scheduler for the given interface.  This
+// never waits for the host: the report is copied and the endpoint
+// interrupt sends it as soon as an IN bank is free.  If the previous
+// report from the same interface is still waiting, the interface's
+// policy decides what happens (see USB_INTERFACE_LIST).  Returns 0
+// if the report was queued or merged, 1 if it was refused, in which
+// case a USB_REPORT_STATE or USB_REPORT_ACCUMULATE caller should
+// retry, and -1 if the USB is not configured.
+int8_t usb_report_queue(uint8_t interface, const uint8_t *report)
+{
+	uint8_t *buffer, size, endpoint, policy, limit;
+	uint8_t i, intr_state;
+	int16_t sum;
+
+	switch (interface) {
+#define USB_INTERFACE_QUEUE_CASE(n, sc, pr, rd, e, sz, b, iv, po, li) \
+	case n##_INTERFACE: \
+		buffer = n##_report; size = sz; endpoint = e; policy = po; limit = li; \
+		break;
+	USB_INTERFACE_LIST(USB_INTERFACE_QUEUE_CASE)
+	default:
+		return -1;
+	}
 	if (!usb_configuration) return -1;
 	intr_state = SREG;
 	cli();
-	UENUM = KEYBOARD_ENDPOINT;
-	timeout = UDFNUML + 50;
-	while (1) {
-		// are we ready to transmit?
-		if (UEINTX & (1<<RWAL)) break;
+	if (usb_report_pending[interface] == USB_REPORT_NEW) {
+		if (policy == USB_REPORT_ACCUMULATE) {
+			// first byte is the buttons, the rest are deltas.
+			// Deltas that would not fit are refused whole, so
+			// the caller still has all of them to send later
+			for (i=1; i<size; i++) {
+				sum = (int8_t)buffer[i] + (int8_t)report[i];
+				if (sum > 127 || sum < -127) {
+					SREG = intr_state;
+					return 1;
+				}
+			}
+			buffer[0] = report[0];
+			for (i=1; i<size; i++) {
+				buffer[i] = (int8_t)buffer[i] + (int8_t)report[i];
+			}
+			usb_report_stats[interface].coalesced++;
+			SREG = intr_state;
+			return 0;
+		}
+		if (policy == USB_REPORT_LIMITED) usb_report_stats[interface].dropped++;
 		SREG = intr_state;
-		// has the USB gone offline?
-		if (!usb_configuration) return -1;
-		// have we waited too long?
-		if (UDFNUML == timeout) return -1;
-		// get ready to try checking again
-		intr_state = SREG;
-		cli();
-		UENUM = KEYBOARD_ENDPOINT;
+		return 1;
 	}
-	UEDATX = keyboard_modifier_keys;
-	UEDATX = 0;
-	for (i=0; i<6; i++) {
-		UEDATX = keyboard_keys[i];
+	if (usb_report_holdoff[interface]) {
+		usb_report_stats[interface].dropped++;
+		SREG = intr_state;
+		return 1;
 	}
-	UEINTX = 0x3A;
-	keyboard_idle_count = 0;
+	for (i=0; i<size; i++) {
+		buffer[i] = report[i];
+	}
+	usb_report_pending[interface] = USB_REPORT_NEW;
+	usb_report_holdoff[interface] = limit;
+	UENUM = endpoint;
+	UEIENX = (1<<TXINE);
 	SREG = intr_state;
 	return 0;
 }
 
+// copy out the last raw report written by the host.  Returns 0 if
+// there was one, -1 if nothing has arrived since the last call.  The
+// answer, if any, goes back with usb_report_queue(RAW_INTERFACE, ...)
+int8_t usb_raw_receive(uint8_t *report)
+{
+	uint8_t i;
+
+	if (!raw_command_pending) return -1;
+	for (i=0; i<RAW_REPORT_SIZE; i++) {
+		report[i] = raw_command[i];
+	}
+	raw_command_pending = 0;
+	return 0;
+}
+
+// copy out the scheduler counters for one interface
+void usb_report_get_stats(uint8_t interface, struct usb_report_stats *stats)
+{
+	uint8_t intr_state;
+
+	if (interface >= NUM_INTERFACES) return;
+	intr_state = SREG;
+	cli();
+	*stats = usb_report_stats[interface];
+	SREG = intr_state;
+}
+
+// queue the contents of keyboard_keys and keyboard_modifier_keys.
+// Returns 1 if the previous report has not gone out yet, in which
+// case nothing is queued and the caller should retry.
+int8_t usb_keyboard_send(void)
+{
+	uint8_t i, report[KEYBOARD_SIZE];
+	int8_t r;
+
+	report[0] = keyboard_modifier_keys;
+	report[1] = 0;
+	for (i=0; i<6; i++) {
+		report[i+2] = keyboard_keys[i];
+	}
+	r = usb_report_queue(KEYBOARD_INTERFACE, report);
+	if (r == 0) keyboard_idle_count = 0;
+	return r;
+}
+
 void usb_disable(void) {
 
 	UDCON = 1<<DETACH; //Detach data pins
@@ -401,41 +620,102 @@ void usb_disable(void) {
  *
  **************************************************************************/
 
+// stop the PLL and USB clock while the bus is suspended, leaving only
+// the asynchronous wakeup interrupt to bring us back
+static inline void usb_suspend_clock(void)
+{
+	UDIEN = (UDIEN & ~(1<<SUSPE)) | (1<<WAKEUPE);
+	USBCON |= (1<<FRZCLK);
+	PLLCSR &= ~(1<<PLLE);
+	usb_suspend_time = timer_read();
+	usb_suspended_state = 1;
+}
+
+// the reverse of usb_suspend_clock.  Waiting for the PLL to lock
+// takes roughly 100us, but only happens once per resume
+static inline void usb_resume_clock(void)
+{
+	PLL_CONFIG();
+	while (!(PLLCSR & (1<<PLOCK))) ;
+	USBCON &= ~(1<<FRZCLK);
+	UDINT = ~(1<<WAKEUPI);
+	UDIEN = (UDIEN & ~(1<<WAKEUPE)) | (1<<SUSPE);
+	usb_suspended_state = 0;
+}
+
 // USB Device Interrupt - handle all device-level events
-// the transmit buffer flushing is triggered by the start of frame
+// the idle timer is advanced by the start of frame, but the report
+// itself is written by the keyboard endpoint interrupt below
+//
+// Both USB interrupts are meant to do a bounded amount of work per
+// entry, so the TWI interrupt and the scan loop are never held off
+// for long.  That is argued from the code below only: no cycle count
+// has been taken from the disassembly and neither interrupt has been
+// timed, so there is no worst case figure yet.  The time spent in
+// each can be measured on PD6 by defining USB_ISR_TIMING, the pin is
+// high from just after the registers are saved until just before
+// they are restored.
+// The one known long case is the wakeup, which spins until the PLL
+// locks once per resume.  That wait has no figure of its own and no
+// timeout, so it is also the one loop here not bounded by the code.
+//
+// Nothing in either interrupt waits on the host.  The only loops are
+// the descriptor table search, the endpoint configuration and the
+// packet copies, all of which have fixed upper bounds.  Requests
+// answered with a single IN packet (GET_STATUS and the HID GETs) do
+// test TXINI, but it is already set once the setup packet has been
+// acknowledged so that test falls straight through.
 //
 ISR(USB_GEN_vect)
 {
-	uint8_t intbits, t, i;
+	uint8_t intbits, i;
 	static uint8_t div4=0;
 
+	USB_ISR_TIMING_BEGIN();
 	intbits = UDINT;
+	if (usb_suspended_state) {
+		// UDINT can't be written while the clock is frozen, so
+		// the only thing to look at is the wakeup from the host
+		if (intbits & (1<<WAKEUPI)) usb_resume_clock();
+		USB_ISR_TIMING_END();
+		return;
+	}
 	UDINT = 0;
+	if (intbits & (1<<SUSPI)) {
+		usb_suspend_clock();
+		USB_ISR_TIMING_END();
+		return;
+	}
 	if (intbits & (1<<EORSTI)) {
 		UENUM = 0;
 		UECONX = 1;
 		UECFG0X = EP_TYPE_CONTROL;
 		UECFG1X = EP_SIZE(ENDPOINT0_SIZE) | EP_SINGLE_BUFFER;
 		UEIENX = (1<<RXSTPE);
+		ep0_state = EP0_IDLE;
+		for (i=0; i<NUM_INTERFACES; i++) {
+			usb_report_pending[i] = USB_REPORT_NONE;
+		}
+		usb_remote_wakeup_enabled = 0;
 		usb_configuration = 0;
 	}
 	if ((intbits & (1<<SOFI)) && usb_configuration) {
+		for (i=0; i<NUM_INTERFACES; i++) {
+			if (usb_report_holdoff[i]) usb_report_holdoff[i]--;
+		}
 		if (keyboard_idle_config && (++div4 & 3) == 0) {
-			UENUM = KEYBOARD_ENDPOINT;
-			if (UEINTX & (1<<RWAL)) {
-				keyboard_idle_count++;
-				if (keyboard_idle_count == keyboard_idle_config) {
-					keyboard_idle_count = 0;
-					UEDATX = keyboard_modifier_keys;
-					UEDATX = 0;
-					for (i=0; i<6; i++) {
-						UEDATX = keyboard_keys[i];
-					}
-					UEINTX = 0x3A;
+			keyboard_idle_count++;
+			if (keyboard_idle_count == keyboard_idle_config) {
+				keyboard_idle_count = 0;
+				if (usb_report_pending[KEYBOARD_INTERFACE] == USB_REPORT_NONE) {
+					usb_report_pending[KEYBOARD_INTERFACE] = USB_REPORT_IDLE;
+					UENUM = KEYBOARD_ENDPOINT;
+					UEIENX = (1<<TXINE);
 				}
 			}
 		}
 	}
+	USB_ISR_TIMING_END();
 }
 
 // Misc functions to wait for ready and send/receive packets
@@ -456,16 +736,83 @@ static inline void usb_ack_out(void)
 	UEINTX = ~(1<<RXOUTI);
 }
 
-// USB Endpoint Interrupt - endpoint 0 is handled here.  The
-// other endpoints are manipulated by the user-callable
-// functions, and the start-of-frame interrupt.
-//
-ISR(USB_COM_vect)
+// Interrupt IN endpoints - only enabled while their interface has a
+// report pending, so this runs once per report and disables itself
+// again.  UENUM must already select the endpoint.
+static inline void usb_report_service(uint8_t interface, const uint8_t *report, uint8_t size)
+{
+	uint8_t i;
+
+	if (UEINTX & (1<<RWAL)) {
+		for (i=0; i<size; i++) {
+			UEDATX = report[i];
+		}
+		UEINTX = 0x3A;
+		usb_report_stats[interface].sent++;
+		usb_report_pending[interface] = USB_REPORT_NONE;
+	}
+	if (usb_report_pending[interface] == USB_REPORT_NONE) UEIENX = 0;
+}
+
+// Endpoint 0 - continue a control transfer started by an earlier
+// setup packet.  Only one IN or OUT packet is handled per call.
+static inline void usb_endpoint0_continue(uint8_t intbits)
+{
+	uint8_t i, n;
+
+	if (ep0_state == EP0_DESCRIPTOR_IN) {
+		if (intbits & (1<<RXOUTI)) {
+			// host ended the data stage early, abort
+			ep0_state = EP0_IDLE;
+		} else if (intbits & (1<<TXINI)) {
+			n = ep0_desc_len < ENDPOINT0_SIZE ? ep0_desc_len : ENDPOINT0_SIZE;
+			for (i = n; i; i--) {
+				UEDATX = pgm_read_byte(ep0_desc_addr++);
+			}
+			ep0_desc_len -= n;
+			usb_send_in();
+			// a full last packet is followed by a zero length one
+			if (n < ENDPOINT0_SIZE) ep0_state = EP0_IDLE;
+		}
+	} else if (ep0_state == EP0_SET_ADDRESS) {
+		if (intbits & (1<<TXINI)) {
+			// status stage is done, the new address applies now
+			UDADDR |= (1<<ADDEN);
+			ep0_state = EP0_IDLE;
+		}
+	} else if (ep0_state == EP0_SET_REPORT) {
+		if (intbits & (1<<RXOUTI)) {
+			keyboard_leds = UEDATX;
+			usb_ack_out();
+			usb_send_in();
+			ep0_state = EP0_IDLE;
+		}
+	} else if (ep0_state == EP0_RAW_SET_REPORT) {
+		if (intbits & (1<<RXOUTI)) {
+			// a short report is padded with zeros
+			if (!raw_command_pending) {
+				n = UEBCLX;
+				for (i=0; i<RAW_REPORT_SIZE; i++) {
+					raw_command[i] = i < n ? UEDATX : 0;
+				}
+				raw_command_pending = 1;
+			}
+			usb_ack_out();
+			usb_send_in();
+			ep0_state = EP0_IDLE;
+		}
+	}
+	if (ep0_state == EP0_IDLE) UEIENX = (1<<RXSTPE);
+}
+
+// Endpoint 0 - decode a setup packet.  Anything which can be answered
+// immediately is; anything which has to wait for the host is left in
+// ep0_state for usb_endpoint0_continue.
+static inline void usb_endpoint0_setup(void)
 {
-	uint8_t intbits;
 	const uint8_t *list;
 	const uint8_t *cfg;
-	uint8_t i, n, len, en;
+	uint8_t i, en;
 	uint8_t bmRequestType;
 	uint8_t bRequest;
 	uint16_t wValue;
@@ -475,170 +822,218 @@ ISR(USB_COM_vect)
 	const uint8_t *desc_addr;
 	uint8_t	desc_length;
 
-	UENUM = 0;
-	intbits = UEINTX;
-	if (intbits & (1<<RXSTPI)) {
-		bmRequestType = UEDATX;
-		bRequest = UEDATX;
-		wValue = UEDATX;
-		wValue |= (UEDATX << 8);
-		wIndex = UEDATX;
-		wIndex |= (UEDATX << 8);
-		wLength = UEDATX;
-		wLength |= (UEDATX << 8);
-		UEINTX = ~((1<<RXSTPI) | (1<<RXOUTI) | (1<<TXINI));
-		if (bRequest == GET_DESCRIPTOR) {
-			list = (const uint8_t *)descriptor_list;
-			for (i=0; ; i++) {
-				if (i >= NUM_DESC_LIST) {
-					UECONX = (1<<STALLRQ)|(1<<EPEN);  //stall
-					return;
-				}
-				desc_val = pgm_read_word(list);
-				if (desc_val != wValue) {
-					list += sizeof(struct descriptor_list_struct);
-					continue;
-				}
-				list += 2;
-				desc_val = pgm_read_word(list);
-				if (desc_val != wIndex) {
-					list += sizeof(struct descriptor_list_struct)-2;
-					continue;
-				}
-				list += 2;
-				desc_addr = (const uint8_t *)pgm_read_word(list);
-				list += 2;
-				desc_length = pgm_read_byte(list);
-				break;
+	bmRequestType = UEDATX;
+	bRequest = UEDATX;
+	wValue = UEDATX;
+	wValue |= (UEDATX << 8);
+	wIndex = UEDATX;
+	wIndex |= (UEDATX << 8);
+	wLength = UEDATX;
+	wLength |= (UEDATX << 8);
+	UEINTX = ~((1<<RXSTPI) | (1<<RXOUTI) | (1<<TXINI));
+	// a new setup packet cancels anything still in progress
+	ep0_state = EP0_IDLE;
+	UEIENX = (1<<RXSTPE);
+	if (bRequest == GET_DESCRIPTOR) {
+		list = (const uint8_t *)descriptor_list;
+		for (i=0; ; i++) {
+			if (i >= NUM_DESC_LIST) {
+				UECONX = (1<<STALLRQ)|(1<<EPEN);  //stall
+				return;
 			}
-			len = (wLength < 256) ? wLength : 255;
-			if (len > desc_length) len = desc_length;
-			do {
-				// wait for host ready for IN packet
-				do {
-					i = UEINTX;
-				} while (!(i & ((1<<TXINI)|(1<<RXOUTI))));
-				if (i & (1<<RXOUTI)) return;	// abort
-				// send IN packet
-				n = len < ENDPOINT0_SIZE ? len : ENDPOINT0_SIZE;
-				for (i = n; i; i--) {
-					UEDATX = pgm_read_byte(desc_addr++);
-				}
-				len -= n;
-				usb_send_in();
-			} while (len || n == ENDPOINT0_SIZE);
-			return;
-                }
-		if (bRequest == SET_ADDRESS) {
-			usb_send_in();
-			usb_wait_in_ready();
-			UDADDR = wValue | (1<<ADDEN);
-			return;
-		}
-		if (bRequest == SET_CONFIGURATION && bmRequestType == 0) {
-			usb_configuration = wValue;
-			usb_send_in();
-			cfg = endpoint_config_table;
-			for (i=1; i<5; i++) {
-				UENUM = i;
-				en = pgm_read_byte(cfg++);
-				UECONX = en;
-				if (en) {
-					UECFG0X = pgm_read_byte(cfg++);
-					UECFG1X = pgm_read_byte(cfg++);
-				}
+			desc_val = pgm_read_word(list);
+			if (desc_val != wValue) {
+				list += sizeof(struct descriptor_list_struct);
+				continue;
 			}
-        		UERST = 0x1E;
-        		UERST = 0;
-			return;
+			list += 2;
+			desc_val = pgm_read_word(list);
+			if (desc_val != wIndex) {
+				list += sizeof(struct descriptor_list_struct)-2;
+				continue;
+			}
+			list += 2;
+			desc_addr = (const uint8_t *)pgm_read_word(list);
+			list += 2;
+			desc_length = pgm_read_byte(list);
+			break;
 		}
-		if (bRequest == GET_CONFIGURATION && bmRequestType == 0x80) {
-			usb_wait_in_ready();
-			UEDATX = usb_configuration;
-			usb_send_in();
-			return;
+		ep0_desc_addr = desc_addr;
+		ep0_desc_len = (wLength < 256) ? wLength : 255;
+		if (ep0_desc_len > desc_length) ep0_desc_len = desc_length;
+		// the packets are sent from the TXINI interrupt
+		ep0_state = EP0_DESCRIPTOR_IN;
+		UEIENX = (1<<RXSTPE)|(1<<TXINE);
+		return;
+	}
+	if (bRequest == SET_ADDRESS) {
+		// the address must only be enabled once the status stage
+		// has completed, so ADDEN is set from the TXINI interrupt
+		UDADDR = wValue & 0x7F;
+		usb_send_in();
+		ep0_state = EP0_SET_ADDRESS;
+		UEIENX = (1<<RXSTPE)|(1<<TXINE);
+		return;
+	}
+	if (bRequest == SET_CONFIGURATION && bmRequestType == 0) {
+		usb_configuration = wValue;
+		for (i=0; i<NUM_INTERFACES; i++) {
+			usb_report_pending[i] = USB_REPORT_NONE;
+		}
+		usb_send_in();
+		cfg = (const uint8_t *)endpoint_config_table;
+		for (i=1; i<=MAX_ENDPOINT; i++) {
+			UENUM = i;
+			en = pgm_read_byte(cfg);
+			UECONX = en;
+			if (en) {
+				UECFG0X = pgm_read_byte(cfg+1);
+				UECFG1X = pgm_read_byte(cfg+2);
+			}
+			cfg += sizeof(struct endpoint_config_struct);
 		}
+		UERST = 0x1E;
+		UERST = 0;
+		UENUM = 0;
+		return;
+	}
+	if (bRequest == GET_CONFIGURATION && bmRequestType == 0x80) {
+		usb_wait_in_ready();
+		UEDATX = usb_configuration;
+		usb_send_in();
+		return;
+	}
 
-		if (bRequest == GET_STATUS) {
-			usb_wait_in_ready();
-			i = 0;
+	if (bRequest == GET_STATUS) {
+		usb_wait_in_ready();
+		i = 0;
 #ifdef SUPPORT_ENDPOINT_HALT
-			if (bmRequestType == 0x82) {
-				UENUM = wIndex;
-				if (UECONX & (1<<STALLRQ)) i = 1;
-				UENUM = 0;
-			}
+		if (bmRequestType == 0x82) {
+			UENUM = wIndex;
+			if (UECONX & (1<<STALLRQ)) i = 1;
+			UENUM = 0;
+		}
 #endif
-			UEDATX = i;
-			UEDATX = 0;
+		if (bmRequestType == 0x80 && usb_remote_wakeup_enabled) i = 2;
+		UEDATX = i;
+		UEDATX = 0;
+		usb_send_in();
+		return;
+	}
+	if ((bRequest == CLEAR_FEATURE || bRequest == SET_FEATURE)
+	  && bmRequestType == 0x00 && wValue == DEVICE_REMOTE_WAKEUP) {
+		usb_remote_wakeup_enabled = (bRequest == SET_FEATURE);
+		usb_send_in();
+		return;
+	}
+#ifdef SUPPORT_ENDPOINT_HALT
+	if ((bRequest == CLEAR_FEATURE || bRequest == SET_FEATURE)
+	  && bmRequestType == 0x02 && wValue == 0) {
+		i = wIndex & 0x7F;
+		if (i >= 1 && i <= MAX_ENDPOINT) {
 			usb_send_in();
+			UENUM = i;
+			if (bRequest == SET_FEATURE) {
+				UECONX = (1<<STALLRQ)|(1<<EPEN);
+			} else {
+				UECONX = (1<<STALLRQC)|(1<<RSTDT)|(1<<EPEN);
+				UERST = (1 << i);
+				UERST = 0;
+			}
+			UENUM = 0;
 			return;
 		}
-#ifdef SUPPORT_ENDPOINT_HALT
-		if ((bRequest == CLEAR_FEATURE || bRequest == SET_FEATURE)
-		  && bmRequestType == 0x02 && wValue == 0) {
-			i = wIndex & 0x7F;
-			if (i >= 1 && i <= MAX_ENDPOINT) {
-				usb_send_in();
-				UENUM = i;
-				if (bRequest == SET_FEATURE) {
-					UECONX = (1<<STALLRQ)|(1<<EPEN);
-				} else {
-					UECONX = (1<<STALLRQC)|(1<<RSTDT)|(1<<EPEN);
-					UERST = (1 << i);
-					UERST = 0;
+	}
+#endif
+	if (wIndex == KEYBOARD_INTERFACE) {
+		if (bmRequestType == 0xA1) {
+			if (bRequest == HID_GET_REPORT) {
+				usb_wait_in_ready();
+				UEDATX = keyboard_modifier_keys;
+				UEDATX = 0;
+				for (i=0; i<6; i++) {
+					UEDATX = keyboard_keys[i];
 				}
+				usb_send_in();
+				return;
+			}
+			if (bRequest == HID_GET_IDLE) {
+				usb_wait_in_ready();
+				UEDATX = keyboard_idle_config;
+				usb_send_in();
+				return;
+			}
+			if (bRequest == HID_GET_PROTOCOL) {
+				usb_wait_in_ready();
+				UEDATX = keyboard_protocol;
+				usb_send_in();
 				return;
 			}
 		}
-#endif
-		if (wIndex == KEYBOARD_INTERFACE) {
-			if (bmRequestType == 0xA1) {
-				if (bRequest == HID_GET_REPORT) {
-					usb_wait_in_ready();
-					UEDATX = keyboard_modifier_keys;
-					UEDATX = 0;
-					for (i=0; i<6; i++) {
-						UEDATX = keyboard_keys[i];
-					}
-					usb_send_in();
-					return;
-				}
-				if (bRequest == HID_GET_IDLE) {
-					usb_wait_in_ready();
-					UEDATX = keyboard_idle_config;
-					usb_send_in();
-					return;
-				}
-				if (bRequest == HID_GET_PROTOCOL) {
-					usb_wait_in_ready();
-					UEDATX = keyboard_protocol;
-					usb_send_in();
-					return;
-				}
+		if (bmRequestType == 0x21) {
+			if (bRequest == HID_SET_REPORT) {
+				// the LED byte arrives in the data stage
+				ep0_state = EP0_SET_REPORT;
+				UEIENX = (1<<RXSTPE)|(1<<RXOUTE);
+				return;
 			}
-			if (bmRequestType == 0x21) {
-				if (bRequest == HID_SET_REPORT) {
-					usb_wait_receive_out();
-					keyboard_leds = UEDATX;
-					usb_ack_out();
-					usb_send_in();
-					return;
-				}
-				if (bRequest == HID_SET_IDLE) {
-					keyboard_idle_config = (wValue >> 8);
-					keyboard_idle_count = 0;
-					usb_send_in();
-					return;
-				}
-				if (bRequest == HID_SET_PROTOCOL) {
-					keyboard_protocol = wValue;
-					usb_send_in();
-					return;
-				}
+			if (bRequest == HID_SET_IDLE) {
+				keyboard_idle_config = (wValue >> 8);
+				keyboard_idle_count = 0;
+				usb_send_in();
+				return;
+			}
+			if (bRequest == HID_SET_PROTOCOL) {
+				keyboard_protocol = wValue;
+				usb_send_in();
+				return;
 			}
 		}
 	}
+	if (wIndex == RAW_INTERFACE && bmRequestType == 0x21 &&
+	  bRequest == HID_SET_REPORT) {
+		// the command arrives in the data stage
+		ep0_state = EP0_RAW_SET_REPORT;
+		UEIENX = (1<<RXSTPE)|(1<<RXOUTE);
+		return;
+	}
+	if ((wIndex == MOUSE_INTERFACE || wIndex == CONSUMER_INTERFACE ||
+	  wIndex == RAW_INTERFACE) &&
+	  bmRequestType == 0x21 && bRequest == HID_SET_IDLE) {
+		// mouse, media key and raw reports only go out when something
+		// changes, so there is no idle rate to keep
+		usb_send_in();
+		return;
+	}
 	UECONX = (1<<STALLRQ) | (1<<EPEN);	// stall
 }
 
+// USB Endpoint Interrupt - endpoint 0 and the interrupt IN endpoints
+// are handled here.  The IN endpoints are checked in interface order,
+// so the keyboard always goes first, and only one endpoint is
+// serviced per entry; anything else pending is picked up when the
+// interrupt fires again straight afterwards.  That keeps the worst
+// case to one packet rather than the sum of all of them.
+//
+ISR(USB_COM_vect)
+{
+	uint8_t intbits;
+
+	USB_ISR_TIMING_BEGIN();
+#define USB_INTERFACE_SERVICE(name, subclass, protocol, report, ep, size, buffer, interval, policy, limit) \
+	if (UEINT & (1<<(ep))) { \
+		UENUM = (ep); \
+		usb_report_service(name##_INTERFACE, name##_report, size); \
+	} else
+	USB_INTERFACE_LIST(USB_INTERFACE_SERVICE)
+	{
+		UENUM = 0;
+		intbits = UEINTX;
+		if (intbits & (1<<RXSTPI)) {
+			usb_endpoint0_setup();
+		} else {
+			usb_endpoint0_continue(intbits);
+		}
+	}
+	USB_ISR_TIMING_END();
+}
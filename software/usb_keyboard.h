@@ -5,11 +5,61 @@
 
 #include <stdint.h>
 
+// How the report scheduler treats a new report when the previous one
+// from the same interface has not been collected by the host yet
+#define USB_REPORT_STATE	0	// refuse it, the caller retries so no state change is lost
+#define USB_REPORT_ACCUMULATE	1	// merge it, byte 0 is replaced and the rest are added as deltas, refuse it if they don't fit
+#define USB_REPORT_LIMITED	2	// drop it, and accept at most one report per limit frames
+
+// Every HID interface, each with one interrupt IN endpoint, in
+// priority order: when several have reports waiting the first one
+// listed is serviced first.  The endpoint constants and report
+// descriptors named here live in usb_keyboard.c.
+//
+//	name, subclass, protocol, report descriptor, endpoint, size, buffer, bInterval, policy, limit
+#define USB_INTERFACE_LIST(X) \
+	X(KEYBOARD, 0x01, 0x01, keyboard_hid_report_desc, KEYBOARD_ENDPOINT, KEYBOARD_SIZE, KEYBOARD_BUFFER, KEYBOARD_INTERVAL, USB_REPORT_STATE, 0) \
+	X(MOUSE, 0x00, 0x00, mouse_hid_report_desc, MOUSE_ENDPOINT, MOUSE_SIZE, MOUSE_BUFFER, MOUSE_INTERVAL, USB_REPORT_ACCUMULATE, 0) \
+	X(CONSUMER, 0x00, 0x00, consumer_hid_report_desc, CONSUMER_ENDPOINT, CONSUMER_SIZE, CONSUMER_BUFFER, CONSUMER_INTERVAL, USB_REPORT_STATE, 0) \
+	X(RAW, 0x00, 0x00, raw_hid_report_desc, RAW_ENDPOINT, RAW_SIZE, RAW_BUFFER, RAW_INTERVAL, USB_REPORT_STATE, 0)
+
+#define USB_INTERFACE_NUMBER(name, subclass, protocol, report, ep, size, buffer, interval, policy, limit) \
+	name##_INTERFACE,
+enum {
+	USB_INTERFACE_LIST(USB_INTERFACE_NUMBER)
+	NUM_INTERFACES
+};
+
+struct usb_report_stats {
+	uint16_t sent;
+	uint16_t coalesced;
+	uint16_t dropped;
+};
+
 void usb_init(void);
 uint8_t usb_configured(void);
 void usb_disable(void);
+uint8_t usb_suspended(void);
+int8_t usb_remote_wakeup(void);
 
 int8_t usb_keyboard_send(void);
+int8_t usb_report_queue(uint8_t interface, const uint8_t *report);
+void usb_report_get_stats(uint8_t interface, struct usb_report_stats *stats);
+int8_t usb_raw_receive(uint8_t *report);
+
+// Bytes of a mouse report, movement is relative
+#define MOUSE_REPORT_BUTTONS	0
+#define MOUSE_REPORT_X		1
+#define MOUSE_REPORT_Y		2
+#define MOUSE_REPORT_WHEEL	3
+#define MOUSE_REPORT_SIZE	8
+
+// Bytes of a consumer control report, a bit for each media key
+#define CONSUMER_REPORT_KEYS	0
+#define CONSUMER_REPORT_SIZE	8
+
+// Raw reports from and to a host tool, the bytes are up to the caller
+#define RAW_REPORT_SIZE		8
 
 extern uint8_t keyboard_modifier_keys;
 extern uint8_t keyboard_keys[6];